@@ -0,0 +1,207 @@
+// Runs the same program and inputs through every Interpreter::Engine and reports wall time and,
+// where the kernel allows perf_event_open, branch misses and retired instructions. Then the same for
+// the engines that can check MUL, ADD and SUB for overflow, with and without checking.
+//
+// Usage: bench_interpreter [runs] [program]
+
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "interpreter.hpp"
+
+using namespace std::literals;
+
+constexpr auto ENGINES = std::array{
+	std::pair{"Loop"sv,	Interpreter::Engine::Loop},
+	std::pair{"Threaded"sv,	Interpreter::Engine::Threaded},
+	std::pair{"Tail_Call"sv,	Interpreter::Engine::Tail_Call},
+	std::pair{"Jit"sv,		Interpreter::Engine::Jit},
+	std::pair{"Native"sv,	Interpreter::Engine::Native},
+	std::pair{"Register"sv,	Interpreter::Engine::Register},
+	std::pair{"Stack_Cache"sv,	Interpreter::Engine::Stack_Cache},
+	std::pair{"Block"sv,	Interpreter::Engine::Block},
+	std::pair{"Trace"sv,	Interpreter::Engine::Trace},
+	std::pair{"Quickening"sv,	Interpreter::Engine::Quickening},
+	std::pair{"Tiered"sv,	Interpreter::Engine::Tiered},
+};
+
+// Counts a hardware event of the calling thread between start() and stop()
+struct Perf_Counter {
+	int fd = -1;
+
+	explicit Perf_Counter(const uint64_t config) {
+#ifdef __linux__
+		auto attr = perf_event_attr{};
+		std::memset(&attr, 0, sizeof(attr));
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.size = sizeof(attr);
+		attr.config = config;
+		attr.disabled = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+#else
+		(void)config;
+#endif
+	}
+
+	~Perf_Counter() {
+#ifdef __linux__
+		if (fd != -1)
+			close(fd);
+#endif
+	}
+
+	Perf_Counter(const Perf_Counter&) = delete;
+	auto operator= (const Perf_Counter&) -> Perf_Counter& = delete;
+
+	auto start() -> void {
+#ifdef __linux__
+		if (fd != -1) {
+			ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+			ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+		}
+#endif
+	}
+
+	auto stop() -> std::optional<uint64_t> {
+#ifdef __linux__
+		if (fd != -1) {
+			ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+			if (auto count = uint64_t{};
+				read(fd, &count, sizeof(count)) == sizeof(count))
+			{
+				return count;
+			}
+		}
+#endif
+		return std::nullopt;
+	}
+};
+
+auto per_run(const std::optional<uint64_t> count, const size_t runs) -> std::string {
+	if (count.has_value())
+		return std::to_string(*count / runs);
+	else
+		return "n/a";
+}
+
+auto main(int argc, char** argv) -> int {
+	const auto runs = argc > 1 ? std::stoul(argv[1]) : 100'000ul;
+	const auto program_path = argc > 2 ? std::string{argv[2]} : BENCH_PROGRAM_DIR "/interpreter.naive_factorial.txt"s;
+
+	auto program = std::stringstream{};
+	if (auto f = std::ifstream{program_path}; f)
+		program << f.rdbuf();
+	else {
+		std::cerr << "Error: could not open " << program_path << '\n';
+		return 1;
+	}
+
+	// Same inputs for every engine, small enough to keep factorial-like loops short
+	auto input = std::string{};
+	for (auto i = 0ul; i < runs; ++i)
+		input += std::to_string(10 + i % 90) + ' ';
+
+	const auto header = [] {
+		std::cout
+			<< std::left << std::setw(16) << "Engine"
+			<< std::right << std::setw(12) << "ns/run"
+			<< std::setw(16) << "branch-miss/run"
+			<< std::setw(16) << "instr/run"
+			<< '\n';
+	};
+
+	// Prints the row of one engine and returns what it wrote, or nullopt if the program did not prepare
+	const auto bench = [&] (const std::string_view name, const Interpreter::Engine engine, const std::string& input, const Stack::Overflow overflow) -> std::optional<std::string> {
+		auto cin = std::istringstream{input};
+		auto cout = std::ostringstream{};
+		auto interpreter = Interpreter{cin, cout};
+		interpreter.arithmetic(overflow);
+
+		auto program_ss = std::istringstream{program.str()};
+		if (not interpreter.prepare(program_ss))
+			return std::nullopt;
+
+		auto branch_misses = Perf_Counter{PERF_COUNT_HW_BRANCH_MISSES};
+		auto instructions = Perf_Counter{PERF_COUNT_HW_INSTRUCTIONS};
+
+		const auto begin = std::chrono::steady_clock::now();
+		branch_misses.start();
+		instructions.start();
+
+		for (auto i = 0ul; i < runs; ++i)
+			interpreter.run([] (auto&&) {}, engine);
+
+		const auto misses = branch_misses.stop();
+		const auto retired = instructions.stop();
+		const auto elapsed = std::chrono::steady_clock::now() - begin;
+
+		std::cout
+			<< std::left << std::setw(16) << name
+			<< std::right << std::setw(12) << std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count() / runs
+			<< std::setw(16) << per_run(misses, runs)
+			<< std::setw(16) << per_run(retired, runs);
+		return cout.str();
+	};
+
+	std::cout
+		<< "Program: " << program_path << '\n'
+		<< "Runs:    " << runs << "\n\n";
+	header();
+
+	auto reference_output = std::optional<std::string>{};
+	for (const auto& [name, engine] : ENGINES) {
+		const auto output = bench(name, engine, input, Stack::Overflow::Unchecked);
+		if (not output.has_value())
+			return 1;
+
+		// Every engine must produce the same output as the first one
+		if (not reference_output.has_value())
+			reference_output = output;
+		else if (*reference_output != *output)
+			std::cout << "  OUTPUT MISMATCH";
+
+		std::cout << '\n';
+	}
+
+	// Inputs that never overflow, so that checking for it is all that differs
+	auto fitting = std::string{};
+	for (auto i = 0ul; i < runs; ++i)
+		fitting += std::to_string(i % 13) + ' ';
+
+	std::cout << "\nOverflow, inputs up to 12\n\n";
+	header();
+
+	reference_output.reset();
+	for (const auto& [name, engine] : { ENGINES[0], ENGINES[1] }) {
+		for (const auto overflow : { Stack::Overflow::Unchecked, Stack::Overflow::Error }) {
+			const auto output = bench(std::string{name} + (overflow == Stack::Overflow::Error ? " Error" : ""), engine, fitting, overflow);
+			if (not output.has_value())
+				return 1;
+
+			if (not reference_output.has_value())
+				reference_output = output;
+			else if (*reference_output != *output)
+				std::cout << "  OUTPUT MISMATCH";
+
+			std::cout << '\n';
+		}
+	}
+}
@@ -0,0 +1,33 @@
+# sage_transpile(<target> PROGRAM <file> FUNCTION <name> [STACK <capacity>])
+#
+# Compiles PROGRAM into the header <name>.hpp defining `auto <name>(Stack&, std::istream&, std::ostream&) -> Machine::Exit`
+# and makes it, plus the sage headers it needs, includable from <target>.
+function(sage_transpile target)
+	cmake_parse_arguments(ARG "" "PROGRAM;FUNCTION;STACK" "" ${ARGN})
+
+	if (NOT ARG_PROGRAM OR NOT ARG_FUNCTION)
+		message(FATAL_ERROR "sage_transpile: PROGRAM and FUNCTION are required")
+	endif()
+	if (NOT ARG_STACK)
+		set(ARG_STACK 256)
+	endif()
+
+	get_filename_component(program ${ARG_PROGRAM} ABSOLUTE)
+	set(dir ${CMAKE_CURRENT_BINARY_DIR}/transpiled)
+	set(header ${dir}/${ARG_FUNCTION}.hpp)
+
+	add_custom_command(
+		OUTPUT ${header}
+		COMMAND ${CMAKE_COMMAND} -E make_directory ${dir}
+		COMMAND sage_transpile ${program} ${ARG_FUNCTION} ${header} ${ARG_STACK}
+		DEPENDS sage_transpile ${program}
+		COMMENT "Transpiling ${ARG_PROGRAM} to ${ARG_FUNCTION}()"
+	)
+
+	target_sources(${target} PRIVATE ${header})
+	target_include_directories(${target}
+		PRIVATE
+			${dir}
+			${PROJECT_SOURCE_DIR}/src
+	)
+endfunction()
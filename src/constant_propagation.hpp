@@ -0,0 +1,194 @@
+#pragma once
+
+#include <vector>
+#include <optional>
+#include <algorithm>
+
+#include "stack.hpp"
+#include "instruction.hpp"
+#include "stack_depth.hpp"
+
+// Which stack slots hold the same constant on every path to an instruction, from abstract interpretation
+// over the static jumps of a program. A JMPZ on a known condition only goes the way it goes, whatever
+// only the other way leads to is never looked at.
+//
+// Only the top of the stack is tracked, whatever lies below what a program pushed is unknown.
+// Comparisons are inverted like everywhere else, they are folded with Instruction::evaluate().
+//
+// rewrite() puts it to use one instruction at a time, so that nothing has to be renumbered and
+// Peephole can clean up after it:
+//
+//	DUP of a constant k		PUSH k
+//	JMPZ on a constant other than 0	POP 2
+//
+// Usage:
+//
+// const auto constants = Constant_Propagation::analyze(instructions);
+// if (const auto top = constants.top(i); top.has_value())	// TOP before instructions[i]
+struct Constant_Propagation {
+	using Integer = Stack::Integer;
+	using Opcode = Instruction::Opcode;
+
+	using Value = std::optional<Integer>;	// nullopt when it is not always the same
+	using Slots = std::vector<Value>;	// The top of the stack, back() is TOP
+
+	static constexpr auto tracked = size_t{16};	// Slots deep, more is hardly ever a constant
+
+	std::vector<std::optional<Slots>> at;	// Before each instruction, nullopt where it is unreachable
+	bool dynamic = false;			// Computed jumps, nothing is known
+
+	static auto analyze(const Instructions& instructions) -> Constant_Propagation {
+		const auto size = instructions.size();
+
+		auto analysis = Constant_Propagation{};
+		analysis.at.assign(size, std::nullopt);
+		if (Stack_Depth::analyze(instructions).dynamic) {
+			analysis.dynamic = true;
+			return analysis;
+		}
+
+		// Joins only ever forget slots or values, so this settles
+		auto worklist = std::vector<size_t>{};
+		const auto join = [&] (const size_t i, const Slots& slots) {
+			if (i >= size)
+				return;
+
+			auto& at = analysis.at[i];
+			if (not at.has_value()) {
+				at = slots;
+				worklist.push_back(i);
+				return;
+			}
+
+			const auto depth = std::min(at->size(), slots.size());
+			auto joined = Slots(depth);
+			for (auto k = size_t{0}; k < depth; ++k) {
+				const auto& a = (*at)[at->size() - depth + k];
+				const auto& b = slots[slots.size() - depth + k];
+				joined[k] = a == b ? a : std::nullopt;
+			}
+
+			if (joined != *at) {
+				at = std::move(joined);
+				worklist.push_back(i);
+			}
+		};
+
+		join(0, {});
+		while (not worklist.empty()) {
+			const auto i = worklist.back();
+			worklist.pop_back();
+
+			const auto& instr = instructions[i];
+			if (not Stack_Depth::needs(instr).has_value())
+				continue;	// Always fails
+
+			auto slots = *analysis.at[i];
+			if (instr.op != Opcode::JMPZ) {
+				step(slots, instr);
+				join(i + 1, slots);
+				continue;
+			}
+
+			// Static, the target is the PUSH right before it
+			pop(slots);
+			const auto condition = pop(slots);
+			const auto target = *instructions[i - 1].arg;
+
+			if (condition != 0)
+				join(i + 1, slots);
+			if ((not condition.has_value() or *condition == 0) and 0 <= target)
+				join(static_cast<size_t>(target), slots);
+		}
+
+		return analysis;
+	}
+
+	// n slots below TOP before instructions[i]
+	auto top(const size_t i, const size_t n = 0) const -> Value {
+		if (not at[i].has_value() or at[i]->size() <= n)
+			return std::nullopt;
+		else
+			return (*at[i])[at[i]->size() - 1 - n];
+	}
+
+	// False when there was nothing to rewrite
+	static auto rewrite(Instructions& instructions) -> bool {
+		const auto constants = analyze(instructions);
+
+		auto changed = false;
+		for (auto i = size_t{0}; i < instructions.size(); ++i) {
+			auto& instr = instructions[i];
+			if (const auto top = constants.top(i); instr.op == Opcode::DUP and top.has_value()) {
+				instr = Instruction{ Opcode::PUSH, *top };
+				changed = true;
+			}
+			else if (const auto condition = constants.top(i, 1); instr.op == Opcode::JMPZ and condition.has_value() and *condition != 0) {
+				instr = Instruction{ Opcode::POP, 2 };
+				changed = true;
+			}
+		}
+		return changed;
+	}
+
+private:
+	static auto pop(Slots& slots) -> Value {
+		if (slots.empty())
+			return std::nullopt;
+
+		const auto value = slots.back();
+		slots.pop_back();
+		return value;
+	}
+
+	// What an instruction that succeeded leaves, JMPZ aside
+	static auto step(Slots& slots, const Instruction& instr) -> void {
+		switch (instr.op) {
+			case Opcode::READ:	slots.push_back(std::nullopt);	break;
+			case Opcode::WRITE:	pop(slots);			break;
+			case Opcode::PUSH:	slots.push_back(instr.arg);	break;
+
+			case Opcode::DUP:
+				if (slots.empty())
+					slots.push_back(std::nullopt);
+				slots.push_back(slots.back());
+				break;
+
+			case Opcode::MUL:
+			case Opcode::ADD:
+			case Opcode::SUB:
+			case Opcode::GT:
+			case Opcode::LT:
+			case Opcode::EQ: {
+				const auto top = pop(slots);
+				const auto second = pop(slots);
+				if (top.has_value() and second.has_value())
+					slots.push_back(Instruction::evaluate(instr.op, *top, *second));
+				else
+					slots.push_back(std::nullopt);
+				break;
+			}
+
+			case Opcode::POP:
+				for (auto n = *instr.arg; n > 0 and not slots.empty(); --n)
+					slots.pop_back();
+				break;
+
+			case Opcode::ROT: {
+				// There were at least n values, whatever was below the tracked ones is unknown
+				const auto n = static_cast<size_t>(*instr.arg);
+				if (n <= slots.size())
+					std::rotate(slots.end() - static_cast<std::ptrdiff_t>(n), slots.end() - 1, slots.end());
+				else if (not slots.empty())
+					slots.pop_back();	// Sinks below the tracked ones, the rest moves up
+				break;
+			}
+
+			case Opcode::JMPZ:
+				break;
+		}
+
+		if (slots.size() > tracked)
+			slots.erase(slots.begin(), slots.end() - static_cast<std::ptrdiff_t>(tracked));
+	}
+};
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <vector>
+#include <optional>
+
+#include "stack.hpp"
+#include "instruction.hpp"
+#include "stack_depth.hpp"
+
+// Basic blocks of a program and the edges between them. A block starts at 0, at every static jump
+// target and after every JMPZ, and only its last instruction can be a JMPZ.
+//
+// Static jumps are the same as for Stack_Depth: `PUSH t; JMPZ`, as long as no jump lands on a JMPZ.
+// In a program with any other jump every instruction is a block of its own, whatever it jumps to
+// could be anywhere. A block ending in such a jump is computed(), its successors only say where it
+// falls through to.
+//
+// Usage:
+//
+// const auto control_flow = Control_Flow::build(instructions);
+// for (const auto successor : control_flow.block_at(i).successors)
+struct Control_Flow {
+	using Integer = Stack::Integer;
+	using Opcode = Instruction::Opcode;
+
+	struct Block {
+		size_t begin, end;			// instructions[begin, end)
+		std::vector<size_t> successors;		// Fall through first, jumps outside of the program have none
+		std::vector<size_t> predecessors;
+		bool computed = false;			// Ends in a JMPZ that could go to any block
+	};
+
+	std::vector<Block> blocks;	// In program order
+	std::vector<size_t> block_of;	// Per instruction
+	bool dynamic = false;		// Has computed jumps
+
+	static auto build(const Instructions& instructions) -> Control_Flow {
+		const auto size = instructions.size();
+
+		auto control_flow = Control_Flow{};
+		control_flow.dynamic = Stack_Depth::analyze(instructions).dynamic;
+
+		const auto target = [&] (const size_t i) -> std::optional<size_t> {
+			if (const auto t = Stack_Depth::static_target(instructions, i);
+				not control_flow.dynamic and t.has_value() and 0 <= *t and static_cast<size_t>(*t) < size)
+			{
+				return static_cast<size_t>(*t);
+			}
+			return std::nullopt;
+		};
+
+		auto leader = std::vector<bool>(size, control_flow.dynamic);
+		if (size > 0)
+			leader[0] = true;
+		for (auto i = size_t{0}; i < size; ++i) {
+			if (instructions[i].op != Opcode::JMPZ)
+				continue;
+			if (i + 1 < size)
+				leader[i + 1] = true;
+			if (const auto t = target(i); t.has_value())
+				leader[*t] = true;
+		}
+
+		control_flow.block_of.resize(size);
+		for (auto i = size_t{0}; i < size; ++i) {
+			if (leader[i])
+				control_flow.blocks.push_back(Block{ i, i, {}, {}, false });
+			control_flow.blocks.back().end = i + 1;
+			control_flow.block_of[i] = control_flow.blocks.size() - 1;
+		}
+
+		for (auto b = size_t{0}; b < control_flow.blocks.size(); ++b) {
+			auto& block = control_flow.blocks[b];
+			const auto last = block.end - 1;
+			const auto edge = [&] (const size_t successor) {
+				block.successors.push_back(successor);
+				control_flow.blocks[successor].predecessors.push_back(b);
+			};
+
+			// A JMPZ only falls through when the condition is not 0, anything else always does
+			if (block.end < size)
+				edge(b + 1);
+
+			if (instructions[last].op != Opcode::JMPZ)
+				continue;
+			else if (const auto t = target(last); t.has_value()) {
+				// Both ways to the same block is still one edge
+				if (const auto successor = control_flow.block_of[*t]; block.end >= size or successor != b + 1)
+					edge(successor);
+			}
+			else if (control_flow.dynamic)
+				block.computed = true;
+		}
+
+		return control_flow;
+	}
+
+	auto block_at(const size_t i) const -> const Block& {
+		return blocks[block_of[i]];
+	}
+};
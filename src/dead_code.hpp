@@ -0,0 +1,66 @@
+#pragma once
+
+#include <vector>
+
+#include "stack.hpp"
+#include "instruction.hpp"
+#include "stack_depth.hpp"
+#include "constant_propagation.hpp"
+
+// Drops every instruction that can never run: past one that always fails, or only reachable the way
+// a JMPZ on a known condition never goes (see Constant_Propagation). What is left is packed together
+// and static jump targets are renumbered to match, a jump onto something that is gone never happens
+// in the first place. Programs with computed jumps are left alone.
+//
+// Usage:
+//
+// auto lines = std::vector<size_t>{};	// Where each instruction was before, for diagnostics
+// Dead_Code::eliminate(instructions, lines);
+struct Dead_Code {
+	using Integer = Stack::Integer;
+	using Opcode = Instruction::Opcode;
+
+	// False when everything can run
+	static auto eliminate(Instructions& instructions, std::vector<size_t>& lines) -> bool {
+		const auto size = instructions.size();
+		const auto constants = Constant_Propagation::analyze(instructions);
+		if (constants.dynamic)
+			return false;
+
+		auto renumbered = std::vector<size_t>(size + 1, 0);
+		auto kept = size_t{0};
+		for (auto i = size_t{0}; i < size; ++i) {
+			renumbered[i] = kept;
+			if (constants.at[i].has_value())
+				++kept;
+		}
+		renumbered[size] = kept;
+
+		if (kept == size)
+			return false;
+
+		// Targets outside of the program stay outside of it, they still have to fail
+		for (auto i = size_t{1}; i < size; ++i) {
+			if (const auto target = Stack_Depth::static_target(instructions, i);
+				instructions[i].op == Opcode::JMPZ and target.has_value() and 0 <= *target and static_cast<size_t>(*target) < size)
+			{
+				instructions[i - 1].arg = static_cast<Integer>(renumbered[static_cast<size_t>(*target)]);
+			}
+		}
+
+		auto packed = Instructions{};
+		auto packed_lines = std::vector<size_t>{};
+		packed.reserve(kept);
+		packed_lines.reserve(kept);
+		for (auto i = size_t{0}; i < size; ++i) {
+			if (constants.at[i].has_value()) {
+				packed.push_back(instructions[i]);
+				packed_lines.push_back(lines[i]);
+			}
+		}
+
+		instructions = std::move(packed);
+		lines = std::move(packed_lines);
+		return true;
+	}
+};
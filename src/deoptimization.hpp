@@ -0,0 +1,60 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include "stack.hpp"
+#include "machine.hpp"
+
+// Getting from what optimized code keeps on the Stack back to what the instructions would have there,
+// so that the generic interpreter can carry on wherever the optimized code stops.
+//
+// Optimized code is free to keep values out of the Stack, eg. constants it only ever uses as immediates.
+// Everywhere it could stop, a guard that does not go the way it speculated or an instruction that can
+// fail, it records a Point: the pc the instructions carry on at and the Layout of the top of the stack
+// the instructions would have there. Every slot of it is either a constant or the next value actually
+// on the Stack, so the values that are there are in the same order, just with the constants missing.
+//
+// Usage:
+//
+// const auto point = Deoptimization::Point{ pc, { { false, 0 }, { true, 7 } } };	// Whatever is there, then 7
+// return Deoptimization::resume(point, stack);	// State::Running at pc with 7 pushed
+struct Deoptimization {
+	using Integer = Stack::Integer;
+
+	struct Slot {
+		bool constant;
+		Integer k;	// Of a constant
+	};
+	using Layout = std::vector<Slot>;	// Bottom first
+
+	struct Point {
+		uint32_t pc;
+		Layout layout;
+	};
+
+	// Puts the constants back in between the values that are there
+	static auto materialize(const Layout& layout, Stack::Vector& stack) -> void {
+		auto constants = size_t{0};
+		for (const auto& slot : layout)
+			constants += slot.constant;
+		if (constants == 0)
+			return;
+
+		// From the top down, nothing is written before it has been read
+		auto from = stack.size();
+		stack.resize(stack.size() + constants);
+		auto to = stack.size();
+		for (auto slot = layout.size(); slot-- > 0; ) {
+			if (layout[slot].constant)
+				stack[--to] = layout[slot].k;
+			else
+				stack[--to] = stack[--from];
+		}
+	}
+
+	static auto resume(const Point& point, Stack::Vector& stack) -> Machine::Exit {
+		materialize(point.layout, stack);
+		return { Machine::State::Running, point.pc };
+	}
+};
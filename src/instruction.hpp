@@ -0,0 +1,94 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <vector>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <type_traits>
+#include <cassert>
+
+#include "stack.hpp"
+
+// A single line of a program, its name resolved once to an Opcode so that
+// execution only ever has to switch on a small integer.
+struct Instruction {
+	using Integer = Stack::Integer;
+	using Argument = std::optional<Integer>;
+
+	enum class Opcode : uint8_t {
+		READ, WRITE, DUP,
+		MUL, ADD, SUB,
+		GT, LT, EQ,
+		JMPZ, PUSH, POP, ROT,
+	};
+
+	static constexpr auto opcode_count = size_t{13};
+
+	// Indexed by Opcode
+	static constexpr auto names = std::array<std::string_view, opcode_count>{
+		"READ", "WRITE", "DUP",
+		"MUL", "ADD", "SUB",
+		"GT", "LT", "EQ",
+		"JMPZ", "PUSH", "POP", "ROT",
+	};
+
+	Opcode op;
+	Argument arg;
+
+	static constexpr auto name(const Opcode op) -> std::string_view {
+		return names[static_cast<size_t>(op)];
+	}
+
+	static constexpr auto opcode(const std::string_view name) -> std::optional<Opcode> {
+		if (const auto it = std::find(names.cbegin(), names.cend(), name);
+			it != names.cend())
+		{
+			return static_cast<Opcode>(std::distance(names.cbegin(), it));
+		}
+		else
+			return std::nullopt;
+	}
+
+	// What MUL, ADD, SUB, GT, LT and EQ push, called as op(TOP, SECOND) like Stack::pop_2_push_op.
+	// Arithmetic wraps around instead of overflowing, comparisons are inverted: 0 for True.
+	static constexpr auto evaluate(const Opcode op, const Integer top, const Integer second) -> Integer {
+		using Unsigned = std::make_unsigned_t<Integer>;
+		switch (op) {
+			case Opcode::MUL:	return static_cast<Integer>(static_cast<Unsigned>(top) * static_cast<Unsigned>(second));
+			case Opcode::ADD:	return static_cast<Integer>(static_cast<Unsigned>(top) + static_cast<Unsigned>(second));
+			case Opcode::SUB:	return static_cast<Integer>(static_cast<Unsigned>(top) - static_cast<Unsigned>(second));
+			case Opcode::GT:	return top <= second;
+			case Opcode::LT:	return top >= second;
+			case Opcode::EQ:	return top != second;
+			default:
+				assert(false and "Not a binary operation");
+				return 0;
+		}
+	}
+
+	// evaluate() where that is exactly op(TOP, SECOND), nullopt where MUL, ADD or SUB would wrap around
+	static auto evaluate_exact(const Opcode op, const Integer top, const Integer second) -> std::optional<Integer> {
+		auto result = Integer{};
+		switch (op) {
+			case Opcode::MUL:	return Stack::overflows(std::multiplies{}, top, second, result) ? std::nullopt : std::optional{result};
+			case Opcode::ADD:	return Stack::overflows(std::plus{}, top, second, result) ? std::nullopt : std::optional{result};
+			case Opcode::SUB:	return Stack::overflows(std::minus{}, top, second, result) ? std::nullopt : std::optional{result};
+			default:		return evaluate(op, top, second);
+		}
+	}
+
+	friend auto operator== (const Instruction&, const Instruction&) -> bool = default;
+
+	friend auto operator<< (std::ostream& o, const Instruction& i) -> std::ostream& {
+		o << std::left << std::setw(5) << name(i.op) << ' ';
+		if (i.arg.has_value())
+			return o << std::right << std::setw(5) << *i.arg;
+		else
+			return o << "     ";
+	}
+};
+using Instructions = std::vector<Instruction>;
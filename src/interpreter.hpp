@@ -7,9 +7,28 @@
 #include <sstream>
 #include <cassert>
 #include <iomanip>
-#include <unordered_map>
+#include <functional>
 
 #include "stack.hpp"
+#include "instruction.hpp"
+#include "machine.hpp"
+#include "superinstruction.hpp"
+#include "profile.hpp"
+#include "tail_call.hpp"
+#include "jit.hpp"
+#include "native.hpp"
+#include "register_vm.hpp"
+#include "stack_cache.hpp"
+#include "stack_depth.hpp"
+#include "verifier.hpp"
+#include "peephole.hpp"
+#include "control_flow.hpp"
+#include "trace.hpp"
+#include "loop_idiom.hpp"
+#include "partial_evaluation.hpp"
+#include "quickening.hpp"
+#include "tiering.hpp"
+#include "value_range.hpp"
 
 
 // Not alot of error handling will be done to keep the code cleaner
@@ -35,41 +54,68 @@
 struct Interpreter {
 	using Integer = Stack::Integer;
 
-	struct Instruction {
-		using Argument = std::optional<Integer>;
-
-		std::string name;
-		Argument arg;
-
-		friend auto operator<< (std::ostream& o, const Instruction& i) -> std::ostream& {
-			o << std::left << std::setw(5) << i.name << ' ';
-			if (i.arg.has_value())
-				return o << std::right << std::setw(5) << *i.arg;
-			else
-				return o << "     ";
-		}
-	};
-	using Instructions = std::vector<Instruction>;
+	using Instruction = ::Instruction;
+	using Instructions = ::Instructions;
+	using Opcode = Instruction::Opcode;
 
 	using PC = Instructions::const_iterator;
 
-	// Hashing
-	using String_Hasher = std::hash<std::string>;
-	using Hash_Result = size_t;
-
-	using Interpreter_Mutator = std::function<void(Interpreter&)>;
-
-	enum class State {
-		Running, Error, Done
+	using State = Machine::State;
+
+	// How run() dispatches the prepared instructions
+	enum class Engine {
+		Loop,		// execute() one instruction at a time, the callback sees every step
+		Threaded,	// Computed goto, the callback only sees the final result
+		Tail_Call,	// Handlers tail call each other with the state in registers, see tail_call.hpp
+		Jit,		// Native x86-64 code, Tail_Call wherever that is not available
+		Native,		// Built by the system compiler and dlopen()ed, see native.hpp. Jit wherever that fails
+		Register,	// Translated to a register machine, see register_vm.hpp. Threaded for whatever it hands back
+		Stack_Cache,	// Computed goto with the top of the stack in registers, see stack_cache.hpp. Threaded without GNU C
+		Block,		// One basic block at a time, see control_flow.hpp. The callback only sees the final result
+		Trace,		// Block, but hot loops run as traces, see trace.hpp
+		Quickening,	// Instructions rewrite themselves the first time they run, see quickening.hpp
+		Tiered,		// Loop, moving on to Quickening and Jit as it gets hot, see tiering.hpp. The callback only sees the final result
 	};
 
 
 private:
 	Instructions instructions;
+	Superinstruction::Code code;	// What Loop and Threaded dispatch on, one per instruction
+	Stack_Depth depth;
+	Value_Range ranges;
+	Value_Range::Interval input;	// What every READ is declared to read
+	Stack::Overflow overflow = Stack::Overflow::Unchecked;	// What MUL, ADD and SUB do about it, see arithmetic()
+	Superinstruction::Selection selection = Superinstruction::Selection::defaults();
+	std::vector<std::optional<Loop_Idiom::Kernel>> kernels;	// Where loops start, what Loop and Threaded run them as
+	bool loop_idioms = true;
+	Peephole::Level peephole = Peephole::Level::None;
+	std::vector<size_t> lines;	// Where each instruction was in the program handed to prepare()
 	PC pc;
 	Stack stack;
 	State state;
 
+	// Compiled forms of instructions, built on first use
+	std::optional<Tail_Call::Code> tail_call_code;
+	std::optional<Jit::Code> jit_code;	// Empty Jit::Code if it could not be compiled
+	std::optional<Native::Code> native_code;	// Same for Native::Code
+	std::optional<Register_VM::Code> register_code;
+	std::optional<Stack_Cache::Code> stack_cache_code;
+	std::optional<Control_Flow> control_flow;
+	std::vector<bool> unchecked_blocks;	// Per block of control_flow, nothing in it can fail
+	std::optional<Quickening::Code> quickened;	// This interpreter's own copy, rewritten as it runs
+	Tiering tiering;
+
+	// Per instruction, for loops starting there
+	struct Loop {
+		uint32_t count = 0;		// Backward jumps to it
+		bool untraceable = false;
+		std::optional<Trace::Code> trace;
+	};
+	std::vector<Loop> loops;
+
+	// Where every run gets to before it needs any input, Threaded, Block and Trace start there
+	std::optional<Partial_Evaluation::Known> snapshot;
+
 // Streams
 private:
 	std::istream& cin;
@@ -85,49 +131,150 @@ public:
 
 	// Prepare program
 	auto prepare(std::istream& program) -> bool {
+		return prepare(parse(program));
+	}
+
+	// Prepare instructions that did not come from text, eg. the output of a pass over parse()
+	auto prepare(Instructions program) -> bool {
 		// Reset program
-		instructions.clear();
+		instructions = Peephole::optimize(Verifier::verify(std::move(program)).instructions, peephole, lines, overflow);
+		code = Superinstruction::compile(instructions, selection);
+		depth = Stack_Depth::analyze(instructions);
+		for (auto i = size_t{0}; i < instructions.size(); ++i) {
+			if (Verifier::takes_argument(instructions[i].op) and not instructions[i].arg.has_value())
+				code[i].dispatch = invalid_dispatch;
+			else if (not code[i].fused() and depth.safe(i))
+				code[i].dispatch = static_cast<uint8_t>(unchecked_dispatch + code[i].dispatch);
+		}
+		kernels.assign(instructions.size(), std::nullopt);
+		if (loop_idioms)
+			kernels = Loop_Idiom::recognize(instructions);
+		for (auto i = size_t{0}; i < instructions.size(); ++i)
+			if (kernels[i].has_value() and code[i].dispatch != invalid_dispatch)
+				code[i].dispatch = kernel_dispatch;
+		ranges = Value_Range::analyze(instructions, input);
+		for (auto i = size_t{0}; i < instructions.size(); ++i) {
+			if (const auto op = instructions[i].op;
+				Value_Range::arithmetic(op) and not code[i].fused()
+				and code[i].dispatch != invalid_dispatch and code[i].dispatch != kernel_dispatch)
+			{
+				if (ranges.proven(i))
+					code[i].dispatch = static_cast<uint8_t>((depth.safe(i) ? unchecked_proven_dispatch : proven_dispatch) + offset(op));
+				else if (overflow == Stack::Overflow::Error)
+					code[i].dispatch = static_cast<uint8_t>((depth.safe(i) ? unchecked_overflow_dispatch : overflow_dispatch) + offset(op));
+			}
+		}
 		stack.clear();
+		tail_call_code.reset();
+		jit_code.reset();
+		native_code.reset();
+		register_code.reset();
+		stack_cache_code.reset();
+		control_flow.reset();
+		quickened.reset();
+		tiering = Tiering{instructions.size()};
+		loops.clear();
+		snapshot.reset();
 
-		{ // Read program and prepare interpreter
-			auto i = 0;
-			auto line = std::string{};
-			while (std::getline(program, line)) {
-				trim(line);
-				if (line.empty())
-					continue;
-				else {
-					auto line_ss = std::istringstream{std::move(line)};
+		if (instructions.empty()) {
+			std::cerr << "Error: prepare: Failed to read any instructions\n";
+			return false;
+		}
+		else
+			return true;
+	}
 
-					auto line_i = Integer{};
-					auto instr_name = std::string{};
-					auto instr_arg = Instruction::Argument{};
+	// Superinstructions the next prepare() fuses, eg. loaded from what tools/profile.cpp picked
+	auto select(const Superinstruction::Selection& superinstructions) -> void {
+		selection = superinstructions;
+	}
 
-					line_ss
-						>> line_i
-						>> instr_name
-						;
+	// Whether the next prepare() has Loop and Threaded run the loops Loop_Idiom recognizes in one go
+	auto idioms(const bool enabled) -> void {
+		loop_idioms = enabled;
+	}
 
-					assert(i++ == line_i and "Expect ascending order of instructions");
-					assert(instruction_map.contains(instr_name) and "Command not expected");
+	// Where instructions[i] of the prepared program was in the one handed to prepare(), they differ once
+	// it is optimized
+	auto line(const size_t i) const -> size_t {
+		return lines[i];
+	}
 
-					if (not line_ss.eof()) {	// Instruction argument exists
-						auto arg = Integer{};
-						line_ss >> arg;
-						instr_arg = arg;
-					}
+	// How hard the next prepare() optimizes, see peephole.hpp
+	auto optimize(const Peephole::Level level) -> void {
+		peephole = level;
+	}
+
+	// What the prepared program is known to leave on the stack, stack_depth().proven() when it can never underflow
+	auto stack_depth() const -> const Stack_Depth& {
+		return depth;
+	}
+
+	// Range the next prepare() may assume whatever READ reads to be in, see value_range.hpp. Every engine
+	// fails to READ anything else, see Machine::read().
+	auto inputs(const Value_Range::Interval range) -> void {
+		input = range;
+	}
+
+	// What the next prepare() has MUL, ADD and SUB do about overflowing an Integer, Stack::Overflow::Error to
+	// have them fail instead of wrapping around. The compiled engines do not check, run() has Threaded run
+	// the program instead of any of them.
+	auto arithmetic(const Stack::Overflow policy) -> void {
+		assert(policy != Stack::Overflow::Impossible and "Up to Value_Range, per instruction");
+		overflow = policy;
+	}
 
-					instructions.emplace_back(std::move(instr_name), std::move(instr_arg));
+	// What the prepared program is known to push, value_range().proven(i) when instructions[i] can never overflow
+	auto value_range() const -> const Value_Range& {
+		return ranges;
+	}
+
+	// The prepared program for input that starts with prefix, see partial_evaluation.hpp
+	auto specialize(const std::vector<Integer>& prefix) const -> Partial_Evaluation::Residual {
+		return Partial_Evaluation::specialize(instructions, prefix, overflow);
+	}
+
+	// Read a program without preparing it, empty on error
+	static auto parse(std::istream& program) -> Instructions {
+		auto instructions = Instructions{};
+
+		[[maybe_unused]] auto i = 0;	// Only checked by assert
+		auto line = std::string{};
+		while (std::getline(program, line)) {
+			trim(line);
+			if (line.empty())
+				continue;
+			else {
+				auto line_ss = std::istringstream{std::move(line)};
+
+				auto line_i = Integer{};
+				auto instr_name = std::string{};
+				auto instr_arg = Instruction::Argument{};
+
+				line_ss
+					>> line_i
+					>> instr_name
+					;
+
+				assert(i++ == line_i and "Expect ascending order of instructions");
+
+				const auto op = Instruction::opcode(instr_name);
+				if (not op.has_value()) {
+					std::cerr << "Error: parse: " << line_i << ": unknown instruction " << instr_name << '\n';
+					return {};
 				}
+
+				if (not line_ss.eof()) {	// Instruction argument exists
+					auto arg = Integer{};
+					line_ss >> arg;
+					instr_arg = arg;
+				}
+
+				instructions.emplace_back(*op, std::move(instr_arg));
 			}
 		}
 
-		if (instructions.empty()) {
-			std::cerr << "Error: prepare: Failed to read any instructions\n";
-			return false;
-		}
-		else
-			return true;
+		return instructions;
 	}
 
 	// Run program
@@ -135,7 +282,7 @@ public:
 		std::optional<Integer> top;
 		State state;
 	};
-	auto run(std::function<void(Execution_Result&&)>&& callback) -> bool {
+	auto run(std::function<void(Execution_Result&&)>&& callback, const Engine requested = Engine::Loop) -> bool {
 		if (instructions.empty()) {
 			std::cerr << "Error: run: No program has been prepared\n";
 			return false;
@@ -143,286 +290,679 @@ public:
 		else {
 			pc = instructions.cbegin();
 			state = State::Running;
-			while (state == State::Running) {
-				callback(execute());
+			// Threaded is the fastest engine that checks for overflow
+			const auto engine = checks_overflow() and wraps(requested) ? Engine::Threaded : requested;
+			switch (engine) {
+				case Engine::Loop:
+					while (state == State::Running) {
+						callback(execute());
+					}
+					break;
+
+				case Engine::Threaded:
+					resume();
+					callback(execute_threaded());
+					break;
+
+				case Engine::Tail_Call:
+					callback(finish(run_tail_call()));
+					break;
+
+				case Engine::Jit:
+					callback(finish(run_jit()));
+					break;
+
+				case Engine::Native:
+					if (not native_code.has_value())
+						native_code = Native::compile(instructions);
+
+					if (*native_code)
+						callback(finish(Native::run(*native_code, machine())));
+					else
+						callback(finish(run_jit()));
+					break;
+
+				case Engine::Register: {
+					if (not register_code.has_value())
+						register_code = Register_VM::compile(instructions);
+
+					if (const auto exit = Register_VM::run(*register_code, machine()); exit.state == State::Running) {
+						pc = instructions.cbegin() + exit.pc;
+						callback(execute_threaded());
+					}
+					else
+						callback(finish(exit));
+					break;
+				}
+
+				case Engine::Stack_Cache:
+#ifdef STACK_CACHE_AVAILABLE
+					if (not stack_cache_code.has_value())
+						stack_cache_code = Stack_Cache::compile(instructions);
+					callback(finish(Stack_Cache::run(*stack_cache_code, machine())));
+#else
+					callback(execute_threaded());
+#endif
+					break;
+
+				case Engine::Block:
+					resume();
+					callback(execute_blocks());
+					break;
+
+				case Engine::Trace:
+					resume();
+					callback(execute_traced());
+					break;
+
+				case Engine::Quickening:
+					if (not quickened.has_value())
+						quickened = Quickening::compile(instructions, overflow);
+					callback(finish(Quickening::run(*quickened, machine())));
+					break;
+
+				case Engine::Tiered:
+					callback(execute_tiered());
+					break;
 			}
 			return true;
 		}
 	}
 
+	// Run like Engine::Loop but without superinstructions, every instruction executed is recorded in the profile
+	auto profile(Profile& profile, std::function<void(Execution_Result&&)>&& callback) -> bool {
+		if (instructions.empty()) {
+			std::cerr << "Error: profile: No program has been prepared\n";
+			return false;
+		}
+
+		pc = instructions.cbegin();
+		state = State::Running;
+		profile.restart();
+		while (state == State::Running) {
+			if (pc != instructions.end())
+				profile.record(pc->op);
+			callback(execute(false));
+		}
+		return true;
+	}
+
+	// Run a program compiled by the Transpiler instead of a prepared one, only the final result is reported
+	auto run_compiled(const Machine::Compiled program, std::function<void(Execution_Result&&)>&& callback) -> bool {
+		pc = instructions.cend();
+		state = program(stack, cin, cout).state;
+		if (state == State::Done)
+			callback({ std::nullopt, state });
+		else
+			callback({ stack.top(), state });
+		return true;
+	}
+
 // Prepare and Execute
 private:
+	// View handed to the engines that live outside of the Interpreter
+	auto machine() -> Machine {
+		return { instructions, stack, cin, cout, input };
+	}
+
+	// Does what the instructions before the first READ do, without running them every time. The
+	// callback of Loop sees every instruction so that one still runs them.
+	auto resume() -> void {
+		if (not snapshot.has_value())
+			snapshot = Partial_Evaluation::evaluate(instructions, {}, overflow);
+
+		for (const auto value : snapshot->output)
+			cout << value << ' ';
+		for (const auto value : snapshot->stack)
+			stack.push(value);
+		pc = instructions.cbegin() + snapshot->pc;
+	}
+
+	auto run_tail_call(const size_t start = 0) -> Machine::Exit {
+		if (not tail_call_code.has_value())
+			tail_call_code = Tail_Call::compile(instructions);
+		return Tail_Call::run(*tail_call_code, machine(), start);
+	}
+
+	auto run_jit(const size_t start = 0) -> Machine::Exit {
+		if (not jit_code.has_value())
+			jit_code = Jit::compile(instructions);
+
+		if (*jit_code)
+			return Jit::run(*jit_code, machine(), start);
+		else
+			return run_tail_call(start);
+	}
+
+	auto finish(const Machine::Exit exit) -> Execution_Result {
+		pc = instructions.cbegin() + exit.pc;
+		state = exit.state;
+		if (state == State::Done)
+			return { std::nullopt, state };
+		else
+			return { stack.top(), state };
+	}
 
-	// Should not throw since we ensure hashes exist in constructor
-	auto execute() noexcept -> Execution_Result {
+	auto execute(const bool fuse = true) noexcept -> Execution_Result {
 		if (pc == instructions.end()) {
 			state = State::Done;
 			return { std::nullopt, state };
 		}
 		else {
-			const auto prev_pc = pc;
 #ifdef INTERPRETER_REPORT_EXECUTION
-			report_pc(prev_pc);
+			report_pc(pc);
 #endif
-			const auto& func = instruction_map.at(pc->name);
-			func(*this);
-			// If noone changed the pc then simply increment.
-			// This is abit hacky... a simple solution could be to hide any +-1 in a function call
-			// eg: auto current_instruction() { return *(pc - 1); }
-			// But that is just begging for "off by one" problems both in the code and in the mind...
-			if (prev_pc == pc)
-				++pc;
+			if (const auto& op = code[index(pc)];
+				fuse and op.fused() and superinstruction(op))
+			{
+				return { stack.top(), state };
+			}
+			else if (op.dispatch == invalid_dispatch) {
+				invalid(*pc++);
+				return { stack.top(), state };
+			}
+			else if (fuse and op.dispatch == kernel_dispatch and kernel()) {
+				return { stack.top(), state };
+			}
+
+			// Step past the instruction before executing it, JMPZ is then free to simply overwrite the pc
+			const auto& instr = *pc++;
+			switch (instr.op) {
+				case Opcode::READ:	read(instr);			break;
+				case Opcode::WRITE:	write(instr);			break;
+				case Opcode::DUP:	dup(instr);			break;
+				case Opcode::MUL:	binary(instr, checks_overflow() ? &Stack::mul<true, Stack::Overflow::Error> : &Stack::mul<>);	break;
+				case Opcode::ADD:	binary(instr, checks_overflow() ? &Stack::add<true, Stack::Overflow::Error> : &Stack::add<>);	break;
+				case Opcode::SUB:	binary(instr, checks_overflow() ? &Stack::sub<true, Stack::Overflow::Error> : &Stack::sub<>);	break;
+				case Opcode::GT:	binary(instr, &Stack::gt);	break;
+				case Opcode::LT:	binary(instr, &Stack::lt);	break;
+				case Opcode::EQ:	binary(instr, &Stack::eq);	break;
+				case Opcode::JMPZ:	jmpz(instr);			break;
+				case Opcode::PUSH:	push(instr);			break;
+				case Opcode::POP:	pop(instr);			break;
+				case Opcode::ROT:	rot(instr);			break;
+			}
 			return { stack.top(), state };
 		}
 	}
 
-// Hashing and Instruction->Interpreter_Mutator mapping
-private:
-	static inline const auto instruction_map = std::unordered_map<std::string, Interpreter_Mutator>{
-		{ "READ",
-			[] (Interpreter& interpreter)
-			{
-				const auto& instr = *interpreter.pc;
-
-				if (instr.arg.has_value())
-					std::cerr << "\tWarning: READ: arguments are not expected\n";
+	// Threaded dispatches the instructions Stack_Depth proved to have their values past the
+	// superinstructions, to handlers that do not check for them. Loop runs them like any other.
+	static constexpr auto unchecked_dispatch = Superinstruction::dispatch_count;
+
+	// Whatever the Verifier found to be missing its argument, the handlers never check for one
+	static constexpr auto invalid_dispatch = unchecked_dispatch + Instruction::opcode_count;
+
+	// Where a loop starts that Loop_Idiom recognized, whatever would have been dispatched there runs unfused
+	static constexpr auto kernel_dispatch = invalid_dispatch + 1;
+
+	// MUL, ADD and SUB that Value_Range proved to never overflow, checked and unchecked for their values
+	static constexpr auto proven_dispatch = kernel_dispatch + 1;
+	static constexpr auto unchecked_proven_dispatch = proven_dispatch + 3;
+
+	// The rest of them with Stack::Overflow::Error, see arithmetic()
+	static constexpr auto overflow_dispatch = unchecked_proven_dispatch + 3;
+	static constexpr auto unchecked_overflow_dispatch = overflow_dispatch + 3;
+
+#ifdef __GNUC__
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"	// Labels as values
+	// Same handlers as execute() but every one of them ends in its own indirect jump to the next,
+	// so the branch predictor gets a separate history per opcode instead of one shared switch.
+	auto execute_threaded() noexcept -> Execution_Result {
+		// Indexed by Superinstruction::Op::dispatch
+		static const void* const handlers[unchecked_overflow_dispatch + 3] = {
+			&&READ, &&WRITE, &&DUP,
+			&&MUL, &&ADD, &&SUB,
+			&&GT, &&LT, &&EQ,
+			&&JMPZ, &&PUSH, &&POP, &&ROT,
+			&&BRANCH, &&JUMP, &&NIP,
+			&&PUSH_OP, &&DUP_OP, &&SWAP_OP,
+			// Unchecked, READ, WRITE and PUSH have nothing to check
+			&&READ, &&WRITE, &&UNCHECKED_DUP,
+			&&UNCHECKED_MUL, &&UNCHECKED_ADD, &&UNCHECKED_SUB,
+			&&UNCHECKED_GT, &&UNCHECKED_LT, &&UNCHECKED_EQ,
+			&&UNCHECKED_JMPZ, &&PUSH, &&UNCHECKED_POP, &&UNCHECKED_ROT,
+			&&INVALID, &&KERNEL,
+			&&PROVEN_MUL, &&PROVEN_ADD, &&PROVEN_SUB,
+			&&UNCHECKED_PROVEN_MUL, &&UNCHECKED_PROVEN_ADD, &&UNCHECKED_PROVEN_SUB,
+			&&OVERFLOW_MUL, &&OVERFLOW_ADD, &&OVERFLOW_SUB,
+			&&UNCHECKED_OVERFLOW_MUL, &&UNCHECKED_OVERFLOW_ADD, &&UNCHECKED_OVERFLOW_SUB,
+		};
 
-				if (auto i = Integer{};
-					interpreter.cin >> i)
-				{
-					interpreter.stack.push(i);
-					interpreter.state = State::Running;
-				}
-				else
-				{
-					std::cerr << "\tError: READ: could not read integer from stdin\n";
-					interpreter.state = State::Error;
-				}
-			}
-		},
+#ifdef INTERPRETER_REPORT_EXECUTION
+#define INTERPRETER_REPORT_PC() report_pc(pc)
+#else
+#define INTERPRETER_REPORT_PC()
+#endif
 
-		{ "WRITE",
-			[] (Interpreter& interpreter)
-			{
-				const auto& instr = *interpreter.pc;
+#define INTERPRETER_DISPATCH()						\
+		do {							\
+			if (state != State::Running)			\
+				return { stack.top(), state };		\
+			if (pc == instructions.end()) {			\
+				state = State::Done;			\
+				return { std::nullopt, state };		\
+			}						\
+			INTERPRETER_REPORT_PC();			\
+			goto *handlers[code[index(pc)].dispatch];	\
+		} while (false)
+
+		// The sequence could not run in one go, start it as the plain instruction it is
+#define INTERPRETER_UNFUSED() goto *handlers[unfused(*pc)]
+
+		INTERPRETER_DISPATCH();
+
+	READ:	read(*pc++);				INTERPRETER_DISPATCH();
+	WRITE:	write(*pc++);				INTERPRETER_DISPATCH();
+	DUP:	dup(*pc++);				INTERPRETER_DISPATCH();
+	MUL:	binary(*pc++, &Stack::mul);		INTERPRETER_DISPATCH();
+	ADD:	binary(*pc++, &Stack::add);		INTERPRETER_DISPATCH();
+	SUB:	binary(*pc++, &Stack::sub);		INTERPRETER_DISPATCH();
+	GT:	binary(*pc++, &Stack::gt);		INTERPRETER_DISPATCH();
+	LT:	binary(*pc++, &Stack::lt);		INTERPRETER_DISPATCH();
+	EQ:	binary(*pc++, &Stack::eq);		INTERPRETER_DISPATCH();
+	JMPZ:	jmpz(*pc++);				INTERPRETER_DISPATCH();
+	PUSH:	push(*pc++);				INTERPRETER_DISPATCH();
+	POP:	pop(*pc++);				INTERPRETER_DISPATCH();
+	ROT:	rot(*pc++);				INTERPRETER_DISPATCH();
+
+	BRANCH:	if (not branch(code[index(pc)]))	INTERPRETER_UNFUSED();	INTERPRETER_DISPATCH();
+	JUMP:	jump(code[index(pc)]);			INTERPRETER_DISPATCH();
+	NIP:	if (not nip(code[index(pc)]))		INTERPRETER_UNFUSED();	INTERPRETER_DISPATCH();
+	PUSH_OP: if (not fused_binary(code[index(pc)]))	INTERPRETER_UNFUSED();	INTERPRETER_DISPATCH();
+	DUP_OP:	if (not fused_binary(code[index(pc)]))	INTERPRETER_UNFUSED();	INTERPRETER_DISPATCH();
+	SWAP_OP: if (not fused_binary(code[index(pc)]))	INTERPRETER_UNFUSED();	INTERPRETER_DISPATCH();
+
+	UNCHECKED_DUP:	dup<false>(*pc++);			INTERPRETER_DISPATCH();
+	UNCHECKED_MUL:	binary(*pc++, &Stack::mul<false>);	INTERPRETER_DISPATCH();
+	UNCHECKED_ADD:	binary(*pc++, &Stack::add<false>);	INTERPRETER_DISPATCH();
+	UNCHECKED_SUB:	binary(*pc++, &Stack::sub<false>);	INTERPRETER_DISPATCH();
+	UNCHECKED_GT:	binary(*pc++, &Stack::gt<false>);	INTERPRETER_DISPATCH();
+	UNCHECKED_LT:	binary(*pc++, &Stack::lt<false>);	INTERPRETER_DISPATCH();
+	UNCHECKED_EQ:	binary(*pc++, &Stack::eq<false>);	INTERPRETER_DISPATCH();
+	UNCHECKED_JMPZ:	jmpz<false>(*pc++);			INTERPRETER_DISPATCH();
+	UNCHECKED_POP:	pop<false>(*pc++);			INTERPRETER_DISPATCH();
+	UNCHECKED_ROT:	rot<false>(*pc++);			INTERPRETER_DISPATCH();
+
+	INVALID:	invalid(*pc++);				INTERPRETER_DISPATCH();
+	KERNEL:		if (not kernel())			INTERPRETER_UNFUSED();	INTERPRETER_DISPATCH();
+
+	PROVEN_MUL:		binary(*pc++, &Stack::mul<true, Stack::Overflow::Impossible>);		INTERPRETER_DISPATCH();
+	PROVEN_ADD:		binary(*pc++, &Stack::add<true, Stack::Overflow::Impossible>);		INTERPRETER_DISPATCH();
+	PROVEN_SUB:		binary(*pc++, &Stack::sub<true, Stack::Overflow::Impossible>);		INTERPRETER_DISPATCH();
+	UNCHECKED_PROVEN_MUL:	binary(*pc++, &Stack::mul<false, Stack::Overflow::Impossible>);	INTERPRETER_DISPATCH();
+	UNCHECKED_PROVEN_ADD:	binary(*pc++, &Stack::add<false, Stack::Overflow::Impossible>);	INTERPRETER_DISPATCH();
+	UNCHECKED_PROVEN_SUB:	binary(*pc++, &Stack::sub<false, Stack::Overflow::Impossible>);	INTERPRETER_DISPATCH();
+
+	OVERFLOW_MUL:		binary(*pc++, &Stack::mul<true, Stack::Overflow::Error>);		INTERPRETER_DISPATCH();
+	OVERFLOW_ADD:		binary(*pc++, &Stack::add<true, Stack::Overflow::Error>);		INTERPRETER_DISPATCH();
+	OVERFLOW_SUB:		binary(*pc++, &Stack::sub<true, Stack::Overflow::Error>);		INTERPRETER_DISPATCH();
+	UNCHECKED_OVERFLOW_MUL:	binary(*pc++, &Stack::mul<false, Stack::Overflow::Error>);		INTERPRETER_DISPATCH();
+	UNCHECKED_OVERFLOW_ADD:	binary(*pc++, &Stack::add<false, Stack::Overflow::Error>);		INTERPRETER_DISPATCH();
+	UNCHECKED_OVERFLOW_SUB:	binary(*pc++, &Stack::sub<false, Stack::Overflow::Error>);		INTERPRETER_DISPATCH();
+
+#undef INTERPRETER_UNFUSED
+#undef INTERPRETER_DISPATCH
+#undef INTERPRETER_REPORT_PC
+	}
+#pragma GCC diagnostic pop
+#else
+	// No labels as values, fall back to the switch
+	auto execute_threaded() noexcept -> Execution_Result {
+		auto result = Execution_Result{};
+		do
+			result = execute();
+		while (state == State::Running);
+		return result;
+	}
+#endif
 
-				if (instr.arg.has_value())
-					std::cerr << "\tWarning: WRITE: arguments are not expected\n";
+	// Loop until a loop is warm, then Quickening from its header until that has gone around hot times,
+	// then Jit from wherever that was. Short runs never compile anything. With Stack::Overflow::Error
+	// it stays in Quickening.
+	auto execute_tiered() noexcept -> Execution_Result {
+		auto tier = tiering.start();
+		auto result = Execution_Result{ stack.top(), state };
+		while (tier == Tiering::Tier::Baseline and state == State::Running) {
+			const auto from = pc;
+			result = execute();
+			if (state == State::Running and pc != instructions.end() and pc <= from)
+				tier = tiering.back_edge(index(pc));
+		}
+		if (state != State::Running)
+			return result;
+
+		if (tier == Tiering::Tier::Optimized) {
+			if (not quickened.has_value())
+				quickened = Quickening::compile(instructions, overflow);
+			// Jit wraps around, so checked arithmetic never gets past Quickening
+			const auto back_edges = checks_overflow() ? Quickening::unlimited : uint64_t{Tiering::hot};
+			if (const auto exit = Quickening::run(*quickened, machine(), index(pc), back_edges); exit.state != State::Running)
+				return finish(exit);
+			else {
+				tiering.promote();
+				pc = instructions.cbegin() + exit.pc;
+			}
+		}
+		return finish(run_jit(index(pc)));
+	}
 
-				if (const auto top = interpreter.stack.pop_top();
-					top.has_value())
+	// Where a block starts is the only place to look for the end of the program, and a block where
+	// Stack_Depth proves every instruction has its values and nothing else can fail (no READ, no jump
+	// out of the program, no arithmetic checked for overflow) runs without looking at state at all
+	auto execute_blocks() noexcept -> Execution_Result {
+		if (not control_flow.has_value()) {
+			control_flow = Control_Flow::build(instructions);
+			unchecked_blocks.assign(control_flow->blocks.size(), true);
+			const auto jumps_out = [&] (const size_t i) {
+				const auto target = Stack_Depth::static_target(instructions, i);
+				return control_flow->block_at(i).computed or not target.has_value()
+					or *target < 0 or static_cast<size_t>(*target) >= instructions.size();
+			};
+			for (auto i = size_t{0}; i < instructions.size(); ++i) {
+				if (const auto op = instructions[i].op;
+					not depth.safe(i) or op == Opcode::READ or (op == Opcode::JMPZ and jumps_out(i))
+					or (checks_overflow() and Value_Range::arithmetic(op) and not ranges.proven(i)))
 				{
-					interpreter.cout << *top << ' ';
+					unchecked_blocks[control_flow->block_of[i]] = false;
 				}
-				else
-					interpreter.cout << "null" << ' ';
+			}
+		}
 
-				interpreter.state = State::Running;
+		while (state == State::Running) {
+			if (pc == instructions.end()) {
+				state = State::Done;
+				return { std::nullopt, state };
 			}
-		},
 
-		{ "DUP",
-			[] (Interpreter& interpreter)
-			{
-				const auto& instr = *interpreter.pc;
+			const auto b = control_flow->block_of[index(pc)];
+			auto n = control_flow->blocks[b].end - index(pc);
+			if (unchecked_blocks[b]) {
+				for (; n > 0; --n) {
+#ifdef INTERPRETER_REPORT_EXECUTION
+					report_pc(pc);
+#endif
+					step<false>(*pc++);
+				}
+			}
+			else {
+				for (; n > 0 and state == State::Running; --n) {
+#ifdef INTERPRETER_REPORT_EXECUTION
+					report_pc(pc);
+#endif
+					if (code[index(pc)].dispatch == invalid_dispatch)
+						invalid(*pc++);
+					else
+						step<true>(*pc++);
+				}
+			}
+		}
+		return { stack.top(), state };
+	}
 
-				if (instr.arg.has_value())
-					std::cerr << "\tWarning: DUP: arguments are not expected\n";
+	// One instruction at a time like execute(), until a loop has jumped back Trace::hot times. The next
+	// iteration of it is recorded and whenever it comes around again it runs as a trace instead. The
+	// trace hands back where it left the loop, from there it is one instruction at a time again.
+	auto execute_traced() noexcept -> Execution_Result {
+		if (depth.dynamic)
+			return execute_blocks();	// No telling where a loop goes
+		if (loops.empty())
+			loops.resize(instructions.size());
+
+		auto recorder = std::optional<Trace::Recorder>{};
+		auto left = instructions.size();	// Where a trace was just left, not to enter it again right away
+		while (state == State::Running) {
+			if (pc == instructions.end()) {
+				state = State::Done;
+				return { std::nullopt, state };
+			}
 
-				if (not interpreter.stack.dup()) {
-					std::cerr << "\tError: DUP: failed, stack is empty\n";
-					interpreter.state = State::Error;
+			const auto i = index(pc);
+			if (auto& loop = loops[i]; recorder.has_value()) {
+				switch (recorder->record(i)) {
+					case Trace::Recorder::Status::Recording:
+						break;
+					case Trace::Recorder::Status::Closed:
+						loop.trace = Trace::compile(instructions, *recorder, overflow);
+						loop.untraceable = not loop.trace.has_value();
+						recorder.reset();
+						continue;
+					case Trace::Recorder::Status::Aborted:
+						loops[recorder->header].untraceable = true;
+						recorder.reset();
+						break;
 				}
-				else
-					interpreter.state = State::Running;
 			}
-		},
-					// Binary Operations
-		{ "MUL",
-			[] (Interpreter& interpreter)
+			else if (loop.trace.has_value() and i != left) {
+				const auto exit = Trace::run(*loop.trace, machine());
+				pc = instructions.cbegin() + exit.pc;
+				state = exit.state;
+				left = exit.pc;
+				continue;
+			}
+
+#ifdef INTERPRETER_REPORT_EXECUTION
+			report_pc(pc);
+#endif
+			if (code[i].dispatch == invalid_dispatch)
+				invalid(*pc++);
+			else
+				step<true>(*pc++);
+			left = instructions.size();
+
+			if (const auto target = index(pc);
+				instructions[i].op == Opcode::JMPZ and target <= i and state == State::Running
+				and not recorder.has_value() and not loops[target].untraceable and not loops[target].trace.has_value()
+				and ++loops[target].count >= Trace::hot)
 			{
-				const auto& instr = *interpreter.pc;
+				recorder = Trace::Recorder{ static_cast<uint32_t>(target), {} };
+			}
+		}
 
-				if (instr.arg.has_value())
-					std::cerr << "\tWarning: MUL: arguments are not expected\n";
+		// A run that stops while recording leaves the loop to try again next time
+		return { stack.top(), state };
+	}
 
+	// One instruction of execute_blocks(), the pc is already past it. With Stack::Overflow::Error the
+	// unchecked blocks only have MUL, ADD and SUB that Value_Range proved to never overflow.
+	template <bool checked>
+	auto step(const Instruction& instr) -> void {
+		constexpr auto policy = checked ? Stack::Overflow::Error : Stack::Overflow::Impossible;
+		switch (instr.op) {
+			case Opcode::READ:	read(instr);				break;
+			case Opcode::WRITE:	write(instr);				break;
+			case Opcode::DUP:	dup<checked>(instr);			break;
+			case Opcode::MUL:	binary(instr, checks_overflow() ? &Stack::mul<checked, policy> : &Stack::mul<checked>);	break;
+			case Opcode::ADD:	binary(instr, checks_overflow() ? &Stack::add<checked, policy> : &Stack::add<checked>);	break;
+			case Opcode::SUB:	binary(instr, checks_overflow() ? &Stack::sub<checked, policy> : &Stack::sub<checked>);	break;
+			case Opcode::GT:	binary(instr, &Stack::gt<checked>);	break;
+			case Opcode::LT:	binary(instr, &Stack::lt<checked>);	break;
+			case Opcode::EQ:	binary(instr, &Stack::eq<checked>);	break;
+			case Opcode::JMPZ:	jmpz<checked>(instr);			break;
+			case Opcode::PUSH:	push(instr);				break;
+			case Opcode::POP:	pop<checked>(instr);			break;
+			case Opcode::ROT:	rot<checked>(instr);			break;
+		}
+	}
 
-				if (not interpreter.stack.mul()) {
-					std::cerr << "\tError: MUL: failed, stack does not have 2 ints\n";
-					interpreter.state = State::Error;
-				}
-				else
-					interpreter.state = State::Running;
-			}
-		},
-		{ "ADD",
-			[] (Interpreter& interpreter)
-			{
-				const auto& instr = *interpreter.pc;
+// Instruction handlers, one per Opcode
+private:
+	// PUSH, POP and ROT the Verifier found without an argument, the other handlers never check for one
+	auto invalid(const Instruction& instr) -> void {
+		Machine::report_missing_argument(instr.op);
+		state = State::Error;
+	}
 
-				if (instr.arg.has_value())
-					std::cerr << "\tWarning: ADD: arguments are not expected\n";
+	auto read(const Instruction&) -> void {
+		if (auto i = Integer{}; machine().read(i)) {
+			stack.push(i);
+			state = State::Running;
+		}
+		else
+			state = State::Error;
+	}
 
-				if (not interpreter.stack.add()) {
-					std::cerr << "\tError: ADD: failed, stack does not have 2 ints\n";
-					interpreter.state = State::Error;
-				}
-				else
-					interpreter.state = State::Running;
-			}
-		},
-		{ "SUB",
-			[] (Interpreter& interpreter)
-			{
-				const auto& instr = *interpreter.pc;
+	auto write(const Instruction&) -> void {
+		if (const auto top = stack.pop_top();
+			top.has_value())
+		{
+			cout << *top << ' ';
+		}
+		else
+			cout << "null" << ' ';
 
-				if (instr.arg.has_value())
-					std::cerr << "\tWarning: SUB: arguments are not expected\n";
+		state = State::Running;
+	}
 
-				if (not interpreter.stack.sub()) {
-					std::cerr << "\tError: SUB: failed, stack does not have 2 ints\n";
-					interpreter.state = State::Error;
-				}
-				else
-					interpreter.state = State::Running;
-			}
-		},
-		{ "GT",
-			[] (Interpreter& interpreter)
-			{
-				const auto& instr = *interpreter.pc;
+	// DUP, JMPZ, POP and ROT are also instantiated unchecked for Threaded, see unchecked_dispatch
+	template <bool checked = true>
+	auto dup(const Instruction&) -> void {
+		if (not stack.dup<checked>()) {
+			Machine::report_underflow(Opcode::DUP);
+			state = State::Error;
+		}
+		else
+			state = State::Running;
+	}
 
-				if (instr.arg.has_value())
-					std::cerr << "\tWarning: GT: arguments are not expected\n";
+	// Binary Operations, MUL, ADD and SUB that had both values failed to fit the result
+	auto binary(const Instruction& instr, bool (Stack::*op)()) -> void {
+		if (not (stack.*op)()) {
+			if (Value_Range::arithmetic(instr.op) and stack.has_at_least(2))
+				Machine::report_overflow(instr.op);
+			else
+				Machine::report_underflow(instr.op);
+			state = State::Error;
+		}
+		else
+			state = State::Running;
+	}
 
-				if (not interpreter.stack.gt()) {
-					std::cerr << "\tError: GT: failed, stack does not have 2 ints\n";
-					interpreter.state = State::Error;
+	template <bool checked = true>
+	auto jmpz(const Instruction&) -> void {
+		if (checked and not stack.has_at_least(2)) {
+			Machine::report_underflow(Opcode::JMPZ);
+			state = State::Error;
+		}
+		else {
+			if (const auto top = *stack.pop_top(), second = *stack.pop_top();
+				second == 0)
+			{
+				if (0 <= top and static_cast<size_t>(top) < instructions.size()) {
+					pc = instructions.cbegin() + top;
+					state = State::Running;
+				}
+				else {
+					Machine::report_jump(top, instructions.size());
+					state = State::Error;
 				}
-				else
-					interpreter.state = State::Running;
 			}
-		},
-		{ "LT",
-			[] (Interpreter& interpreter)
-			{
-				const auto& instr = *interpreter.pc;
+		}
+	}
 
-				if (instr.arg.has_value())
-					std::cerr << "\tWarning: LT: arguments are not expected\n";
+	auto push(const Instruction& instr) -> void {
+		stack.push(*instr.arg);
+		state = State::Running;
+	}
 
-				if (not interpreter.stack.lt()) {
-					std::cerr << "\tError: LT: failed, stack does not have 2 ints\n";
-					interpreter.state = State::Error;
-				}
-				else
-					interpreter.state = State::Running;
-			}
-		},
-		{ "EQ",
-			[] (Interpreter& interpreter)
-			{
-				const auto& instr = *interpreter.pc;
+	template <bool checked = true>
+	auto pop(const Instruction& instr) -> void {
+		if (not stack.pop_n<checked>(*instr.arg)) {
+			Machine::report_underflow(Opcode::POP, *instr.arg);
+			state = State::Error;
+		}
+		else
+			state = State::Running;
+	}
 
-				if (instr.arg.has_value())
-					std::cerr << "\tWarning: EQ: arguments are not expected\n";
+	// Superinstructions, false when the sequence has to run one instruction at a time after all
+	// so that the instruction that fails reports itself
+	auto superinstruction(const Superinstruction::Op& op) -> bool {
+		switch (op.kind()) {
+			case Superinstruction::Kind::BRANCH:	return branch(op);
+			case Superinstruction::Kind::JUMP:	return jump(op);
+			case Superinstruction::Kind::NIP:	return nip(op);
+			case Superinstruction::Kind::PUSH_OP:
+			case Superinstruction::Kind::DUP_OP:
+			case Superinstruction::Kind::SWAP_OP:	return fused_binary(op);
+		}
+		return false;
+	}
 
-				if (not interpreter.stack.eq()) {
-					std::cerr << "\tError: EQ: failed, stack does not have 2 ints\n";
-					interpreter.state = State::Error;
-				}
-				else
-					interpreter.state = State::Running;
-			}
-		},
+	// The whole loop starting at pc, false when it has to run one instruction at a time after all
+	auto kernel() -> bool {
+		const auto& kernel = *kernels[index(pc)];
+		if (not Loop_Idiom::run(kernel, stack, overflow))
+			return false;
 
-		{ "JMPZ",
-			[] (Interpreter& interpreter)
-			{
-				const auto& instr = *interpreter.pc;
+		pc = instructions.cbegin() + kernel.exit;
+		state = State::Running;
+		return true;
+	}
 
-				if (instr.arg.has_value())
-					std::cerr << "\tWarning: JMPZ: arguments are not expected\n";
+	auto branch(const Superinstruction::Op& op) -> bool {
+		if (const auto top = stack.top(); not top.has_value())
+			return false;
+		else if (Instruction::evaluate(op.operation, op.value, *top) == 0)
+			pc = instructions.cbegin() + op.target;
+		else
+			pc += op.length;
 
+		state = State::Running;
+		return true;
+	}
 
-				if (auto& stack = interpreter.stack;
-					not stack.has_at_least(2))
-				{
-					std::cerr << "\tError: JMPZ: stack does not have at least 2 int\n";
-					interpreter.state = State::Error;
-				}
-				else {
+	auto jump(const Superinstruction::Op& op) -> bool {
+		pc = instructions.cbegin() + op.target;
+		state = State::Running;
+		return true;
+	}
 
-					if (const auto top = *stack.pop_top(), second = *stack.pop_top();
-						second == 0)
-					{
-						if (0 <= top and static_cast<size_t>(top) < interpreter.instructions.size()) {
-							interpreter.pc = interpreter.instructions.cbegin() + top;
-							interpreter.state = State::Running;
-						}
-						else {
-							std::cerr
-								<< "\tError: JMPZ: requested jump to " << top
-								<< " is past end of program "
-								<< (interpreter.instructions.size() - 1) << '\n';
-							interpreter.state = State::Error;
-						}
-					}
-				}
-			}
-		},
+	auto nip(const Superinstruction::Op& op) -> bool {
+		if (not stack.nip())
+			return false;
 
-		{ "PUSH",
-			[] (Interpreter& interpreter)
-			{
-				const auto& instr = *interpreter.pc;
+		pc += op.length;
+		state = State::Running;
+		return true;
+	}
 
-				if (not instr.arg.has_value()) {
-					std::cerr << "\tError: PUSH: arguments expected\n";
-					interpreter.state = State::Error;
-				}
-				else {
-					interpreter.stack.push(*instr.arg);
-					interpreter.state = State::Running;
-				}
-			}
-		},
-		{ "POP",
-			[] (Interpreter& interpreter)
-			{
-				const auto& instr = *interpreter.pc;
+	// PUSH_OP, DUP_OP and SWAP_OP, they only differ in where the operands come from. Whatever overflows
+	// with Stack::Overflow::Error is left to the instructions to fail on.
+	auto fused_binary(const Superinstruction::Op& op) -> bool {
+		const auto swap = op.kind() == Superinstruction::Kind::SWAP_OP;
+		if (not stack.has_at_least(swap ? 2 : 1))
+			return false;
 
-				if (not instr.arg.has_value()) {
-					std::cerr << "\tError: POP: arguments expected\n";
-					interpreter.state = State::Error;
-				}
-				else if (not interpreter.stack.pop_n(*instr.arg)) {
-					std::cerr << "\tError: POP: stack does not have at least " << *instr.arg << " ints\n";
-					interpreter.state = State::Error;
-				}
-				else
-					interpreter.state = State::Running;
-			}
-		},
+		auto& values = stack.storage();
+		const auto top = values.back();
+		const auto [a, b] =
+			op.kind() == Superinstruction::Kind::PUSH_OP ? std::pair{ op.value, top }
+			: op.kind() == Superinstruction::Kind::DUP_OP ? std::pair{ top, top }
+			: std::pair{ values.end()[-2], top };
+		const auto result = checks_overflow() ? Instruction::evaluate_exact(op.operation, a, b) : Instruction::evaluate(op.operation, a, b);
+		if (not result.has_value())
+			return false;
 
-		{ "ROT",
-			[] (Interpreter& interpreter)
-			{
-				const auto& instr = *interpreter.pc;
+		if (swap)
+			values.pop_back();
+		values.back() = *result;
 
-				if (not instr.arg.has_value()) {
-					std::cerr << "\tError: arguments expected\n";
-					interpreter.state = State::Error;
-				}
-				else if (not interpreter.stack.rot(*instr.arg)) {
-					std::cerr << "\tError: stack does not have at least " << *instr.arg << " ints\n";
-					interpreter.state = State::Error;
-				}
-				else
-					interpreter.state = State::Running;
-			}
-		},
-	};
+		pc += op.length;
+		state = State::Running;
+		return true;
+	}
+
+	template <bool checked = true>
+	auto rot(const Instruction& instr) -> void {
+		if (not stack.rot<checked>(*instr.arg)) {
+			Machine::report_underflow(Opcode::ROT, *instr.arg);
+			state = State::Error;
+		}
+		else
+			state = State::Running;
+	}
 
 	// Thanks: https://_stackoverflow.com/questions/216823/how-to-trim-an-stdstring
 	static auto trim(std::string& l) -> void {
@@ -440,14 +980,50 @@ private:
 		);
 	}
 
+	auto checks_overflow() const -> bool {
+		return overflow == Stack::Overflow::Error;
+	}
+
+	// Compiled engines, MUL, ADD and SUB wrap around in them whatever arithmetic() says
+	static auto wraps(const Engine engine) -> bool {
+		switch (engine) {
+			case Engine::Tail_Call:
+			case Engine::Jit:
+			case Engine::Native:
+			case Engine::Register:
+			case Engine::Stack_Cache:
+				return true;
+			default:
+				return false;
+		}
+	}
+
+	// MUL, ADD and SUB are next to each other in every range of dispatch they have
+	static auto offset(const Opcode op) -> size_t {
+		return static_cast<size_t>(op) - static_cast<size_t>(Opcode::MUL);
+	}
+
+	// What Threaded dispatches to where a superinstruction or kernel could not run in one go
+	auto unfused(const Instruction& instr) const -> size_t {
+		if (checks_overflow() and Value_Range::arithmetic(instr.op))
+			return overflow_dispatch + offset(instr.op);
+		else
+			return static_cast<size_t>(instr.op);
+	}
+
+	auto index(const PC& pc) const -> size_t {
+		return static_cast<size_t>(std::distance(instructions.cbegin(), pc));
+	}
+
 	auto report_pc(const PC& pc) const -> void {
 		std::cerr
 			<< "Executing: "
-			<< std::right << std::setw(3) << std::distance(instructions.cbegin(), pc) << ' '
+			<< std::right << std::setw(3) << lines[index(pc)] << ' '
 			<< *pc << '\t'
-			<< stack
-			<< '\n'
 			;
+		if (const auto& op = code[index(pc)]; op.fused())
+			std::cerr << Superinstruction::name(op.kind()) << '\t';
+		std::cerr << stack << '\n';
 	}
 
 public:
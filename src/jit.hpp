@@ -0,0 +1,531 @@
+#pragma once
+
+#include <vector>
+#include <optional>
+#include <functional>
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__x86_64__) and defined(__linux__)
+#	define JIT_AVAILABLE
+#	include <sys/mman.h>
+#endif
+
+#include "stack.hpp"
+#include "instruction.hpp"
+#include "machine.hpp"
+
+// Compiles prepared instructions to x86-64 machine code.
+//
+// Usage:
+//
+// if (const auto code = Jit::compile(instructions); code)
+// 	const auto exit = Jit::run(code, machine);
+// else
+// 	// Not supported here, use one of the interpreting engines
+//
+// Register allocation of the generated code:
+//	rbx	sp, one past the top of the stack
+//	r12	base of the stack
+//	r13	limit, sp at which the next push no longer fits
+//	r14	Context*
+// All of them are callee saved, so READ/WRITE/ROT can simply call back into C++.
+// Every instruction gets its own label, JMPZ targets that are pushed right before the JMPZ
+// become direct jumps, the rest go through a table indexed by instruction.
+struct Jit {
+	using Integer = Stack::Integer;
+	using Opcode = Instruction::Opcode;
+	using State = Machine::State;
+
+	// Why the generated code stopped with State::Error, the message is printed from C++
+	enum class Error : uint32_t {
+		None, Underflow, Jump, Read, Missing_Argument,
+	};
+
+	struct Context {
+		Integer* sp;
+		Integer* base;
+		Integer* limit;
+
+		Stack::Vector* storage;
+		const Machine* machine;	// For READ
+		std::ostream* cout;
+
+		uint32_t pc;
+		Error error;
+		Integer target;	// Of a failed JMPZ
+	};
+
+	using Function = auto (*)(Context*) -> uint32_t;	// Returns the State
+
+	// Executable memory, empty if the program could not be compiled
+	struct Code {
+		void* memory = nullptr;
+		size_t size = 0;
+		Function function = nullptr;
+
+		Code() = default;
+		Code(const Code&) = delete;
+		auto operator= (const Code&) -> Code& = delete;
+		Code(Code&& other) noexcept { *this = std::move(other); }
+		auto operator= (Code&& other) noexcept -> Code& {
+			std::swap(memory, other.memory);
+			std::swap(size, other.size);
+			std::swap(function, other.function);
+			return *this;
+		}
+
+		~Code() {
+#ifdef JIT_AVAILABLE
+			if (memory != nullptr)
+				munmap(memory, size);
+#endif
+		}
+
+		explicit operator bool () const {
+			return function != nullptr;
+		}
+	};
+
+	static auto compile(const Instructions& instructions) -> Code {
+#ifdef JIT_AVAILABLE
+		if (instructions.empty() or instructions.size() > size_t{INT32_MAX})
+			return {};
+
+		auto assembler = Assembler{instructions.size()};
+		emit_program(assembler, instructions);
+		return assembler.finish();
+#else
+		(void)instructions;
+		return {};
+#endif
+	}
+
+	// Starting anywhere but 0 is for carrying on from another engine, see tiering.hpp
+	static auto run(const Code& code, const Machine& machine, const size_t start = 0) -> Machine::Exit {
+		assert(code and "Check Jit::compile() before running");
+
+		auto& storage = machine.stack.storage();
+		const auto depth = storage.size();
+		storage.resize(std::max<size_t>(64, 2 * depth));
+
+		auto ctx = Context{
+			.sp = storage.data() + depth,
+			.base = storage.data(),
+			.limit = storage.data() + storage.size(),
+			.storage = &storage,
+			.machine = &machine,
+			.cout = &machine.cout,
+			.pc = static_cast<uint32_t>(start),
+			.error = Error::None,
+			.target = 0,
+		};
+
+		const auto state = static_cast<State>(code.function(&ctx));
+		storage.resize(static_cast<size_t>(ctx.sp - ctx.base));
+
+		if (state == State::Error) {
+			report(machine.instructions, ctx);
+			return { state, ctx.pc + size_t{1} };
+		}
+		else
+			return { state, ctx.pc };
+	}
+
+// Called from the generated code
+private:
+	static auto read(Context* ctx, Integer* sp) -> uint32_t {
+		return ctx->machine->read(*sp);
+	}
+
+	static auto write(Context* ctx, Integer* sp) -> Integer* {
+		if (sp != ctx->base) {
+			*ctx->cout << sp[-1] << ' ';
+			return sp - 1;
+		}
+		else {
+			*ctx->cout << "null" << ' ';
+			return sp;
+		}
+	}
+
+	static auto rot(Integer* sp, const size_t n) -> void {
+		std::rotate(sp - n, sp - 1, sp);
+	}
+
+	static auto grow(Context* ctx, Integer* sp) -> Integer* {
+		const auto depth = sp - ctx->base;
+		ctx->storage->resize(2 * ctx->storage->size());
+		ctx->base = ctx->storage->data();
+		ctx->limit = ctx->base + ctx->storage->size();
+		return ctx->base + depth;
+	}
+
+	static auto report(const Instructions& instructions, const Context& ctx) -> void {
+		const auto& instr = instructions[ctx.pc];
+		switch (ctx.error) {
+			case Error::Underflow:		Machine::report_underflow(instr.op, instr.arg.value_or(0));	break;
+			case Error::Jump:		Machine::report_jump(ctx.target, instructions.size());		break;
+			case Error::Read:												break;	// Machine::read() reported it
+			case Error::Missing_Argument:	Machine::report_missing_argument(instr.op);			break;
+			case Error::None:												break;
+		}
+	}
+
+#ifdef JIT_AVAILABLE
+// Code generation
+private:
+	using Label = size_t;
+
+	// Just the handful of encodings the opcodes need, rel32 everywhere to keep the fixups uniform
+	struct Assembler {
+		std::vector<uint8_t> bytes;
+
+		std::vector<std::optional<size_t>> labels;	// Instruction i is label i, the end of the program is label size
+		struct Fixup { size_t at; Label label; };
+		std::vector<Fixup> fixups;
+
+		std::vector<std::function<void()>> stubs;	// Cold paths, emitted after the program
+
+		size_t table_label;
+		size_t instruction_count;
+
+		explicit Assembler(const size_t count)
+			: labels(count + 1)
+			, instruction_count{count}
+		{
+			table_label = new_label();
+		}
+
+		auto new_label() -> Label {
+			labels.emplace_back();
+			return labels.size() - 1;
+		}
+
+		auto bind(const Label l) -> void {
+			labels[l] = bytes.size();
+		}
+
+		auto emit(std::initializer_list<uint8_t> bs) -> void {
+			bytes.insert(bytes.end(), bs);
+		}
+
+		auto emit32(const uint32_t v) -> void {
+			for (auto i = 0; i < 4; ++i)
+				bytes.push_back(static_cast<uint8_t>(v >> (8 * i)));
+		}
+
+		auto emit64(const uint64_t v) -> void {
+			for (auto i = 0; i < 8; ++i)
+				bytes.push_back(static_cast<uint8_t>(v >> (8 * i)));
+		}
+
+		auto rel32(const Label l) -> void {
+			fixups.push_back({ bytes.size(), l });
+			emit32(0);
+		}
+
+		// Conditions for 0F 8x jcc rel32
+		enum Condition : uint8_t {
+			Below = 0x2, Above_Equal = 0x3, Zero = 0x4, Not_Zero = 0x5,
+		};
+
+		auto jcc(const Condition cc, const Label l) -> void	{ emit({0x0F, static_cast<uint8_t>(0x80 | cc)}); rel32(l); }
+		auto jmp(const Label l) -> void				{ emit({0xE9}); rel32(l); }
+
+		auto call(const void* f) -> void {
+			emit({0x48, 0xB8}); emit64(reinterpret_cast<uint64_t>(f));	// mov rax, imm64
+			emit({0xFF, 0xD0});						// call rax
+		}
+
+		auto mov_rdi_ctx() -> void	{ emit({0x4C, 0x89, 0xF7}); }	// mov rdi, r14
+		auto mov_rsi_sp() -> void	{ emit({0x48, 0x89, 0xDE}); }	// mov rsi, rbx
+		auto mov_rdi_sp() -> void	{ emit({0x48, 0x89, 0xDF}); }	// mov rdi, rbx
+		auto mov_sp_rax() -> void	{ emit({0x48, 0x89, 0xC3}); }	// mov rbx, rax
+
+		auto add_sp(const int32_t n) -> void	{ emit({0x48, 0x81, 0xC3}); emit32(static_cast<uint32_t>(n)); }	// add rbx, imm32
+		auto sub_sp(const int32_t n) -> void	{ emit({0x48, 0x81, 0xEB}); emit32(static_cast<uint32_t>(n)); }	// sub rbx, imm32
+		auto mov_rcx(const uint64_t v) -> void	{ emit({0x48, 0xB9}); emit64(v); }				// mov rcx, imm64
+
+		auto load_eax(const int8_t disp) -> void	{ emit({0x8B, 0x43, static_cast<uint8_t>(disp)}); }	// mov eax, [rbx + disp8]
+		auto load_ecx(const int8_t disp) -> void	{ emit({0x8B, 0x4B, static_cast<uint8_t>(disp)}); }	// mov ecx, [rbx + disp8]
+		auto store_eax(const int8_t disp) -> void	{ emit({0x89, 0x43, static_cast<uint8_t>(disp)}); }	// mov [rbx + disp8], eax
+		auto store_ecx(const int8_t disp) -> void	{ emit({0x89, 0x4B, static_cast<uint8_t>(disp)}); }	// mov [rbx + disp8], ecx
+		auto store_imm(const Integer i) -> void		{ emit({0xC7, 0x03}); emit32(static_cast<uint32_t>(i)); }	// mov dword [rbx], imm32
+
+		// mov dword [r14 + disp32], imm32
+		auto store_ctx(const size_t offset, const uint32_t v) -> void {
+			emit({0x41, 0xC7, 0x86}); emit32(static_cast<uint32_t>(offset)); emit32(v);
+		}
+
+		auto finish() -> Code {
+			// Jump table for the JMPZ targets only known at runtime, aligned absolute addresses
+			while (bytes.size() % 8 != 0)
+				emit({0xCC});
+			bind(table_label);
+			const auto table_at = bytes.size();
+			bytes.resize(bytes.size() + 8 * instruction_count);
+
+			for (const auto& [at, label] : fixups) {
+				assert(labels[label].has_value() and "Unbound label");
+				const auto rel = static_cast<int64_t>(*labels[label]) - static_cast<int64_t>(at + 4);
+				const auto rel32 = static_cast<uint32_t>(static_cast<int32_t>(rel));
+				std::memcpy(bytes.data() + at, &rel32, sizeof(rel32));
+			}
+
+			auto code = Code{};
+			code.size = bytes.size();
+			code.memory = mmap(nullptr, code.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (code.memory == MAP_FAILED) {
+				code.memory = nullptr;
+				return code;
+			}
+
+			auto* const memory = static_cast<uint8_t*>(code.memory);
+			std::memcpy(memory, bytes.data(), bytes.size());
+			for (auto i = size_t{0}; i < instruction_count; ++i) {
+				const auto address = reinterpret_cast<uint64_t>(memory + *labels[i]);
+				std::memcpy(memory + table_at + 8 * i, &address, sizeof(address));
+			}
+
+			if (mprotect(code.memory, code.size, PROT_READ | PROT_EXEC) != 0)
+				return code;	// Still unmapped by ~Code
+
+			code.function = reinterpret_cast<Function>(code.memory);
+			return code;
+		}
+	};
+
+	static auto emit_program(Assembler& a, const Instructions& instructions) -> void {
+		const auto size = instructions.size();
+		const auto epilogue = a.new_label();
+
+		// Prologue, 5 pushes keep the native stack 16 byte aligned for the calls
+		a.emit({0x53, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57});	// push rbx, r12, r13, r14, r15
+		a.emit({0x49, 0x89, 0xFE});						// mov r14, rdi
+		a.emit({0x49, 0x8B, 0x9E}); a.emit32(offsetof(Context, sp));		// mov rbx, [r14 + sp]
+		a.emit({0x4D, 0x8B, 0xA6}); a.emit32(offsetof(Context, base));		// mov r12, [r14 + base]
+		a.emit({0x4D, 0x8B, 0xAE}); a.emit32(offsetof(Context, limit));	// mov r13, [r14 + limit]
+
+		// Enter at ctx.pc through the jump table, every instruction has its label there
+		a.emit({0x41, 0x8B, 0x86}); a.emit32(offsetof(Context, pc));		// mov eax, [r14 + pc]
+		a.emit({0x48, 0x8D, 0x0D}); a.rel32(a.table_label);			// lea rcx, [rip + table]
+		a.emit({0xFF, 0x24, 0xC1});						// jmp [rcx + rax * 8]
+
+		// Leaves through the epilogue with pc and error recorded in the Context
+		const auto fail = [&] (const size_t pc, const Error error) {
+			a.store_ctx(offsetof(Context, pc), static_cast<uint32_t>(pc));
+			a.store_ctx(offsetof(Context, error), static_cast<uint32_t>(error));
+			a.emit({0xB8}); a.emit32(static_cast<uint32_t>(State::Error));	// mov eax, Error
+			a.jmp(epilogue);
+		};
+
+		const auto cold = [&] (std::function<void()> body) -> Label {
+			const auto l = a.new_label();
+			a.stubs.push_back([&a, l, body = std::move(body)] { a.bind(l); body(); });
+			return l;
+		};
+
+		// Jumps to the error path unless the stack holds at least n values. POP and ROT take any Integer,
+		// 4n only fits the sign extended imm32 of cmp up to a point.
+		const auto require = [&] (const size_t pc, const size_t n) {
+			if (n == 0)
+				return;
+			a.emit({0x48, 0x89, 0xD8});					// mov rax, rbx
+			a.emit({0x4C, 0x29, 0xE0});					// sub rax, r12
+			if (const auto bytes = 4 * uint64_t{n}; bytes <= INT32_MAX) {
+				a.emit({0x48, 0x3D}); a.emit32(static_cast<uint32_t>(bytes));	// cmp rax, 4n
+			}
+			else {
+				a.mov_rcx(bytes);
+				a.emit({0x48, 0x39, 0xC8});					// cmp rax, rcx
+			}
+			a.jcc(Assembler::Below, cold([=] { fail(pc, Error::Underflow); }));
+		};
+
+		// Grows the stack if the next push would not fit
+		const auto reserve = [&] {
+			const auto resume = a.new_label();
+			a.emit({0x4C, 0x39, 0xEB});					// cmp rbx, r13
+			a.jcc(Assembler::Above_Equal, cold([&a, resume] {
+				a.mov_rdi_ctx();
+				a.mov_rsi_sp();
+				a.call(reinterpret_cast<const void*>(&grow));
+				a.mov_sp_rax();
+				a.emit({0x4D, 0x8B, 0xA6}); a.emit32(offsetof(Context, base));	// mov r12, [r14 + base]
+				a.emit({0x4D, 0x8B, 0xAE}); a.emit32(offsetof(Context, limit));	// mov r13, [r14 + limit]
+				a.jmp(resume);
+			}));
+			a.bind(resume);
+		};
+
+		const auto jump_error = [&] (const size_t pc) {
+			return cold([=, &a] {
+				a.emit({0x41, 0x89, 0x86}); a.emit32(offsetof(Context, target));	// mov [r14 + target], eax
+				fail(pc, Error::Jump);
+			});
+		};
+
+		for (auto i = size_t{0}; i < size; ++i) {
+			const auto& instr = instructions[i];
+			a.bind(i);
+
+			switch (instr.op) {
+				case Opcode::READ:
+					reserve();
+					a.mov_rdi_ctx();
+					a.mov_rsi_sp();
+					a.call(reinterpret_cast<const void*>(&read));
+					a.emit({0x85, 0xC0});					// test eax, eax
+					a.jcc(Assembler::Zero, cold([=] { fail(i, Error::Read); }));
+					a.add_sp(4);
+					break;
+
+				case Opcode::WRITE:
+					a.mov_rdi_ctx();
+					a.mov_rsi_sp();
+					a.call(reinterpret_cast<const void*>(&write));
+					a.mov_sp_rax();
+					break;
+
+				case Opcode::DUP:
+					require(i, 1);
+					reserve();
+					a.load_eax(-4);
+					a.emit({0x89, 0x03});					// mov [rbx], eax
+					a.add_sp(4);
+					break;
+
+				case Opcode::MUL:
+				case Opcode::ADD:
+				case Opcode::SUB:
+				case Opcode::GT:
+				case Opcode::LT:
+				case Opcode::EQ:
+					require(i, 2);
+					a.load_eax(-4);		// TOP
+					a.load_ecx(-8);		// SECOND
+					switch (instr.op) {
+						case Opcode::MUL:	a.emit({0x0F, 0xAF, 0xC1});	break;	// imul eax, ecx
+						case Opcode::ADD:	a.emit({0x01, 0xC8});		break;	// add eax, ecx
+						case Opcode::SUB:	a.emit({0x29, 0xC8});		break;	// sub eax, ecx
+						// Inverted comparisons, TOP <= SECOND etc. like Stack
+						case Opcode::GT:	a.emit({0x39, 0xC8, 0x0F, 0x9E, 0xC2, 0x0F, 0xB6, 0xC2});	break;	// cmp eax, ecx; setle dl; movzx eax, dl
+						case Opcode::LT:	a.emit({0x39, 0xC8, 0x0F, 0x9D, 0xC2, 0x0F, 0xB6, 0xC2});	break;	// cmp eax, ecx; setge dl; movzx eax, dl
+						case Opcode::EQ:	a.emit({0x39, 0xC8, 0x0F, 0x95, 0xC2, 0x0F, 0xB6, 0xC2});	break;	// cmp eax, ecx; setne dl; movzx eax, dl
+						default:		break;
+					}
+					a.store_eax(-8);
+					a.sub_sp(4);
+					break;
+
+				case Opcode::JMPZ:
+					require(i, 2);
+					a.load_eax(-4);				// Target
+					a.load_ecx(-8);				// Condition
+					a.sub_sp(8);
+					a.emit({0x85, 0xC9});			// test ecx, ecx
+					a.jcc(Assembler::Not_Zero, i + 1);
+					a.emit({0x3D}); a.emit32(static_cast<uint32_t>(size));	// cmp eax, size
+					a.jcc(Assembler::Above_Equal, jump_error(i));		// Unsigned, so negatives too
+					a.emit({0x48, 0x8D, 0x0D}); a.rel32(a.table_label);	// lea rcx, [rip + table]
+					a.emit({0xFF, 0x24, 0xC1});				// jmp [rcx + rax * 8]
+					break;
+
+				case Opcode::PUSH:
+					if (not instr.arg.has_value()) {
+						fail(i, Error::Missing_Argument);
+						break;
+					}
+
+					// PUSH t; JMPZ with a known t, the JMPZ keeps its own generic code for anyone jumping to it
+					if (i + 1 < size and instructions[i + 1].op == Opcode::JMPZ) {
+						const auto target = *instr.arg;
+						a.emit({0x48, 0x89, 0xD8});				// mov rax, rbx
+						a.emit({0x4C, 0x29, 0xE0});				// sub rax, r12
+						a.emit({0x48, 0x3D}); a.emit32(4);			// cmp rax, 4
+						a.jcc(Assembler::Below, cold([=, &a] {
+							a.store_imm(target);				// The PUSH still happens
+							a.add_sp(4);
+							fail(i + 1, Error::Underflow);
+						}));
+						a.load_ecx(-4);						// Condition
+						a.sub_sp(4);
+						a.emit({0x85, 0xC9});					// test ecx, ecx
+						if (0 <= target and static_cast<size_t>(target) < size)
+							a.jcc(Assembler::Zero, static_cast<size_t>(target));
+						else {
+							a.jcc(Assembler::Zero, cold([=, &a] {
+								a.emit({0xB8}); a.emit32(static_cast<uint32_t>(target));	// mov eax, target
+								a.emit({0x41, 0x89, 0x86}); a.emit32(offsetof(Context, target));	// mov [r14 + target], eax
+								fail(i + 1, Error::Jump);
+							}));
+						}
+						a.jmp(i + 2);
+						break;
+					}
+
+					reserve();
+					a.store_imm(*instr.arg);
+					a.add_sp(4);
+					break;
+
+				case Opcode::POP:
+					if (not instr.arg.has_value())
+						fail(i, Error::Missing_Argument);
+					else if (*instr.arg < 0)
+						fail(i, Error::Underflow);	// Like Stack::pop_n, huge once converted to size_t
+					else if (*instr.arg > 0) {
+						require(i, static_cast<size_t>(*instr.arg));
+						if (const auto bytes = 4 * uint64_t{static_cast<size_t>(*instr.arg)}; bytes <= INT32_MAX)
+							a.sub_sp(static_cast<int32_t>(bytes));
+						else {
+							a.mov_rcx(bytes);
+							a.emit({0x48, 0x29, 0xCB});	// sub rbx, rcx
+						}
+					}
+					break;
+
+				case Opcode::ROT:
+					if (not instr.arg.has_value())
+						fail(i, Error::Missing_Argument);
+					else if (*instr.arg < 0)
+						fail(i, Error::Underflow);
+					else if (const auto n = static_cast<size_t>(*instr.arg); n == 2) {
+						require(i, 2);
+						a.load_eax(-4);
+						a.load_ecx(-8);
+						a.store_ecx(-4);
+						a.store_eax(-8);
+					}
+					else if (n > 2) {
+						require(i, n);
+						a.mov_rdi_sp();
+						a.emit({0x48, 0xC7, 0xC6}); a.emit32(static_cast<uint32_t>(n));	// mov rsi, n
+						a.call(reinterpret_cast<const void*>(&rot));
+					}
+					else
+						require(i, n);
+					break;
+			}
+		}
+
+		// Falling off the end
+		a.bind(size);
+		a.store_ctx(offsetof(Context, pc), static_cast<uint32_t>(size));
+		a.emit({0xB8}); a.emit32(static_cast<uint32_t>(State::Done));	// mov eax, Done
+
+		a.bind(epilogue);
+		a.emit({0x49, 0x89, 0x9E}); a.emit32(offsetof(Context, sp));		// mov [r14 + sp], rbx
+		a.emit({0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x5B});	// pop r15, r14, r13, r12, rbx
+		a.emit({0xC3});								// ret
+
+		for (const auto stubs = std::move(a.stubs); const auto& stub : stubs)
+			stub();
+		assert(a.stubs.empty() and "Stubs do not nest");
+	}
+#endif
+};
@@ -0,0 +1,163 @@
+#pragma once
+
+#include <vector>
+#include <optional>
+#include <cstdint>
+#include <type_traits>
+
+#include "stack.hpp"
+#include "instruction.hpp"
+
+// Counted loops our programs are built from, recognized where they start so that the whole loop runs as
+// a single kernel instead of one dispatch per instruction per iteration:
+//
+// COUNT	DUP; PUSH 1; ROT 2; SUB; DUP; PUSH e; EQ; PUSH m; JMPZ; PUSH 0; PUSH h; JMPZ
+//		pushes TOP-1, TOP-2, ... down to e and goes to m. The same with ADD counts up.
+// FOLD		MUL; ROT 2; DUP; PUSH 0; EQ; PUSH d; JMPZ; PUSH 0; PUSH h; JMPZ
+//		multiplies TOP with whatever is below it down to the first 0 and goes to d, keeping the 0
+//		on top. The same with ADD sums them up.
+//
+// where h is the first instruction of the loop. naive_factorial.txt is one of each.
+//
+// Wrapping around is the same as Instruction::evaluate(): a count that has to wrap past the end of
+// Integer, a fold that would run out of values or a stack too small to start with are not taken on.
+// run() then leaves it to the instructions, which do or fail exactly the way they always do. With
+// Stack::Overflow::Error neither of them wraps around at all, the instructions fail where they overflow.
+//
+// Usage:
+//
+// const auto kernels = Loop_Idiom::recognize(instructions);
+// if (kernels[i].has_value() and Loop_Idiom::run(*kernels[i], stack))
+// 	// Go on at kernels[i]->exit
+struct Loop_Idiom {
+	using Integer = Stack::Integer;
+	using Unsigned = std::make_unsigned_t<Integer>;
+	using Opcode = Instruction::Opcode;
+
+	enum class Kind : uint8_t {
+		COUNT, FOLD,
+	};
+
+	struct Kernel {
+		Kind kind;
+		Opcode operation;	// SUB or ADD for COUNT, MUL or ADD for FOLD
+		Integer end;		// e of COUNT
+		uint32_t exit;		// m or d
+	};
+
+	// One per instruction, where a loop starts
+	static auto recognize(const Instructions& instructions) -> std::vector<std::optional<Kernel>> {
+		auto kernels = std::vector<std::optional<Kernel>>(instructions.size());
+		for (auto h = size_t{0}; h < instructions.size(); ++h)
+			kernels[h] = match(instructions, h);
+		return kernels;
+	}
+
+	static auto match(const Instructions& instructions, const size_t h) -> std::optional<Kernel> {
+		const auto is = [&] (const size_t offset, const Opcode op, const std::optional<Integer> arg = std::nullopt) {
+			return h + offset < instructions.size() and instructions[h + offset].op == op and instructions[h + offset].arg == arg;
+		};
+		const auto pushes = [&] (const size_t offset) -> std::optional<Integer> {
+			if (h + offset < instructions.size() and instructions[h + offset].op == Opcode::PUSH)
+				return instructions[h + offset].arg;
+			else
+				return std::nullopt;
+		};
+		// PUSH t; JMPZ with t inside of the program
+		const auto jumps = [&] (const size_t offset) -> std::optional<uint32_t> {
+			if (const auto target = pushes(offset);
+				target.has_value() and 0 <= *target and static_cast<size_t>(*target) < instructions.size() and is(offset + 1, Opcode::JMPZ))
+			{
+				return static_cast<uint32_t>(*target);
+			}
+			return std::nullopt;
+		};
+		const auto back = [&] (const size_t offset) {
+			return is(offset, Opcode::PUSH, 0) and jumps(offset + 1) == h;
+		};
+
+		const auto end = pushes(5);
+		if (const auto exit = jumps(7);
+			is(0, Opcode::DUP) and is(1, Opcode::PUSH, 1) and is(2, Opcode::ROT, 2)
+			and (is(3, Opcode::SUB) or is(3, Opcode::ADD))
+			and is(4, Opcode::DUP) and end.has_value() and is(6, Opcode::EQ) and exit.has_value() and back(9))
+		{
+			return Kernel{ Kind::COUNT, instructions[h + 3].op, *end, *exit };
+		}
+
+		if (const auto exit = jumps(5);
+			(is(0, Opcode::MUL) or is(0, Opcode::ADD))
+			and is(1, Opcode::ROT, 2) and is(2, Opcode::DUP) and is(3, Opcode::PUSH, 0) and is(4, Opcode::EQ)
+			and exit.has_value() and back(7))
+		{
+			return Kernel{ Kind::FOLD, instructions[h].op, 0, *exit };
+		}
+
+		return std::nullopt;
+	}
+
+	// False when the loop has to run as it is after all
+	static auto run(const Kernel& kernel, Stack& stack, const Stack::Overflow overflow = Stack::Overflow::Unchecked) -> bool {
+		switch (kernel.kind) {
+			case Kind::COUNT:	return count(kernel, stack.storage(), overflow);
+			case Kind::FOLD:	return fold(kernel, stack.storage(), overflow);
+		}
+		return false;
+	}
+
+private:
+	static auto count(const Kernel& kernel, Stack::Vector& stack, const Stack::Overflow overflow) -> bool {
+		if (stack.empty())
+			return false;
+		else if (overflow == Stack::Overflow::Error
+			and (kernel.operation == Opcode::SUB ? stack.back() < kernel.end : stack.back() > kernel.end))
+		{
+			return false;	// Wraps around to get there
+		}
+
+		// Values pushed, the last one being end
+		const auto top = static_cast<Unsigned>(stack.back());
+		const auto end = static_cast<Unsigned>(kernel.end);
+		const auto n = static_cast<Unsigned>(kernel.operation == Opcode::SUB ? top - end : end - top);
+		if (n == 0)
+			return false;	// Only stops after going all the way around
+
+		const auto step = kernel.operation == Opcode::SUB ? static_cast<Unsigned>(-1) : Unsigned{1};
+		stack.reserve(stack.size() + n);
+		auto value = top;
+		for (auto i = Unsigned{0}; i < n; ++i) {
+			value += step;
+			stack.push_back(static_cast<Integer>(value));
+		}
+		return true;
+	}
+
+	static auto fold(const Kernel& kernel, Stack::Vector& stack, const Stack::Overflow overflow) -> bool {
+		// TOP and SECOND always go in, then everything up to the 0 below them
+		const auto size = stack.size();
+		if (size < 3)
+			return false;
+
+		auto zero = size - 3;
+		while (stack[zero] != 0) {
+			if (zero == 0)
+				return false;
+			--zero;
+		}
+
+		auto value = stack.back();
+		for (auto i = size - 1; i-- > zero + 1; ) {
+			if (overflow != Stack::Overflow::Error)
+				value = Instruction::evaluate(kernel.operation, stack[i], value);
+			else if (const auto exact = Instruction::evaluate_exact(kernel.operation, stack[i], value); exact.has_value())
+				value = *exact;
+			else
+				return false;
+		}
+
+		stack.resize(zero + 2);
+		stack[zero + 1] = 0;
+		stack[zero] = value;
+		return true;
+	}
+};
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <iostream>
+
+#include "stack.hpp"
+#include "instruction.hpp"
+#include "value_range.hpp"
+
+// What an execution engine gets to work with: the prepared program, the stack it mutates
+// and the streams behind READ and WRITE.
+struct Machine {
+	enum class State {
+		Running, Error, Done
+	};
+
+	// Where and why an engine stopped, pc is an index into instructions
+	struct Exit {
+		State state;
+		size_t pc;
+	};
+
+	// A program compiled to native code ahead of time, see transpiler.hpp
+	using Compiled = auto (*)(Stack&, std::istream&, std::ostream&) -> Exit;
+
+	const Instructions& instructions;
+	Stack& stack;
+	std::istream& cin;
+	std::ostream& cout;
+	Value_Range::Interval input = {};	// What every READ is declared to read, see Interpreter::inputs()
+
+	// READ on every engine, false with the failure already reported. Reading anything outside of input
+	// fails like there being nothing to read does, the stack is left alone either way.
+	auto read(Stack::Integer& i) const -> bool {
+		if (not (cin >> i)) {
+			report_read();
+			return false;
+		}
+		else if (not input.contains(i)) {
+			report_input(i, input.lo, input.hi);
+			return false;
+		}
+		else
+			return true;
+	}
+
+	// Messages of a failed instruction, shared so every engine reports the same way
+	static auto report_underflow(const Instruction::Opcode op, const Stack::Integer arg = 0) -> void {
+		using Opcode = Instruction::Opcode;
+		switch (op) {
+			case Opcode::DUP:	std::cerr << "\tError: DUP: failed, stack is empty\n";				break;
+			case Opcode::JMPZ:	std::cerr << "\tError: JMPZ: stack does not have at least 2 int\n";		break;
+			case Opcode::POP:	std::cerr << "\tError: POP: stack does not have at least " << arg << " ints\n";	break;
+			case Opcode::ROT:	std::cerr << "\tError: stack does not have at least " << arg << " ints\n";		break;
+			default:
+				std::cerr << "\tError: " << Instruction::name(op) << ": failed, stack does not have 2 ints\n";
+		}
+	}
+
+	static auto report_overflow(const Instruction::Opcode op) -> void {
+		std::cerr << "\tError: " << Instruction::name(op) << ": result does not fit an int\n";
+	}
+
+	static auto report_jump(const Stack::Integer target, const size_t program_size) -> void {
+		std::cerr
+			<< "\tError: JMPZ: requested jump to " << target
+			<< " is past end of program " << (program_size - 1) << '\n';
+	}
+
+	static auto report_read() -> void {
+		std::cerr << "\tError: READ: could not read integer from stdin\n";
+	}
+
+	static auto report_input(const Stack::Integer i, const int64_t lo, const int64_t hi) -> void {
+		std::cerr << "\tError: READ: " << i << " is outside of the declared input [" << lo << ", " << hi << "]\n";
+	}
+
+	static auto report_missing_argument(const Instruction::Opcode op) -> void {
+		if (op == Instruction::Opcode::ROT)
+			std::cerr << "\tError: arguments expected\n";
+		else
+			std::cerr << "\tError: " << Instruction::name(op) << ": arguments expected\n";
+	}
+};
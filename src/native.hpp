@@ -0,0 +1,275 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <sstream>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <filesystem>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <cassert>
+
+#if __has_include(<dlfcn.h>) and __has_include(<unistd.h>) and __has_include(<sys/stat.h>) and __has_include(<sys/wait.h>)
+#	define NATIVE_AVAILABLE
+#	include <dlfcn.h>
+#	include <unistd.h>
+#	include <sys/stat.h>
+#	include <sys/wait.h>
+#endif
+
+#include "stack.hpp"
+#include "instruction.hpp"
+#include "machine.hpp"
+#include "transpiler.hpp"
+
+// Compiles a prepared program to C with the Transpiler, builds it into a shared object with
+// the system compiler and dlopen()s it. Shared objects are cached by a hash of their source,
+// so a program is only ever compiled once per machine. Whatever is in the cache gets loaded as it is,
+// so a cache directory anyone but the user could write to is not used at all.
+//
+// Usage:
+//
+// if (const auto code = Native::compile(instructions); code)
+// 	const auto exit = Native::run(code, machine);
+// else
+// 	// No compiler, no dlopen or the build failed, use one of the other engines
+//
+// Compiling takes as long as starting the compiler does, this is for programs that run long
+// or often enough to amortize that.
+struct Native {
+	using Integer = Stack::Integer;
+	using State = Machine::State;
+
+	struct Options {
+		std::string compiler = "cc";
+		std::string flags = "-O2 -shared -fPIC";
+		std::filesystem::path cache = default_cache();
+	};
+
+	// A loaded shared object, empty if the program could not be compiled
+	struct Code {
+		void* handle = nullptr;
+		Transpiler::C_Function function = nullptr;
+
+		Code() = default;
+		Code(const Code&) = delete;
+		auto operator= (const Code&) -> Code& = delete;
+		Code(Code&& other) noexcept { *this = std::move(other); }
+		auto operator= (Code&& other) noexcept -> Code& {
+			std::swap(handle, other.handle);
+			std::swap(function, other.function);
+			return *this;
+		}
+
+		~Code() {
+#ifdef NATIVE_AVAILABLE
+			if (handle != nullptr)
+				dlclose(handle);
+#endif
+		}
+
+		explicit operator bool () const {
+			return function != nullptr;
+		}
+	};
+
+	static constexpr auto symbol = std::string_view{"sage_program"};
+
+	static auto compile(const Instructions& instructions) -> Code {
+		return compile(instructions, Options{});
+	}
+
+	static auto compile(const Instructions& instructions, const Options& options) -> Code {
+#ifdef NATIVE_AVAILABLE
+		namespace fs = std::filesystem;
+
+		auto source = std::ostringstream{};
+		Transpiler::emit(instructions, { .function = std::string{symbol}, .dialect = Transpiler::Dialect::C }, source);
+
+		// Same source built the same way is the same shared object
+		auto name = std::ostringstream{};
+		name << std::hex << std::setw(16) << std::setfill('0') << hash(source.str() + '\0' + options.compiler + '\0' + options.flags);
+		const auto c_path = options.cache / (name.str() + ".c");
+		const auto so_path = options.cache / (name.str() + ".so");
+
+		if (not private_directory(options.cache))
+			return {};
+
+		if (auto ec = std::error_code{}; not fs::exists(so_path, ec)) {
+			// Write and build next to the final names and rename, concurrent builds of the same program then
+			// never see half a file
+			const auto pid = '.' + std::to_string(getpid());
+			const auto tmp_c_path = options.cache / (name.str() + pid + ".c");
+			if (auto c = std::ofstream{tmp_c_path}; not (c << source.str() and c.flush())) {
+				std::cerr << "\tWarning: native: could not write " << tmp_c_path << '\n';
+				fs::remove(tmp_c_path, ec);
+				return {};
+			}
+			fs::rename(tmp_c_path, c_path, ec);
+			if (ec) {
+				std::cerr << "\tWarning: native: could not rename " << tmp_c_path << ": " << ec.message() << '\n';
+				return {};
+			}
+
+			const auto tmp_path = options.cache / (name.str() + pid + ".so");
+			if (not build(options, c_path, tmp_path)) {
+				std::cerr << "\tWarning: native: " << options.compiler << " failed to build " << c_path << '\n';
+				fs::remove(tmp_path, ec);
+				return {};
+			}
+
+			fs::rename(tmp_path, so_path, ec);
+			if (ec) {
+				std::cerr << "\tWarning: native: could not rename " << tmp_path << ": " << ec.message() << '\n';
+				return {};
+			}
+		}
+
+		auto code = Code{};
+		code.handle = dlopen(so_path.c_str(), RTLD_NOW | RTLD_LOCAL);
+		if (code.handle == nullptr) {
+			std::cerr << "\tWarning: native: " << dlerror() << '\n';
+			return {};
+		}
+
+		code.function = reinterpret_cast<Transpiler::C_Function>(dlsym(code.handle, symbol.data()));
+		if (code.function == nullptr)
+			std::cerr << "\tWarning: native: " << so_path << " has no " << symbol << '\n';
+		return code;
+#else
+		(void)instructions;
+		(void)options;
+		return {};
+#endif
+	}
+
+	static auto run(const Code& code, const Machine& machine) -> Machine::Exit {
+		assert(code and "Check Native::compile() before running");
+
+		const auto host = Transpiler::Host{
+			.ctx = const_cast<Machine*>(&machine),
+			.read = read,
+			.write = write,
+			.write_null = write_null,
+			.report = report,
+		};
+
+		auto& storage = machine.stack.storage();
+		auto depth = storage.size();
+		storage.resize(std::max<size_t>(64, 2 * depth));
+
+		// The compiled program stops with State::Running whenever it needs a bigger stack
+		auto pc = size_t{0};
+		auto state = State::Running;
+		while ((state = static_cast<State>(code.function(&host, storage.data(), &depth, storage.size(), &pc))) == State::Running)
+			storage.resize(2 * storage.size());
+
+		storage.resize(depth);
+		return { state, pc };
+	}
+
+	// FNV-1a, only used to name cache entries
+	static constexpr auto hash(const std::string_view s) -> uint64_t {
+		auto h = uint64_t{14695981039346656037ull};
+		for (const auto c : s) {
+			h ^= static_cast<uint8_t>(c);
+			h *= 1099511628211ull;
+		}
+		return h;
+	}
+
+private:
+#ifdef NATIVE_AVAILABLE
+	// Creates the cache as only the user's own, and refuses one that is not: a symlink, someone else's
+	// or writable by anyone else, they could have put any shared object they like in there
+	static auto private_directory(const std::filesystem::path& cache) -> bool {
+		auto ec = std::error_code{};
+		if (cache.has_parent_path())
+			std::filesystem::create_directories(cache.parent_path(), ec);
+		if (mkdir(cache.c_str(), 0700) != 0 and errno != EEXIST) {
+			std::cerr << "\tWarning: native: could not create " << cache << ": " << std::strerror(errno) << '\n';
+			return false;
+		}
+
+		struct stat status {};
+		if (lstat(cache.c_str(), &status) != 0
+			or not S_ISDIR(status.st_mode) or status.st_uid != getuid() or (status.st_mode & (S_IWGRP | S_IWOTH)) != 0)
+		{
+			std::cerr << "\tWarning: native: " << cache << " is not a directory only this user can write to, not using it\n";
+			return false;
+		}
+		return true;
+	}
+
+	// Runs the compiler without a shell, whatever TMPDIR puts in the paths is never taken for a command.
+	// The compiler and its flags are split on whitespace.
+	static auto build(const Options& options, const std::filesystem::path& c_path, const std::filesystem::path& so_path) -> bool {
+		auto words = std::vector<std::string>{};
+		auto command = std::istringstream{options.compiler + ' ' + options.flags};
+		for (auto word = std::string{}; command >> word; )
+			words.push_back(std::move(word));
+		words.insert(words.end(), { "-o", so_path.string(), c_path.string() });
+
+		auto argv = std::vector<char*>{};
+		for (auto& word : words)
+			argv.push_back(word.data());
+		argv.push_back(nullptr);
+
+		const auto pid = fork();
+		if (pid < 0)
+			return false;
+		if (pid == 0) {
+			execvp(argv[0], argv.data());
+			_exit(127);
+		}
+
+		auto status = 0;
+		while (waitpid(pid, &status, 0) < 0) {
+			if (errno != EINTR)
+				return false;
+		}
+		return WIFEXITED(status) and WEXITSTATUS(status) == 0;
+	}
+#endif
+
+	static auto default_cache() -> std::filesystem::path {
+		auto ec = std::error_code{};
+		auto tmp = std::filesystem::temp_directory_path(ec);
+		if (ec)
+			tmp = "/tmp";
+#ifdef NATIVE_AVAILABLE
+		return tmp / ("sage-native-" + std::to_string(getuid()));	// Not shared between users
+#else
+		return tmp / "sage-native";
+#endif
+	}
+
+	// Host callbacks, ctx is the Machine
+	static auto read(void* ctx, Integer* value) -> int {
+		return static_cast<Machine*>(ctx)->read(*value);
+	}
+
+	static auto write(void* ctx, const Integer value) -> void {
+		static_cast<Machine*>(ctx)->cout << value << ' ';
+	}
+
+	static auto write_null(void* ctx) -> void {
+		static_cast<Machine*>(ctx)->cout << "null" << ' ';
+	}
+
+	static auto report(void* ctx, const int report, const int op, const Integer arg) -> void {
+		const auto& machine = *static_cast<Machine*>(ctx);
+		const auto opcode = static_cast<Instruction::Opcode>(op);
+		switch (static_cast<Transpiler::Report>(report)) {
+			case Transpiler::Report::Underflow:		Machine::report_underflow(opcode, arg);				break;
+			case Transpiler::Report::Jump:			Machine::report_jump(arg, machine.instructions.size());	break;
+			case Transpiler::Report::Read:									break;	// Machine::read() reported it
+			case Transpiler::Report::Missing_Argument:	Machine::report_missing_argument(opcode);			break;
+		}
+	}
+};
@@ -0,0 +1,172 @@
+#pragma once
+
+#include <vector>
+#include <optional>
+#include <algorithm>
+#include <limits>
+
+#include "stack.hpp"
+#include "instruction.hpp"
+#include "stack_depth.hpp"
+#include "dead_code.hpp"
+
+// Specializes a program for input that always starts the same way. Whatever runs before the program
+// needs anything else is run right here: READ takes from the known prefix and the values it works on
+// are all ones it pushed itself. What is left is the residual program, which starts by writing what
+// was written so far, pushes what was left on the stack and jumps to where the program stopped.
+//
+// It stops at the first instruction that
+// - READs past the prefix
+// - needs a value it did not push, the stack is left over from the last run after all
+// - fails, so that the residual program fails there too, which with Stack::Overflow::Error includes
+//   MUL, ADD and SUB that overflow
+// and after `budget` instructions, a program that loops forever on known values still has to.
+//
+// Jump targets move behind what the residual program starts with, so programs with computed jumps
+// are left alone. So are programs that stop right away.
+//
+// Usage:
+//
+// const auto residual = Partial_Evaluation::specialize(instructions, { 3, 7 });
+// interpreter.prepare(residual.instructions);	// And feed it the input past residual.consumed
+struct Partial_Evaluation {
+	using Integer = Stack::Integer;
+	using Opcode = Instruction::Opcode;
+
+	static constexpr auto budget = size_t{1'000'000};
+
+	struct Residual {
+		Instructions instructions;
+		size_t consumed = 0;	// Values of the prefix it READ, the rest still has to be input
+	};
+
+	// Where running a program on nothing but the prefix got, and what it did up to there
+	struct Known {
+		size_t pc = 0;
+		std::vector<Integer> stack;	// Pushed on top of whatever the program started with
+		std::vector<Integer> output;	// WRITEs
+		size_t consumed = 0;		// Of the prefix
+	};
+
+	// Works for any program, computed jumps go wherever the known values say
+	static auto evaluate(
+		const Instructions& instructions,
+		const std::vector<Integer>& prefix = {},
+		const Stack::Overflow overflow = Stack::Overflow::Unchecked
+	) -> Known {
+		const auto size = instructions.size();
+
+		auto known = Known{};
+		auto& [pc, stack, output, consumed] = known;
+		const auto pop = [&] {
+			const auto top = stack.back();
+			stack.pop_back();
+			return top;
+		};
+
+		for (auto steps = size_t{0}; pc < size and steps < budget; ++steps) {
+			const auto& instr = instructions[pc];
+			const auto needs = Stack_Depth::needs(instr);
+			if (not needs.has_value() or stack.size() < std::max<size_t>(*needs, instr.op == Opcode::WRITE ? 1 : 0))
+				break;	// Fails or looks below what was pushed, WRITE would print null or whatever is there
+
+			if (instr.op == Opcode::READ) {
+				if (consumed == prefix.size())
+					break;
+				stack.push_back(prefix[consumed++]);
+			}
+			else if (instr.op == Opcode::JMPZ) {
+				const auto target = stack[stack.size() - 1];
+				const auto condition = stack[stack.size() - 2];
+				if (condition == 0 and (target < 0 or static_cast<size_t>(target) >= size))
+					break;
+
+				stack.resize(stack.size() - 2);
+				if (condition == 0) {
+					pc = static_cast<size_t>(target);
+					continue;
+				}
+			}
+			else {
+				switch (instr.op) {
+					case Opcode::WRITE:	output.push_back(pop());		break;
+					case Opcode::DUP:	stack.push_back(stack.back());		break;
+					case Opcode::PUSH:	stack.push_back(*instr.arg);		break;
+					case Opcode::POP:	stack.resize(stack.size() - static_cast<size_t>(*instr.arg));	break;
+					case Opcode::ROT:
+						std::rotate(stack.end() - *instr.arg, stack.end() - 1, stack.end());
+						break;
+					default: {
+						const auto top = stack.back();
+						const auto second = stack[stack.size() - 2];
+						const auto result = overflow == Stack::Overflow::Error
+							? Instruction::evaluate_exact(instr.op, top, second)
+							: Instruction::evaluate(instr.op, top, second);
+						if (not result.has_value())
+							return known;	// Before it fails, pc is still there
+
+						pop();
+						stack.back() = *result;
+						break;
+					}
+				}
+			}
+			++pc;
+		}
+
+		return known;
+	}
+
+	static auto specialize(
+		const Instructions& instructions,
+		const std::vector<Integer>& prefix,
+		const Stack::Overflow overflow = Stack::Overflow::Unchecked
+	) -> Residual {
+		const auto size = instructions.size();
+		if (size == 0 or Stack_Depth::analyze(instructions).dynamic)
+			return { instructions, 0 };
+
+		const auto [pc, stack, output, consumed] = evaluate(instructions, prefix, overflow);
+		if (pc == 0)
+			return { instructions, 0 };
+
+		auto residual = Instructions{};
+		for (const auto value : output) {
+			residual.emplace_back(Opcode::PUSH, value);
+			residual.emplace_back(Opcode::WRITE, std::nullopt);
+		}
+		for (const auto value : stack)
+			residual.emplace_back(Opcode::PUSH, value);
+
+		// Ran to the end, there is nothing left to jump to
+		if (pc >= size) {
+			if (residual.empty()) {
+				// Does nothing, but a program it is
+				residual.emplace_back(Opcode::PUSH, 0);
+				residual.emplace_back(Opcode::POP, 1);
+			}
+			return { residual, consumed };
+		}
+
+		const auto offset = static_cast<Integer>(residual.size() + 3);
+		residual.emplace_back(Opcode::PUSH, 0);
+		residual.emplace_back(Opcode::PUSH, static_cast<Integer>(pc) + offset);
+		residual.emplace_back(Opcode::JMPZ, std::nullopt);
+
+		// Targets past the end have to stay there, unless they are too far out to ever come back in
+		const auto start = residual.size();
+		residual.insert(residual.end(), instructions.cbegin(), instructions.cend());
+		for (auto i = start + 1; i < residual.size(); ++i) {
+			if (const auto target = Stack_Depth::static_target(residual, i);
+				residual[i].op == Opcode::JMPZ and target.has_value() and 0 <= *target and *target <= std::numeric_limits<Integer>::max() - offset)
+			{
+				residual[i - 1].arg = *target + offset;
+			}
+		}
+
+		// The setup is only ever run through now
+		auto lines = std::vector<size_t>(residual.size());
+		Dead_Code::eliminate(residual, lines);
+		return { residual, consumed };
+	}
+};
@@ -0,0 +1,288 @@
+#pragma once
+
+#include <vector>
+#include <optional>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+
+#include "stack.hpp"
+#include "instruction.hpp"
+#include "stack_depth.hpp"
+#include "constant_propagation.hpp"
+#include "dead_code.hpp"
+
+// Rewrites short sequences into shorter ones that do the same, until there is nothing left to rewrite.
+//
+// Basic	ROT 1				nothing
+//		ROT 2; ROT 2			nothing
+//		DUP; POP 1			nothing
+//		PUSH k; POP 1			nothing
+//		PUSH k|DUP; POP n		POP n-1
+//		<binary>; POP n			POP n+1
+//		POP a; POP b			POP a+b
+//		PUSH c; PUSH t; JMPZ		nothing if t is the next instruction anyway
+//		PUSH t; JMPZ			PUSH u; JMPZ if t is a `PUSH 0; PUSH u; JMPZ` itself
+//		Whatever Dead_Code finds can never run
+// Fold		PUSH a; PUSH b; <binary>	PUSH (b <binary> a)
+//		PUSH a; PUSH b; ROT 2		PUSH b; PUSH a
+// Propagate	Whatever Constant_Propagation::rewrite() finds in between, so that the above can take
+//		apart the constant computations it leaves behind
+//
+// Whatever a program does has to stay the same, errors included. Anything that could fail is only
+// dropped where Stack_Depth proves it cannot, which with Stack::Overflow::Error MUL, ADD and SUB never
+// are, and nothing that overflows is folded then. Nothing but the first instruction of a sequence may
+// be a jump target. Static jump targets are renumbered after the instructions that were dropped,
+// programs with computed jumps are left alone as there is no telling where those go.
+//
+// `PUSH 0; PUSH t; JMPZ` already runs as a single Superinstruction::Kind::JUMP, all there is to do
+// with it here is to jump straight to where it goes.
+//
+// Usage:
+//
+// interpreter.prepare(Peephole::optimize(Interpreter::parse(program), Peephole::Level::Fold));
+struct Peephole {
+	using Integer = Stack::Integer;
+	using Opcode = Instruction::Opcode;
+
+	enum class Level {
+		None, Basic, Fold, Propagate,
+	};
+
+	static auto optimize(Instructions instructions, const Level level, const Stack::Overflow overflow = Stack::Overflow::Unchecked) -> Instructions {
+		auto lines = std::vector<size_t>{};
+		return optimize(std::move(instructions), level, lines, overflow);
+	}
+
+	// lines gets where every instruction that is left was in the program handed in, for diagnostics
+	static auto optimize(
+		Instructions instructions,
+		const Level level,
+		std::vector<size_t>& lines,
+		const Stack::Overflow overflow = Stack::Overflow::Unchecked
+	) -> Instructions {
+		lines.resize(instructions.size());
+		std::iota(lines.begin(), lines.end(), size_t{0});
+		if (level == Level::None)
+			return instructions;
+
+		// Every rewrite makes the program or a chain of jumps shorter, or takes away a DUP or JMPZ,
+		// this cannot go on forever
+		while (
+			rewrite(instructions, lines, level, overflow)
+			or (level == Level::Propagate and Constant_Propagation::rewrite(instructions))
+			or Dead_Code::eliminate(instructions, lines))
+		{
+		}
+		return instructions;
+	}
+
+private:
+	struct Match {
+		size_t length;
+		Instructions replacement;
+	};
+
+	// One pass, false when it did not change anything
+	static auto rewrite(Instructions& instructions, std::vector<size_t>& lines, const Level level, const Stack::Overflow overflow) -> bool {
+		const auto size = instructions.size();
+		const auto depth = Stack_Depth::analyze(instructions);
+		if (depth.dynamic)
+			return false;
+
+		auto is_target = std::vector<bool>(size, false);
+		auto feeds_jump = std::vector<bool>(size, false);	// PUSH t of a static jump
+		for (auto i = size_t{1}; i < size; ++i) {
+			if (const auto target = Stack_Depth::static_target(instructions, i);
+				instructions[i].op == Opcode::JMPZ and target.has_value())
+			{
+				feeds_jump[i - 1] = true;
+				if (0 <= *target and static_cast<size_t>(*target) < size)
+					is_target[static_cast<size_t>(*target)] = true;
+			}
+		}
+
+		auto changed = thread_jumps(instructions, feeds_jump);
+
+		auto optimized = Instructions{};
+		auto optimized_lines = std::vector<size_t>{};
+		optimized.reserve(size);
+		optimized_lines.reserve(size);
+		auto renumbered = std::vector<size_t>(size, 0);
+		auto feeds = std::vector<bool>{};	// feeds_jump of optimized
+
+		for (auto i = size_t{0}; i < size; ) {
+			renumbered[i] = optimized.size();
+
+			const auto match = find(instructions, i, depth, level, overflow);
+			const auto fits = [&] {
+				if (not match.has_value())
+					return false;
+				for (auto j = i + 1; j < i + match->length; ++j)
+					if (is_target[j])
+						return false;
+				// Jumping past the last instruction is an error, not the end of the program
+				return not (is_target[i] and i + match->length == size and match->replacement.empty());
+			};
+
+			if (fits()) {
+				for (auto j = i + 1; j < i + match->length; ++j)
+					renumbered[j] = optimized.size();
+				for (const auto& instr : match->replacement) {
+					optimized.push_back(instr);
+					optimized_lines.push_back(lines[i]);
+					feeds.push_back(false);
+				}
+				i += match->length;
+				changed = true;
+			}
+			else {
+				optimized.push_back(instructions[i]);
+				optimized_lines.push_back(lines[i]);
+				feeds.push_back(feeds_jump[i]);
+				++i;
+			}
+		}
+
+		// An empty program does not even prepare, unlike one that does nothing
+		if (not changed or optimized.empty())
+			return false;
+
+		// Targets outside of the program stay outside of it, they still have to fail
+		for (auto i = size_t{0}; i < optimized.size(); ++i)
+			if (feeds[i] and 0 <= *optimized[i].arg and static_cast<size_t>(*optimized[i].arg) < size)
+				optimized[i].arg = static_cast<Integer>(renumbered[static_cast<size_t>(*optimized[i].arg)]);
+
+		instructions = std::move(optimized);
+		lines = std::move(optimized_lines);
+		return true;
+	}
+
+	static auto find(
+		const Instructions& instructions,
+		const size_t i,
+		const Stack_Depth& depth,
+		const Level level,
+		const Stack::Overflow overflow
+	) -> std::optional<Match> {
+		const auto at = [&] (const size_t offset, const Opcode op) -> const Instruction* {
+			if (i + offset < instructions.size() and instructions[i + offset].op == op)
+				return &instructions[i + offset];
+			else
+				return nullptr;
+		};
+		const auto with = [] (const Instruction* instr, const Integer arg) {
+			return instr != nullptr and instr->arg == arg;
+		};
+		const auto with_arg = [] (const Instruction* instr) {
+			return instr != nullptr and instr->arg.has_value();
+		};
+
+		// Fails where it overflows, so it is not safe to drop either
+		const auto checked = [&] (const Opcode op) {
+			return overflow == Stack::Overflow::Error and Opcode::MUL <= op and op <= Opcode::SUB;
+		};
+		const auto binary = [&] (const Instruction* instr) {
+			return instr != nullptr and Opcode::MUL <= instr->op and instr->op <= Opcode::EQ and not checked(instr->op);
+		};
+		const auto pop = [&] (const size_t offset) -> std::optional<Integer> {
+			if (const auto* instr = at(offset, Opcode::POP); with_arg(instr) and *instr->arg > 0)
+				return *instr->arg;
+			else
+				return std::nullopt;
+		};
+		// Both run without failing, so the error of either one never has to be reproduced
+		const auto safe = depth.safe(i) and i + 1 < instructions.size() and depth.safe(i + 1);
+
+		if (with(at(0, Opcode::ROT), 1) and depth.safe(i))
+			return Match{ 1, {} };
+
+		if (with(at(0, Opcode::ROT), 2) and with(at(1, Opcode::ROT), 2) and depth.safe(i))
+			return Match{ 2, {} };
+
+		if (at(0, Opcode::DUP) != nullptr and with(at(1, Opcode::POP), 1) and depth.safe(i))
+			return Match{ 2, {} };
+
+		if (with_arg(at(0, Opcode::PUSH)) and with_arg(at(1, Opcode::PUSH)) and at(2, Opcode::JMPZ) != nullptr
+			and *instructions[i + 1].arg == static_cast<Integer>(i + 3) and i + 3 < instructions.size())
+		{
+			return Match{ 3, {} };
+		}
+
+		if (with_arg(at(0, Opcode::PUSH)) and with(at(1, Opcode::POP), 1))
+			return Match{ 2, {} };
+
+		if (const auto n = pop(1); n.has_value() and safe) {
+			constexpr auto max = std::numeric_limits<Integer>::max();
+			if (*n > 1 and (with_arg(at(0, Opcode::PUSH)) or at(0, Opcode::DUP) != nullptr))
+				return Match{ 2, { Instruction{ Opcode::POP, *n - 1 } } };
+			if (*n < max and binary(&instructions[i]))
+				return Match{ 2, { Instruction{ Opcode::POP, *n + 1 } } };
+			if (const auto first = pop(0); first.has_value() and *first <= max - *n)
+				return Match{ 2, { Instruction{ Opcode::POP, *first + *n } } };
+		}
+
+		if (level >= Level::Fold and with_arg(at(0, Opcode::PUSH)) and with_arg(at(1, Opcode::PUSH)) and with(at(2, Opcode::ROT), 2))
+			return Match{ 3, { instructions[i + 1], instructions[i] } };
+
+		if (level >= Level::Fold and with_arg(at(0, Opcode::PUSH)) and with_arg(at(1, Opcode::PUSH)) and i + 2 < instructions.size()) {
+			switch (const auto op = instructions[i + 2].op; op) {
+				case Opcode::MUL:
+				case Opcode::ADD:
+				case Opcode::SUB:
+				case Opcode::GT:
+				case Opcode::LT:
+				case Opcode::EQ: {
+					const auto top = *instructions[i + 1].arg;
+					const auto second = *instructions[i].arg;
+					if (not checked(op))
+						return Match{ 3, { Instruction{ Opcode::PUSH, Instruction::evaluate(op, top, second) } } };
+					else if (const auto value = Instruction::evaluate_exact(op, top, second); value.has_value())
+						return Match{ 3, { Instruction{ Opcode::PUSH, *value } } };
+					break;
+				}
+				default:
+					break;
+			}
+		}
+
+		return std::nullopt;
+	}
+
+	// Static jumps onto `PUSH 0; PUSH u; JMPZ` go to u instead, unless that goes around in circles
+	static auto thread_jumps(Instructions& instructions, const std::vector<bool>& feeds_jump) -> bool {
+		const auto size = instructions.size();
+		const auto jump = [&] (const Integer target) -> std::optional<Integer> {
+			if (const auto t = static_cast<size_t>(target);
+				0 <= target and t + 2 < size
+				and instructions[t].op == Opcode::PUSH and instructions[t].arg == 0
+				and feeds_jump[t + 1])
+			{
+				const auto next = *instructions[t + 1].arg;
+				if (0 <= next and static_cast<size_t>(next) < size)
+					return next;
+			}
+			return std::nullopt;
+		};
+
+		auto changed = false;
+		for (auto i = size_t{0}; i < size; ++i) {
+			if (not feeds_jump[i])
+				continue;
+
+			auto visited = std::vector<bool>(size, false);
+			auto target = *instructions[i].arg;
+			auto next = jump(target);
+			for (; next.has_value() and not visited[static_cast<size_t>(*next)]; next = jump(target)) {
+				visited[static_cast<size_t>(*next)] = true;
+				target = *next;
+			}
+
+			if (not next.has_value() and target != *instructions[i].arg) {
+				instructions[i].arg = target;
+				changed = true;
+			}
+		}
+		return changed;
+	}
+};
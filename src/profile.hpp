@@ -0,0 +1,116 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <iostream>
+
+#include "instruction.hpp"
+
+// Counts the n-grams of opcodes along the executed trace, taken jumps included, see
+// Interpreter::profile(). Used to pick which superinstructions are worth having, see
+// Superinstruction::Selection.
+//
+// Usage:
+//
+// auto profile = Profile{};
+// interpreter.profile(profile, callback);	// Once per training run
+// for (const auto& [gram, count] : profile.top(10))
+// 	std::cout << gram << ' ' << count << '\n';
+struct Profile {
+	using Opcode = Instruction::Opcode;
+
+	static constexpr auto min_length = size_t{2};
+	static constexpr auto max_length = size_t{5};
+
+	// Up to max_length opcodes packed 4 bits each, the length on top
+	struct Gram {
+		uint64_t key;
+
+		static_assert(Instruction::opcode_count <= 16);
+
+		template <typename It>
+		static auto pack(It first, const It last) -> Gram {
+			auto key = uint64_t{0};
+			auto length = uint64_t{0};
+			for (; first != last; ++first, ++length)
+				key = (key << 4) | static_cast<uint64_t>(*first);
+			return { (length << 60) | key };
+		}
+
+		auto length() const -> size_t {
+			return static_cast<size_t>(key >> 60);
+		}
+
+		auto operator[] (const size_t i) const -> Opcode {
+			return static_cast<Opcode>((key >> 4 * (length() - 1 - i)) & 0xf);
+		}
+
+		auto operator== (const Gram&) const -> bool = default;
+
+		friend auto operator<< (std::ostream& o, const Gram& gram) -> std::ostream& {
+			for (auto i = size_t{0}; i < gram.length(); ++i)
+				o << (i > 0 ? "; " : "") << Instruction::name(gram[i]);
+			return o;
+		}
+	};
+
+	struct Gram_Hash {
+		auto operator() (const Gram& gram) const -> size_t {
+			return std::hash<uint64_t>{}(gram.key);
+		}
+	};
+
+	std::unordered_map<Gram, uint64_t, Gram_Hash> counts;
+	uint64_t executed = 0;	// Instructions
+
+	// Every n-gram that ends with op
+	auto record(const Opcode op) -> void {
+		std::shift_left(window.begin(), window.end(), 1);
+		window.back() = op;
+		filled = std::min(filled + 1, max_length);
+		++executed;
+
+		for (auto n = min_length; n <= filled; ++n)
+			++counts[Gram::pack(window.end() - n, window.end())];
+	}
+
+	// Separate runs do not make up a trace together
+	auto restart() -> void {
+		filled = 0;
+	}
+
+	auto count(const Gram gram) const -> uint64_t {
+		if (const auto it = counts.find(gram); it != counts.end())
+			return it->second;
+		else
+			return 0;
+	}
+
+	auto merge(const Profile& other) -> void {
+		for (const auto& [gram, count] : other.counts)
+			counts[gram] += count;
+		executed += other.executed;
+	}
+
+	// Most frequent first, ties by the longer gram
+	auto top(const size_t n) const -> std::vector<std::pair<Gram, uint64_t>> {
+		auto grams = std::vector<std::pair<Gram, uint64_t>>{counts.cbegin(), counts.cend()};
+		const auto by_count = [] (const auto& a, const auto& b) {
+			if (a.second != b.second)
+				return a.second > b.second;
+			else
+				return a.first.key > b.first.key;
+		};
+		const auto middle = grams.begin() + static_cast<ptrdiff_t>(std::min(n, grams.size()));
+		std::partial_sort(grams.begin(), middle, grams.end(), by_count);
+		grams.erase(middle, grams.end());
+		return grams;
+	}
+
+private:
+	std::array<Opcode, max_length> window{};
+	size_t filled = 0;
+};
@@ -0,0 +1,274 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+
+#include "stack.hpp"
+#include "instruction.hpp"
+#include "machine.hpp"
+
+// Every instruction starts out generic and the first time it runs it rewrites itself, right there in
+// the code, into a form that no longer has to look at its argument:
+//
+//	ROT 2			SWAP
+//	POP 1			DROP
+//	ROT 1			NOP
+//	ROT n, POP n		ROT_N, POP_N
+//	PUSH t; JMPZ		BRANCH to t, t already checked to be in the program, the JMPZ is skipped
+//
+// Nothing but what the instruction itself says decides what it becomes, so running it again never
+// has to undo a rewrite. Whatever fails stays generic and fails again the same way next time. POP and
+// ROT of 0 or less never get here, the Verifier drops their argument.
+//
+// With Stack::Overflow::Error MUL, ADD and SUB compile to CHECKED_MUL, CHECKED_ADD and CHECKED_SUB,
+// which fail like Engine::Loop does instead of wrapping around.
+//
+// The rewrites go to the Code, never to the Instructions. Each Interpreter compiles its own Code from
+// the instructions it shares with everybody else, so no two of them ever rewrite the same Code.
+//
+// Usage:
+//
+// auto code = Quickening::compile(instructions, overflow);	// One per thread
+// const auto exit = Quickening::run(code, machine);
+//
+// run() can also start in the middle of the program and give up after a number of backward jumps,
+// handing back State::Running at the target of the last one. See tiering.hpp.
+struct Quickening {
+	using Integer = Stack::Integer;
+	using Opcode = Instruction::Opcode;
+	using State = Machine::State;
+
+	// Numbered after the Opcodes, which are what every instruction starts out as
+	enum class Kind : uint8_t {
+		SWAP = Instruction::opcode_count,
+		DROP, ROT_N, POP_N, NOP, BRANCH,
+		MISSING_ARGUMENT,	// PUSH, POP or ROT without one
+		CHECKED_MUL, CHECKED_ADD, CHECKED_SUB,	// Fail on overflow, in the order of their Opcodes
+		DONE,			// One past the end
+	};
+
+	struct Op {
+		uint8_t kind;	// Opcode or Kind
+		Integer arg;	// For BRANCH the target
+	};
+	using Code = std::vector<Op>;
+
+	static auto compile(const Instructions& instructions, const Stack::Overflow overflow = Stack::Overflow::Unchecked) -> Code {
+		auto code = Code{};
+		code.reserve(instructions.size() + 1);
+		for (const auto& instr : instructions) {
+			if ((instr.op == Opcode::PUSH or instr.op == Opcode::POP or instr.op == Opcode::ROT) and not instr.arg.has_value())
+				code.push_back({ static_cast<uint8_t>(Kind::MISSING_ARGUMENT), 0 });
+			else if (overflow == Stack::Overflow::Error and Opcode::MUL <= instr.op and instr.op <= Opcode::SUB)
+				code.push_back({ static_cast<uint8_t>(static_cast<uint8_t>(Kind::CHECKED_MUL) + static_cast<uint8_t>(instr.op) - static_cast<uint8_t>(Opcode::MUL)), 0 });
+			else
+				code.push_back({ static_cast<uint8_t>(instr.op), instr.arg.value_or(0) });
+		}
+		code.push_back({ static_cast<uint8_t>(Kind::DONE), 0 });
+		return code;
+	}
+
+	static constexpr auto unlimited = std::numeric_limits<uint64_t>::max();
+
+	static auto run(Code& code, const Machine& machine, const size_t start = 0, uint64_t back_edges = unlimited) -> Machine::Exit {
+		const auto& instructions = machine.instructions;
+		const auto size = instructions.size();
+		auto& stack = machine.stack.storage();
+
+		const auto pop = [&] {
+			const auto top = stack.back();
+			stack.pop_back();
+			return top;
+		};
+		const auto quicken = [] (Op& op, const Kind kind) {
+			op.kind = static_cast<uint8_t>(kind);
+		};
+		// Error at the instruction pc points to
+		const auto error = [&] (const size_t pc) -> Machine::Exit {
+			return { State::Error, pc + 1 };
+		};
+
+		for (auto pc = start; ; ) {
+			auto& op = code[pc];
+			switch (op.kind) {
+				case static_cast<uint8_t>(Opcode::READ):
+					if (auto i = Integer{}; machine.read(i))
+						stack.push_back(i);
+					else
+						return error(pc);
+					++pc;
+					break;
+
+				case static_cast<uint8_t>(Opcode::WRITE):
+					if (stack.empty())
+						machine.cout << "null" << ' ';
+					else
+						machine.cout << pop() << ' ';
+					++pc;
+					break;
+
+				case static_cast<uint8_t>(Opcode::DUP):
+					if (stack.empty()) {
+						Machine::report_underflow(Opcode::DUP);
+						return error(pc);
+					}
+					stack.push_back(stack.back());
+					++pc;
+					break;
+
+				case static_cast<uint8_t>(Opcode::MUL):
+				case static_cast<uint8_t>(Opcode::ADD):
+				case static_cast<uint8_t>(Opcode::SUB):
+				case static_cast<uint8_t>(Opcode::GT):
+				case static_cast<uint8_t>(Opcode::LT):
+				case static_cast<uint8_t>(Opcode::EQ): {
+					const auto operation = static_cast<Opcode>(op.kind);
+					if (stack.size() < 2) {
+						Machine::report_underflow(operation);
+						return error(pc);
+					}
+					const auto top = pop();
+					stack.back() = Instruction::evaluate(operation, top, stack.back());
+					++pc;
+					break;
+				}
+
+				// Leaves both values where they were when the result does not fit
+				case static_cast<uint8_t>(Kind::CHECKED_MUL):
+				case static_cast<uint8_t>(Kind::CHECKED_ADD):
+				case static_cast<uint8_t>(Kind::CHECKED_SUB): {
+					const auto operation = static_cast<Opcode>(static_cast<uint8_t>(Opcode::MUL) + op.kind - static_cast<uint8_t>(Kind::CHECKED_MUL));
+					if (stack.size() < 2) {
+						Machine::report_underflow(operation);
+						return error(pc);
+					}
+					const auto result = Instruction::evaluate_exact(operation, stack.end()[-1], stack.end()[-2]);
+					if (not result.has_value()) {
+						Machine::report_overflow(operation);
+						return error(pc);
+					}
+					stack.pop_back();
+					stack.back() = *result;
+					++pc;
+					break;
+				}
+
+				case static_cast<uint8_t>(Opcode::JMPZ): {
+					if (stack.size() < 2) {
+						Machine::report_underflow(Opcode::JMPZ);
+						return error(pc);
+					}
+					const auto target = pop();
+					if (pop() != 0)
+						++pc;
+					else if (0 <= target and static_cast<size_t>(target) < size) {
+						if (static_cast<size_t>(target) <= pc and --back_edges == 0)
+							return { State::Running, static_cast<size_t>(target) };
+						pc = static_cast<size_t>(target);
+					}
+					else {
+						Machine::report_jump(target, size);
+						return error(pc);
+					}
+					break;
+				}
+
+				case static_cast<uint8_t>(Opcode::PUSH):
+					if (const auto target = op.arg;
+						pc + 1 < size and instructions[pc + 1].op == Opcode::JMPZ and 0 <= target and static_cast<size_t>(target) < size)
+					{
+						quicken(op, Kind::BRANCH);
+						break;	// Runs as BRANCH right away
+					}
+					stack.push_back(op.arg);
+					++pc;
+					break;
+
+				// Arguments are converted to size_t just like Stack::pop_n/rot, 0 and less are left to the Verifier
+				case static_cast<uint8_t>(Opcode::POP): {
+					const auto n = static_cast<size_t>(op.arg);
+					if (stack.size() < n) {
+						Machine::report_underflow(Opcode::POP, op.arg);
+						return error(pc);
+					}
+					quicken(op, n == 0 ? Kind::NOP : n == 1 ? Kind::DROP : Kind::POP_N);
+					break;
+				}
+
+				case static_cast<uint8_t>(Opcode::ROT): {
+					const auto n = static_cast<size_t>(op.arg);
+					if (stack.size() < n) {
+						Machine::report_underflow(Opcode::ROT, op.arg);
+						return error(pc);
+					}
+					quicken(op, n < 2 ? Kind::NOP : n == 2 ? Kind::SWAP : Kind::ROT_N);
+					break;
+				}
+
+				case static_cast<uint8_t>(Kind::SWAP):
+					if (stack.size() < 2) {
+						Machine::report_underflow(Opcode::ROT, 2);
+						return error(pc);
+					}
+					std::swap(stack[stack.size() - 1], stack[stack.size() - 2]);
+					++pc;
+					break;
+
+				case static_cast<uint8_t>(Kind::DROP):
+					if (stack.empty()) {
+						Machine::report_underflow(Opcode::POP, 1);
+						return error(pc);
+					}
+					stack.pop_back();
+					++pc;
+					break;
+
+				case static_cast<uint8_t>(Kind::ROT_N):
+					if (stack.size() < static_cast<size_t>(op.arg)) {
+						Machine::report_underflow(Opcode::ROT, op.arg);
+						return error(pc);
+					}
+					std::rotate(stack.end() - op.arg, stack.end() - 1, stack.end());
+					++pc;
+					break;
+
+				case static_cast<uint8_t>(Kind::POP_N):
+					if (stack.size() < static_cast<size_t>(op.arg)) {
+						Machine::report_underflow(Opcode::POP, op.arg);
+						return error(pc);
+					}
+					stack.resize(stack.size() - static_cast<size_t>(op.arg));
+					++pc;
+					break;
+
+				case static_cast<uint8_t>(Kind::NOP):
+					++pc;
+					break;
+
+				case static_cast<uint8_t>(Kind::BRANCH):
+					// The PUSH always works, only the JMPZ after it can fail and leaves the target on top
+					if (stack.empty()) {
+						stack.push_back(op.arg);
+						Machine::report_underflow(Opcode::JMPZ);
+						return error(pc + 1);
+					}
+					if (pop() != 0)
+						pc += 2;
+					else if (static_cast<size_t>(op.arg) <= pc and --back_edges == 0)
+						return { State::Running, static_cast<size_t>(op.arg) };
+					else
+						pc = static_cast<size_t>(op.arg);
+					break;
+
+				case static_cast<uint8_t>(Kind::MISSING_ARGUMENT):
+					Machine::report_missing_argument(instructions[pc].op);
+					return error(pc);
+
+				case static_cast<uint8_t>(Kind::DONE):
+					return { State::Done, size };
+			}
+		}
+	}
+};
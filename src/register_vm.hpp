@@ -0,0 +1,580 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <optional>
+#include <algorithm>
+#include <iostream>
+#include <cstdint>
+
+#include "stack.hpp"
+#include "instruction.hpp"
+#include "machine.hpp"
+
+// Translates the stack program into a register machine, one basic block at a time.
+//
+// Within a block the depth of the stack relative to where the block started is known statically,
+// so every stack slot the block touches is a register: fp[-1] is whatever was on top when the block
+// was entered, fp[0] the first value it pushes and so on. DUP, ROT, POP and PUSH only rename what
+// is in those registers while translating and leave nothing to execute, arithmetic reads and writes
+// them directly and constants are folded. At the end of the block the registers are written back to
+// where the stack would have them, fp moves by the block's change in depth and the next block starts.
+//
+// The absolute depth is never needed, so neither is a depth that is the same on every path. Each
+// block checks once on entry that the stack holds every value it is going to touch. If it does not,
+// or the block hits anything the translation leaves alone (eg. a JMPZ to a computed target), the
+// stack is handed back and the run continues on a stack engine from that pc: errors are then still
+// reported by exactly the instruction that fails.
+//
+// Usage:
+//
+// const auto code = Register_VM::compile(instructions);
+// if (const auto exit = Register_VM::run(code, machine); exit.state == Machine::State::Running)
+// 	// Continue with a stack engine from exit.pc
+struct Register_VM {
+	using Integer = Stack::Integer;
+	using Opcode = Instruction::Opcode;
+	using State = Machine::State;
+
+	// a and b stand for TOP and SECOND of the instruction they replace, each either an fp relative
+	// register or IMMEDIATE for Op::k. Terminators move fp by shift before going anywhere.
+	enum class Kind : uint8_t {
+		ENTER,					// Hand over at pc unless a values are on the stack, make room for b registers past fp
+		MOVE,					// fp[dest] = a
+		MUL, ADD, SUB, GT, LT, EQ,		// fp[dest] = a <op> b
+		BRANCH_GT, BRANCH_LT, BRANCH_EQ,	// goto target if a <op> b gives 0
+		JUMP_ZERO,				// goto target if a is 0
+		JUMP,					// goto target
+		READ,					// fp[dest] from cin, Error at pc if there is nothing to read
+		WRITE,					// cout << a
+		BAIL,					// Hand over at pc
+		DONE,
+	};
+
+	static constexpr auto IMMEDIATE = INT32_MAX;
+	static constexpr auto deepest = int32_t{1024};	// POP and ROT past that are left to the stack engines, every value they reach is a register
+
+	struct Op {
+		Kind kind;
+		int32_t dest;
+		int32_t a;
+		int32_t b;
+		Integer k;		// Whichever of a and b is IMMEDIATE
+		int32_t shift;
+		uint32_t target;	// Index of an Op for jumps, otherwise the pc of an instruction
+	};
+	using Code = std::vector<Op>;
+
+	// Never fails, whatever cannot be translated hands over to the stack engines instead
+	static auto compile(const Instructions& instructions) -> Code {
+		// Blocks start at 0, after every JMPZ and at every target a JMPZ is known to have. Targets are
+		// only known while translating, so translate until they are all where blocks start.
+		auto leaders = std::vector<bool>(instructions.size() + 1, false);
+		leaders[0] = true;
+		for (auto i = size_t{0}; i < instructions.size(); ++i)
+			if (instructions[i].op == Opcode::JMPZ)
+				leaders[i + 1] = true;
+
+		while (true) {
+			auto translation = Translation{instructions, leaders};
+			if (translation.run())
+				return std::move(translation.code);
+		}
+	}
+
+	static auto run(const Code& code, const Machine& machine) -> Machine::Exit {
+		auto& storage = machine.stack.storage();
+		const auto depth = storage.size();
+		storage.resize(std::max<size_t>(64, 2 * depth));
+
+		auto* base = storage.data();
+		auto* fp = base + depth;
+		const auto* op = code.data();
+
+		const auto value = [&] (const int32_t r) {
+			return r == IMMEDIATE ? op->k : fp[r];
+		};
+		const auto exit = [&] (const State state, const size_t pc) -> Machine::Exit {
+			storage.resize(static_cast<size_t>(fp - base));
+			return { state, pc };
+		};
+
+		while (true) {
+			switch (op->kind) {
+				case Kind::ENTER:
+					if (fp - base < op->a)
+						return exit(State::Running, op->target);
+					if (fp + op->b > base + storage.size()) {
+						const auto d = fp - base;
+						storage.resize(std::max(2 * storage.size(), static_cast<size_t>(d + op->b)));
+						base = storage.data();
+						fp = base + d;
+					}
+					++op;
+					break;
+
+				case Kind::MOVE:	fp[op->dest] = value(op->a);	++op;	break;
+
+				case Kind::MUL:	fp[op->dest] = Instruction::evaluate(Opcode::MUL, value(op->a), value(op->b));	++op;	break;
+				case Kind::ADD:	fp[op->dest] = Instruction::evaluate(Opcode::ADD, value(op->a), value(op->b));	++op;	break;
+				case Kind::SUB:	fp[op->dest] = Instruction::evaluate(Opcode::SUB, value(op->a), value(op->b));	++op;	break;
+				case Kind::GT:	fp[op->dest] = Instruction::evaluate(Opcode::GT, value(op->a), value(op->b));	++op;	break;
+				case Kind::LT:	fp[op->dest] = Instruction::evaluate(Opcode::LT, value(op->a), value(op->b));	++op;	break;
+				case Kind::EQ:	fp[op->dest] = Instruction::evaluate(Opcode::EQ, value(op->a), value(op->b));	++op;	break;
+
+				case Kind::BRANCH_GT:	branch(op, fp, code, value(op->a) > value(op->b));	break;
+				case Kind::BRANCH_LT:	branch(op, fp, code, value(op->a) < value(op->b));	break;
+				case Kind::BRANCH_EQ:	branch(op, fp, code, value(op->a) == value(op->b));	break;
+				case Kind::JUMP_ZERO:	branch(op, fp, code, value(op->a) == 0);		break;
+				case Kind::JUMP:	branch(op, fp, code, true);				break;
+
+				case Kind::READ:
+					if (auto i = Integer{}; machine.read(i)) {
+						fp[op->dest] = i;
+						++op;
+					}
+					else {
+						fp += op->dest;	// Always a READ on a written back stack
+						return exit(State::Error, op->target + 1);
+					}
+					break;
+
+				case Kind::WRITE:	machine.cout << value(op->a) << ' ';	++op;	break;
+
+				case Kind::BAIL:
+					fp += op->shift;
+					return exit(State::Running, op->target);
+
+				case Kind::DONE:
+					fp += op->shift;
+					return exit(State::Done, machine.instructions.size());
+			}
+		}
+	}
+
+	// How many of code's Ops are not ENTER, what a run dispatches besides the block entries
+	static auto operations(const Code& code) -> size_t {
+		return static_cast<size_t>(std::count_if(code.cbegin(), code.cend(), [] (const auto& op) { return op.kind != Kind::ENTER; }));
+	}
+
+private:
+	static auto branch(const Op*& op, Integer*& fp, const Code& code, const bool taken) -> void {
+		fp += op->shift;
+		op = taken ? code.data() + op->target : op + 1;
+	}
+
+	static constexpr auto has_operand(const Opcode op) -> bool {
+		return op == Opcode::PUSH or op == Opcode::POP or op == Opcode::ROT;
+	}
+
+	// What a stack slot holds while translating a block
+	struct Value {
+		enum class Space : uint8_t { Slot, Temporary, Constant } space;
+		Integer index;	// Position relative to fp, Temporary number or the Constant itself
+
+		auto operator== (const Value&) const -> bool = default;
+
+		static auto slot(const int32_t position) -> Value { return { Space::Slot, position }; }
+	};
+
+	struct Translation {
+		const Instructions& instructions;
+		std::vector<bool>& leaders;
+
+		Code code{};
+		std::vector<uint32_t> block_op = std::vector<uint32_t>(instructions.size(), UINT32_MAX);
+		bool complete = true;	// No new leaders found
+
+		// Ops of the block being translated still refer to Values, see lower()
+		struct Pending {
+			Kind kind;
+			std::optional<Value> dest{}, a{}, b{};
+			int32_t shift = 0;
+			uint32_t target = 0;
+		};
+
+		// Block state
+		std::vector<Pending> block{};
+		std::deque<Value> stack{};	// Positions [low, depth)
+		int32_t low = 0;
+		int32_t depth = 0;
+		int32_t need = 0;
+		int32_t highest = 0;		// One past the highest position written
+		int32_t temporaries = 0;
+		std::optional<size_t> last_compare{};	// Index into block of a compare whose result nothing else uses yet
+
+		auto run() -> bool {
+			for (auto i = size_t{0}; i < instructions.size();) {
+				if (not leaders[i]) {
+					++i;	// Unreachable without a jump, nothing jumps here
+					continue;
+				}
+				i = translate_block(i);
+			}
+
+			if (not complete)
+				return false;
+
+			// Jumps go to the ENTER of their target's block, or past it if it has nothing to check.
+			// Jumps to a block that only jumps on go straight on.
+			for (auto& op : code)
+				if (jumps(op))
+					op.target = block_op[op.target];
+
+			for (auto& op : code) {
+				for (auto hops = size_t{0}; jumps(op) and hops < code.size(); ++hops) {
+					if (const auto& enter = code[op.target]; enter.kind == Kind::ENTER and enter.a <= 0 and enter.b == 0)
+						++op.target;
+					if (const auto& next = code[op.target]; next.kind == Kind::JUMP and &next != &op) {
+						op.shift += next.shift;
+						op.target = next.target;
+					}
+					else
+						break;
+				}
+			}
+			return true;
+		}
+
+		auto at(const int32_t position) -> Value& {
+			while (position < low) {
+				stack.push_front(Value::slot(low - 1));
+				--low;
+			}
+			return stack[static_cast<size_t>(position - low)];
+		}
+
+		auto require(const int32_t n) -> void {
+			need = std::max(need, n - depth);
+		}
+
+		auto push(const Value value) -> void {
+			stack.push_back(value);
+			++depth;
+		}
+
+		auto pop() -> Value {
+			const auto value = at(depth - 1);
+			stack.pop_back();
+			--depth;
+			return value;
+		}
+
+		auto used(const Value value) const -> bool {
+			return std::find(stack.cbegin(), stack.cend(), value) != stack.cend();
+		}
+
+		// Where the result of an operation that leaves it at position goes: its own slot unless something still needs what is there
+		auto result(const int32_t position) -> Value {
+			if (const auto slot = Value::slot(position); not used(slot)) {
+				highest = std::max(highest, position + 1);
+				return slot;
+			}
+			else
+				return { Value::Space::Temporary, temporaries++ };
+		}
+
+		auto emit(Pending op) -> void {
+			block.push_back(std::move(op));
+			last_compare.reset();
+		}
+
+		// Write the stack back, afterwards every position holds its own slot. keep is read after
+		// this and must not be overwritten on the way.
+		auto write_back(std::optional<Value>& keep) -> size_t {
+			struct Move {
+				int32_t position;
+				Value value;
+			};
+			auto pending = std::vector<Move>{};
+			for (auto p = low; p < depth; ++p)
+				if (const auto value = at(p); value != Value::slot(p))
+					pending.push_back({ p, value });
+
+			const auto written = [&] (const Value value) {
+				return value.space == Value::Space::Slot
+					and std::any_of(pending.cbegin(), pending.cend(), [&] (const auto& move) { return move.position == value.index; });
+			};
+			const auto save = [&] (const Value value) {
+				const auto temporary = Value{ Value::Space::Temporary, temporaries++ };
+				emit({ .kind = Kind::MOVE, .dest = temporary, .a = value });
+				return temporary;
+			};
+
+			auto moves = size_t{0};
+			if (keep.has_value() and written(*keep)) {
+				keep = save(*keep);
+				++moves;
+			}
+
+			// Whatever nothing else still has to read goes first, a temporary breaks the cycles
+			while (not pending.empty()) {
+				const auto free = std::find_if(pending.begin(), pending.end(), [&] (const auto& move) {
+					return std::none_of(pending.cbegin(), pending.cend(), [&] (const auto& other) { return other.value == Value::slot(move.position); });
+				});
+
+				if (free == pending.end()) {
+					const auto slot = Value::slot(pending.front().position);
+					const auto temporary = save(slot);
+					++moves;
+					for (auto& move : pending)
+						if (move.value == slot)
+							move.value = temporary;
+					continue;
+				}
+
+				emit({ .kind = Kind::MOVE, .dest = Value::slot(free->position), .a = free->value });
+				++moves;
+				highest = std::max(highest, free->position + 1);
+				at(free->position) = Value::slot(free->position);
+				pending.erase(free);
+			}
+			return moves;
+		}
+
+		auto write_back() -> void {
+			auto none = std::optional<Value>{};
+			write_back(none);
+		}
+
+		auto bail(const size_t pc) -> void {
+			write_back();
+			emit({ .kind = Kind::BAIL, .shift = depth, .target = static_cast<uint32_t>(pc) });
+		}
+
+		auto jump(const size_t target, const std::optional<Value> condition = std::nullopt) -> void {
+			if (target == instructions.size() and not condition.has_value()) {
+				emit({ .kind = Kind::DONE, .shift = depth });
+				return;
+			}
+			if (not leaders[target]) {
+				leaders[target] = true;
+				complete = false;
+			}
+			emit({ .kind = condition.has_value() ? Kind::JUMP_ZERO : Kind::JUMP, .a = condition, .shift = depth, .target = static_cast<uint32_t>(target) });
+		}
+
+		// Returns the index after the block
+		auto translate_block(const size_t leader) -> size_t {
+			block.clear();
+			stack.clear();
+			low = depth = need = highest = temporaries = 0;
+			last_compare.reset();
+
+			auto i = leader;
+			const auto end = [&] {
+				do
+					++i;
+				while (i < instructions.size() and not leaders[i]);
+				return i;
+			};
+
+			while (true) {
+				if (i == instructions.size()) {
+					write_back();
+					emit({ .kind = Kind::DONE, .shift = depth });
+					break;
+				}
+				if (i != leader and leaders[i]) {
+					write_back();
+					jump(i);
+					break;
+				}
+
+				const auto& instr = instructions[i];
+				if (has_operand(instr.op) and not instr.arg.has_value()) {
+					bail(i);
+					end();
+					break;
+				}
+
+				if (translate(instr, i))
+					++i;
+				else {
+					bail(i);
+					end();
+					break;
+				}
+
+				if (instr.op == Opcode::JMPZ) {
+					if (const auto kind = block.back().kind; i == instructions.size() and kind != Kind::JUMP and kind != Kind::DONE)
+						emit({ .kind = Kind::DONE });	// Not taken, off the end of the program
+					break;
+				}
+			}
+
+			lower(leader);
+			return i;
+		}
+
+		// Appends to block, false to hand over at instr instead
+		auto translate(const Instruction& instr, const size_t pc) -> bool {
+			switch (instr.op) {
+				case Opcode::READ: {
+					write_back();
+					const auto dest = Value::slot(depth);
+					highest = std::max(highest, depth + 1);
+					emit({ .kind = Kind::READ, .dest = dest, .target = static_cast<uint32_t>(pc) });
+					push(dest);
+					return true;
+				}
+
+				case Opcode::WRITE:
+					require(1);
+					emit({ .kind = Kind::WRITE, .a = pop() });
+					return true;
+
+				case Opcode::DUP:
+					require(1);
+					push(at(depth - 1));
+					return true;
+
+				case Opcode::MUL:
+				case Opcode::ADD:
+				case Opcode::SUB:
+				case Opcode::GT:
+				case Opcode::LT:
+				case Opcode::EQ: {
+					require(2);
+					const auto top = pop();
+					const auto second = pop();
+					if (top.space == Value::Space::Constant and second.space == Value::Space::Constant)
+						push({ Value::Space::Constant, Instruction::evaluate(instr.op, top.index, second.index) });
+					else {
+						const auto dest = result(depth);
+						emit({ .kind = binary(instr.op), .dest = dest, .a = top, .b = second });
+						if (instr.op == Opcode::GT or instr.op == Opcode::LT or instr.op == Opcode::EQ)
+							last_compare = block.size() - 1;
+						push(dest);
+					}
+					return true;
+				}
+
+				case Opcode::JMPZ: {
+					const auto target = at(depth - 1);
+					if (target.space != Value::Space::Constant)
+						return false;
+					require(2);
+
+					const auto valid = 0 <= target.index and static_cast<size_t>(target.index) < instructions.size();
+					const auto condition = at(depth - 2);
+					if (condition.space == Value::Space::Constant) {
+						pop();
+						pop();
+						write_back();
+						if (condition.index != 0)
+							jump(pc + 1);
+						else if (valid)
+							jump(static_cast<size_t>(target.index));
+						else
+							return undo(target, condition);
+						return true;
+					}
+					else if (not valid)
+						return false;
+
+					const auto compare = last_compare;
+					pop();
+					pop();
+					auto keep = std::optional<Value>{condition};
+					if (write_back(keep) == 0 and compare.has_value() and block[*compare].dest == condition and not used(condition)) {
+						// Nothing in between, branch on the comparison itself
+						auto& op = block[*compare];
+						op.kind = branch(op.kind);
+						op.dest.reset();
+						op.shift = depth;
+						op.target = static_cast<uint32_t>(target.index);
+						if (not leaders[static_cast<size_t>(target.index)]) {
+							leaders[static_cast<size_t>(target.index)] = true;
+							complete = false;
+						}
+						last_compare.reset();
+					}
+					else
+						jump(static_cast<size_t>(target.index), keep);
+					return true;
+				}
+
+				case Opcode::PUSH:
+					push({ Value::Space::Constant, *instr.arg });
+					return true;
+
+				case Opcode::POP:
+				case Opcode::ROT: {
+					if (*instr.arg < 0 or *instr.arg > deepest)
+						return false;
+
+					const auto n = static_cast<int32_t>(*instr.arg);
+					require(n);
+					if (instr.op == Opcode::POP)
+						for (auto j = 0; j < n; ++j)
+							pop();
+					else if (n >= 2) {
+						// The top sinks n - 1 places
+						const auto top = at(depth - 1);
+						for (auto p = depth - 1; p > depth - n; --p)
+							at(p) = at(p - 1);
+						at(depth - n) = top;
+					}
+					return true;
+				}
+			}
+			return false;
+		}
+
+		// A JMPZ that always jumps out of the program, leave it to the stack engines
+		auto undo(const Value target, const Value condition) -> bool {
+			// Written back already, put them back on top so the hand over sees them
+			push(condition);
+			push(target);
+			return false;
+		}
+
+		// Replace the Values of the block with registers, temporaries go past every slot it writes
+		auto lower(const size_t leader) -> void {
+			block_op[leader] = static_cast<uint32_t>(code.size());
+			code.push_back({ .kind = Kind::ENTER, .dest = 0, .a = need, .b = highest + temporaries, .k = 0, .shift = 0, .target = static_cast<uint32_t>(leader) });
+
+			for (const auto& pending : block) {
+				auto op = Op{ .kind = pending.kind, .dest = 0, .a = 0, .b = 0, .k = 0, .shift = pending.shift, .target = pending.target };
+				const auto reg = [&] (const std::optional<Value>& value) -> int32_t {
+					if (not value.has_value())
+						return 0;
+					switch (value->space) {
+						case Value::Space::Slot:	return value->index;
+						case Value::Space::Temporary:	return highest + value->index;
+						case Value::Space::Constant:	op.k = value->index; return IMMEDIATE;
+					}
+					return 0;
+				};
+				op.dest = reg(pending.dest);
+				op.a = reg(pending.a);
+				op.b = reg(pending.b);
+				code.push_back(op);
+			}
+		}
+
+		static constexpr auto jumps(const Op& op) -> bool {
+			return op.kind >= Kind::BRANCH_GT and op.kind <= Kind::JUMP;
+		}
+
+		static constexpr auto binary(const Opcode op) -> Kind {
+			switch (op) {
+				case Opcode::MUL:	return Kind::MUL;
+				case Opcode::ADD:	return Kind::ADD;
+				case Opcode::SUB:	return Kind::SUB;
+				case Opcode::GT:	return Kind::GT;
+				case Opcode::LT:	return Kind::LT;
+				default:		return Kind::EQ;
+			}
+		}
+
+		static constexpr auto branch(const Kind compare) -> Kind {
+			switch (compare) {
+				case Kind::GT:	return Kind::BRANCH_GT;
+				case Kind::LT:	return Kind::BRANCH_LT;
+				default:	return Kind::BRANCH_EQ;
+			}
+		}
+	};
+};
@@ -9,6 +9,9 @@
 namespace rs = std::ranges;
 namespace vw = std::ranges::views;
 #include <cassert>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
 
 struct Stack {
 	using Integer = int32_t;
@@ -30,10 +33,13 @@ public:
 			return std::nullopt;
 	}
 
+	// Operations that take values off the stack have unchecked variants, for code that is known
+	// to have them, see stack_depth.hpp
+	template <bool checked = true>
 	auto pop_n(const size_t n) -> bool {
 		assert(n > 0);
 
-		if (has_at_least(n)) {
+		if (not checked or has_at_least(n)) {
 			stack.erase(stack.cend() - n, stack.cend());
 			return true;
 		}
@@ -41,8 +47,9 @@ public:
 			return false;
 	}
 
+	template <bool checked = true>
 	auto dup() -> bool {
-		if (not stack.empty()) {
+		if (not checked or not stack.empty()) {
 			stack.push_back(stack.back());
 			return true;
 		}
@@ -50,20 +57,28 @@ public:
 			return false;
 	}
 
+	// What MUL, ADD and SUB do about overflowing an Integer
+	enum class Overflow {
+		Unchecked,	// Undefined, whatever -fsanitize=undefined makes of it
+		Impossible,	// Proven to never happen, see value_range.hpp, so not even the sanitizer looks
+		Error,		// Fails like missing a value would, leaving both of them on the stack
+	};
+
 	// Operations on top 2 values
-	auto mul() -> bool { return pop_2_push_op(std::multiplies{}	); }
-	auto add() -> bool { return pop_2_push_op(std::plus{}		); }
-	auto sub() -> bool { return pop_2_push_op(std::minus{}		); }
+	template <bool checked = true, Overflow overflow = Overflow::Unchecked> auto mul() -> bool { return arithmetic<checked, overflow>(std::multiplies{}	); }
+	template <bool checked = true, Overflow overflow = Overflow::Unchecked> auto add() -> bool { return arithmetic<checked, overflow>(std::plus{}	); }
+	template <bool checked = true, Overflow overflow = Overflow::Unchecked> auto sub() -> bool { return arithmetic<checked, overflow>(std::minus{}	); }
 
 	// Comparisons are specified to be inverted: 0 for True and 1 for False
-	auto gt () -> bool { return pop_2_push_op(std::less_equal{}	); }
-	auto lt () -> bool { return pop_2_push_op(std::greater_equal{}	); }
-	auto eq () -> bool { return pop_2_push_op(std::not_equal_to{}	); }
+	template <bool checked = true> auto gt () -> bool { return pop_2_push_op<checked>(std::less_equal{}	); }
+	template <bool checked = true> auto lt () -> bool { return pop_2_push_op<checked>(std::greater_equal{}	); }
+	template <bool checked = true> auto eq () -> bool { return pop_2_push_op<checked>(std::not_equal_to{}	); }
 
+	template <bool checked = true>
 	auto rot(const size_t n) -> bool {
 		assert(n > 0 and "Might as well have a NOOP instruction");
 
-		if (has_at_least(n)) {
+		if (not checked or has_at_least(n)) {
 			// See https://en.cppreference.com/w/cpp/algorithm/ranges/rotate
 			// TL;DR for a single right rotation we want the last element (middle)
 			// to become the first.
@@ -75,6 +90,16 @@ public:
 			return false;
 	}
 
+	// Drop SECOND, what ROT 2; POP 1 does
+	auto nip() -> bool {
+		if (has_at_least(2)) {
+			stack.erase(stack.end() - 2);
+			return true;
+		}
+		else
+			return false;
+	}
+
 public:
 	auto top() const -> std::optional<Integer> {
 		if (not stack.empty())
@@ -95,10 +120,36 @@ public:
 		return stack.size() >= n;
 	}
 
+	// For the engines that keep the stack in their own registers and hand it back when they exit
+	auto storage() -> Vector& {
+		return stack;
+	}
+
+	// Whether op(TOP, SECOND) of MUL, ADD or SUB does not fit an Integer, result is only that when it does.
+	// Without GNU C it is worked out in 64 bits, wide enough for any of them.
+	template <typename Operation>
+	static auto overflows(const Operation, const Integer top, const Integer second, Integer& result) -> bool {
+#ifdef __GNUC__
+		if constexpr (std::is_same_v<Operation, std::multiplies<>>)
+			return __builtin_mul_overflow(top, second, &result);
+		else if constexpr (std::is_same_v<Operation, std::plus<>>)
+			return __builtin_add_overflow(top, second, &result);
+		else
+			return __builtin_sub_overflow(top, second, &result);
+#else
+		const auto wide = Operation{}(int64_t{top}, int64_t{second});
+		if (wide < std::numeric_limits<Integer>::min() or wide > std::numeric_limits<Integer>::max())
+			return true;
+		result = static_cast<Integer>(wide);
+		return false;
+#endif
+	}
+
 private:
-	// Operation called as op(TOP, SECOND)
-	auto pop_2_push_op(const std::function<Integer(Integer, Integer)>& op) -> bool {
-		if (has_at_least(2)) {
+	// Operation called as op(TOP, SECOND), a template so it inlines instead of going through std::function
+	template <bool checked, typename Operation>
+	auto pop_2_push_op(const Operation op) -> bool {
+		if (not checked or has_at_least(2)) {
 			// Argument resolution unspecified so we need to "pin" the values
 			const auto top = pop_back();
 			const auto second = pop_back();
@@ -109,6 +160,41 @@ private:
 			return false;
 	}
 
+	// The operation itself, the sanitizer instruments whatever function it is spelled out in
+	template <typename Operation>
+	struct Impossible {
+#ifdef __GNUC__
+		__attribute__((no_sanitize("signed-integer-overflow")))
+#endif
+		auto operator() (const Integer top, const Integer second) const -> Integer {
+			if constexpr (std::is_same_v<Operation, std::multiplies<>>)
+				return top * second;
+			else if constexpr (std::is_same_v<Operation, std::plus<>>)
+				return top + second;
+			else
+				return top - second;
+		}
+	};
+
+	template <bool checked, Overflow overflow, typename Operation>
+	auto arithmetic(const Operation op) -> bool {
+		if constexpr (overflow == Overflow::Error) {
+			if (checked and not has_at_least(2))
+				return false;
+
+			auto result = Integer{};
+			if (overflows(op, stack.end()[-1], stack.end()[-2], result)) [[unlikely]]
+				return false;
+			stack.pop_back();
+			stack.back() = result;
+			return true;
+		}
+		else if constexpr (overflow == Overflow::Impossible)
+			return pop_2_push_op<checked>(Impossible<Operation>{});
+		else
+			return pop_2_push_op<checked>(op);
+	}
+
 	// Does NOT check if stack is empty
 	auto pop_back() -> Integer {
 		const auto back = stack.back();
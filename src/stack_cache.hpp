@@ -0,0 +1,311 @@
+#pragma once
+
+#include <vector>
+#include <iostream>
+#include <algorithm>
+#include <cstdint>
+
+#include "stack.hpp"
+#include "instruction.hpp"
+#include "machine.hpp"
+
+#ifdef __GNUC__
+#	define STACK_CACHE_AVAILABLE
+#endif
+
+// Computed goto like Interpreter::execute_threaded() but the top two values of the stack live in
+// local variables, only what does not fit in them goes to memory. Which of them are in use is a
+// state, every state has its own dispatch table and every handler knows the state it leaves
+// behind, so the state never has to be looked up at run time:
+//
+//	S0	nothing cached			depth = sp
+//	S1	a is TOP			depth = sp + 1
+//	S2	a is SECOND, b is TOP		depth = sp + 2
+//
+// eg. ADD in S2 is a single `a = b + a` that leaves S1, ADD in S1 loads SECOND from memory and
+// stays in S1. Pushing in S2 is the only place a value gets spilled.
+//
+// Usage:
+//
+// const auto code = Stack_Cache::compile(instructions);
+// const auto exit = Stack_Cache::run(code, machine);
+struct Stack_Cache {
+	using Integer = Stack::Integer;
+	using Opcode = Instruction::Opcode;
+	using State = Machine::State;
+
+	// Handlers past the Opcodes
+	static constexpr auto MISSING_ARGUMENT = static_cast<uint8_t>(Instruction::opcode_count);
+	static constexpr auto DONE = static_cast<uint8_t>(Instruction::opcode_count + 1);
+
+	struct Op {
+		uint8_t handler;	// Opcode, MISSING_ARGUMENT or DONE
+		Integer arg;		// Opcode for MISSING_ARGUMENT
+	};
+	using Code = std::vector<Op>;
+
+	// Arguments are decoded once, the Verifier already dropped stray ones
+	static auto compile(const Instructions& instructions) -> Code {
+		auto code = Code{};
+		code.reserve(instructions.size() + 1);
+
+		for (const auto& instr : instructions) {
+			switch (instr.op) {
+				case Opcode::PUSH:
+				case Opcode::POP:
+				case Opcode::ROT:
+					if (not instr.arg.has_value())
+						code.push_back({ MISSING_ARGUMENT, static_cast<Integer>(instr.op) });
+					else
+						code.push_back({ static_cast<uint8_t>(instr.op), *instr.arg });
+					break;
+
+				default:
+					code.push_back({ static_cast<uint8_t>(instr.op), 0 });
+			}
+		}
+
+		code.push_back({ DONE, 0 });	// Falling off the end of the program
+		return code;
+	}
+
+#ifdef STACK_CACHE_AVAILABLE
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"	// Labels as values
+	static auto run(const Code& code, const Machine& machine) -> Machine::Exit {
+		// Indexed by Op::handler, one table per state
+#define STACK_CACHE_TABLE(S)									\
+		static const void* const S[Instruction::opcode_count + 2] = {			\
+			&&S##_READ, &&S##_WRITE, &&S##_DUP,					\
+			&&S##_MUL, &&S##_ADD, &&S##_SUB,					\
+			&&S##_GT, &&S##_LT, &&S##_EQ,						\
+			&&S##_JMPZ, &&S##_PUSH, &&S##_POP, &&S##_ROT,				\
+			&&S##_MISSING_ARGUMENT, &&S##_DONE,					\
+		}
+
+		STACK_CACHE_TABLE(S0);
+		STACK_CACHE_TABLE(S1);
+		STACK_CACHE_TABLE(S2);
+#undef STACK_CACHE_TABLE
+
+		auto& storage = machine.stack.storage();
+		auto sp = storage.size();
+		storage.resize(std::max<size_t>(64, 2 * sp));
+		auto* memory = storage.data();
+
+		auto a = Integer{};
+		auto b = Integer{};
+
+		const auto size = code.size() - 1;
+		const auto* pc = code.data();
+		auto state = State::Running;
+
+		const auto spill = [&] (const Integer value) {
+			if (sp == storage.size()) [[unlikely]] {
+				storage.resize(2 * storage.size());
+				memory = storage.data();
+			}
+			memory[sp++] = value;
+		};
+
+#define STACK_CACHE_NEXT(S)	do { ++pc; goto *S[pc->handler]; } while (false)
+#define STACK_CACHE_GOTO(S)	goto *S[pc->handler]
+#define STACK_CACHE_ERROR(S)	do { state = State::Error; goto S##_EXIT; } while (false)
+
+		STACK_CACHE_GOTO(S0);
+
+	// READ
+	S0_READ:
+		if (machine.read(a))	STACK_CACHE_NEXT(S1);
+		STACK_CACHE_ERROR(S0);
+	S1_READ:
+		if (machine.read(b))	STACK_CACHE_NEXT(S2);
+		STACK_CACHE_ERROR(S1);
+	S2_READ:
+		if (auto i = Integer{}; machine.read(i)) {
+			spill(a);
+			a = b;
+			b = i;
+			STACK_CACHE_NEXT(S2);
+		}
+		STACK_CACHE_ERROR(S2);
+
+	// WRITE
+	S0_WRITE:
+		if (sp > 0)
+			machine.cout << memory[--sp] << ' ';
+		else
+			machine.cout << "null" << ' ';
+		STACK_CACHE_NEXT(S0);
+	S1_WRITE:
+		machine.cout << a << ' ';
+		STACK_CACHE_NEXT(S0);
+	S2_WRITE:
+		machine.cout << b << ' ';
+		STACK_CACHE_NEXT(S1);
+
+	// DUP
+	S0_DUP:
+		if (sp < 1) [[unlikely]] {
+			Machine::report_underflow(Opcode::DUP);
+			STACK_CACHE_ERROR(S0);
+		}
+		a = b = memory[--sp];
+		STACK_CACHE_NEXT(S2);
+	S1_DUP:
+		b = a;
+		STACK_CACHE_NEXT(S2);
+	S2_DUP:
+		spill(a);
+		a = b;
+		STACK_CACHE_NEXT(S2);
+
+	// Binary operations, TOP and SECOND end up in b and a whatever the state, the result in a
+#define STACK_CACHE_BINARY(OP)							\
+	S0_##OP:								\
+		if (sp < 2) [[unlikely]] {					\
+			Machine::report_underflow(Opcode::OP);			\
+			STACK_CACHE_ERROR(S0);					\
+		}								\
+		b = memory[--sp];						\
+		a = memory[--sp];						\
+		goto S2_##OP;							\
+	S1_##OP:								\
+		if (sp < 1) [[unlikely]] {					\
+			Machine::report_underflow(Opcode::OP);			\
+			STACK_CACHE_ERROR(S1);					\
+		}								\
+		b = a;								\
+		a = memory[--sp];						\
+	S2_##OP:								\
+		a = Instruction::evaluate(Opcode::OP, b, a);			\
+		STACK_CACHE_NEXT(S1);
+
+		STACK_CACHE_BINARY(MUL)
+		STACK_CACHE_BINARY(ADD)
+		STACK_CACHE_BINARY(SUB)
+		STACK_CACHE_BINARY(GT)
+		STACK_CACHE_BINARY(LT)
+		STACK_CACHE_BINARY(EQ)
+#undef STACK_CACHE_BINARY
+
+	// JMPZ, same as the binary operations: target in b, condition in a and nothing left cached
+	S0_JMPZ:
+		if (sp < 2) [[unlikely]] {
+			Machine::report_underflow(Opcode::JMPZ);
+			STACK_CACHE_ERROR(S0);
+		}
+		b = memory[--sp];
+		a = memory[--sp];
+		goto S2_JMPZ;
+	S1_JMPZ:
+		if (sp < 1) [[unlikely]] {
+			Machine::report_underflow(Opcode::JMPZ);
+			STACK_CACHE_ERROR(S1);
+		}
+		b = a;
+		a = memory[--sp];
+	S2_JMPZ:
+		if (a != 0)
+			STACK_CACHE_NEXT(S0);
+		else if (0 <= b and static_cast<size_t>(b) < size) {
+			pc = code.data() + b;
+			STACK_CACHE_GOTO(S0);
+		}
+		Machine::report_jump(b, size);
+		STACK_CACHE_ERROR(S0);
+
+	// PUSH
+	S0_PUSH:
+		a = pc->arg;
+		STACK_CACHE_NEXT(S1);
+	S1_PUSH:
+		b = pc->arg;
+		STACK_CACHE_NEXT(S2);
+	S2_PUSH:
+		spill(a);
+		a = b;
+		b = pc->arg;
+		STACK_CACHE_NEXT(S2);
+
+	// POP, only POP 1 is common enough to stay cached. The Verifier rejects 0 and less, past it
+	// arguments are converted to size_t like in Tail_Call.
+	S2_POP:
+		if (pc->arg == 1)
+			STACK_CACHE_NEXT(S1);
+		spill(a);
+		spill(b);
+		goto S0_POP;
+	S1_POP:
+		if (pc->arg == 1)
+			STACK_CACHE_NEXT(S0);
+		spill(a);
+	S0_POP:
+		if (const auto n = static_cast<size_t>(pc->arg); sp < n) [[unlikely]] {
+			Machine::report_underflow(Opcode::POP, pc->arg);
+			STACK_CACHE_ERROR(S0);
+		}
+		else
+			sp -= n;
+		STACK_CACHE_NEXT(S0);
+
+	// ROT, ROT 2 in S2 is a swap
+	S2_ROT:
+		if (pc->arg == 2) {
+			std::swap(a, b);
+			STACK_CACHE_NEXT(S2);
+		}
+		spill(a);
+		spill(b);
+		goto S0_ROT;
+	S1_ROT:
+		spill(a);
+	S0_ROT:
+		if (const auto n = static_cast<size_t>(pc->arg); sp < n) [[unlikely]] {
+			Machine::report_underflow(Opcode::ROT, pc->arg);
+			STACK_CACHE_ERROR(S0);
+		}
+		else if (n >= 2)
+			std::rotate(memory + sp - n, memory + sp - 1, memory + sp);
+		STACK_CACHE_NEXT(S0);
+
+	// Anything that stops the run
+	S0_MISSING_ARGUMENT:
+		Machine::report_missing_argument(static_cast<Opcode>(pc->arg));
+		STACK_CACHE_ERROR(S0);
+	S1_MISSING_ARGUMENT:
+		Machine::report_missing_argument(static_cast<Opcode>(pc->arg));
+		STACK_CACHE_ERROR(S1);
+	S2_MISSING_ARGUMENT:
+		Machine::report_missing_argument(static_cast<Opcode>(pc->arg));
+		STACK_CACHE_ERROR(S2);
+
+	S0_DONE:
+		state = State::Done;
+		goto S0_EXIT;
+	S1_DONE:
+		state = State::Done;
+		goto S1_EXIT;
+	S2_DONE:
+		state = State::Done;
+		goto S2_EXIT;
+
+	S2_EXIT:
+		spill(a);
+		a = b;
+	S1_EXIT:
+		spill(a);
+	S0_EXIT:
+		storage.resize(sp);
+		{
+			const auto index = static_cast<size_t>(pc - code.data());
+			return { state, state == State::Error ? index + 1 : index };
+		}
+
+#undef STACK_CACHE_ERROR
+#undef STACK_CACHE_GOTO
+#undef STACK_CACHE_NEXT
+	}
+#pragma GCC diagnostic pop
+#endif
+};
@@ -0,0 +1,176 @@
+#pragma once
+
+#include <vector>
+#include <optional>
+#include <algorithm>
+
+#include "stack.hpp"
+#include "instruction.hpp"
+
+// Lower bound of the stack depth before every instruction, from a dataflow pass over the jumps a
+// program makes. An instruction that fails ends the run, so whatever follows it may assume it
+// succeeded: after a DUP there are at least 2 values no matter what came before.
+//
+// The stack outlives run(), all a program can count on at the start is a depth >= 0 and there is
+// no upper bound worth tracking.
+//
+// A jump is static when its target is PUSHed right before the JMPZ. Anything else, a computed target
+// or a jump landing straight on a JMPZ so that its target comes from the stack, could go anywhere:
+// every instruction then also gets the depth those jumps leave behind.
+//
+// Usage:
+//
+// const auto depth = Stack_Depth::analyze(instructions);
+// if (depth.safe(i))	// instructions[i] cannot underflow, no need to check
+struct Stack_Depth {
+	using Integer = Stack::Integer;
+	using Opcode = Instruction::Opcode;
+
+	std::vector<std::optional<size_t>> minimum;	// Per instruction, nullopt where it is unreachable
+	std::vector<std::optional<size_t>> needed;	// Per instruction, see needs()
+	bool dynamic = false;				// Has jumps that are not static
+
+	static auto analyze(const Instructions& instructions) -> Stack_Depth {
+		const auto size = instructions.size();
+
+		auto analysis = Stack_Depth{};
+		analysis.minimum.assign(size, std::nullopt);
+		analysis.needed.reserve(size);
+		for (const auto& instr : instructions)
+			analysis.needed.push_back(needs(instr));
+
+		auto is_static = std::vector<bool>(size, false);
+		auto is_target = std::vector<bool>(size, false);
+		for (auto i = size_t{0}; i < size; ++i) {
+			if (instructions[i].op != Opcode::JMPZ)
+				continue;
+
+			if (const auto target = static_target(instructions, i); target.has_value()) {
+				is_static[i] = true;
+				if (0 <= *target and static_cast<size_t>(*target) < size)
+					is_target[static_cast<size_t>(*target)] = true;
+			}
+			else
+				analysis.dynamic = true;
+		}
+
+		// Jumping onto a JMPZ takes its target from the stack, and a jump that could go anywhere could
+		// land on any of them
+		for (auto i = size_t{0}; i < size; ++i)
+			if (is_static[i] and is_target[i])
+				analysis.dynamic = true;
+		if (analysis.dynamic)
+			is_static.assign(size, false);
+
+		// Depths only ever go down, so this settles
+		auto worklist = std::vector<size_t>{};
+		const auto join = [&] (const size_t i, const size_t depth) {
+			if (i < size and (not analysis.minimum[i].has_value() or depth < *analysis.minimum[i])) {
+				analysis.minimum[i] = depth;
+				worklist.push_back(i);
+			}
+		};
+
+		auto anywhere = std::optional<size_t>{};	// Lowest depth a dynamic jump leaves
+		join(0, 0);
+		while (not worklist.empty()) {
+			const auto i = worklist.back();
+			worklist.pop_back();
+
+			const auto& instr = instructions[i];
+			const auto& needed = analysis.needed[i];
+			if (not needed.has_value())
+				continue;	// Always fails
+
+			const auto after = effect(instr, std::max(*analysis.minimum[i], *needed));
+			join(i + 1, after);
+
+			if (instr.op != Opcode::JMPZ)
+				continue;
+			else if (is_static[i]) {
+				if (const auto target = *instructions[i - 1].arg; 0 <= target)
+					join(static_cast<size_t>(target), after);
+			}
+			else if (not anywhere.has_value() or after < *anywhere) {
+				anywhere = after;
+				for (auto j = size_t{0}; j < size; ++j)
+					join(j, after);
+			}
+		}
+
+		return analysis;
+	}
+
+	auto reachable(const size_t i) const -> bool {
+		return minimum[i].has_value();
+	}
+
+	// Has the values instructions[i] needs whenever it runs
+	auto safe(const size_t i) const -> bool {
+		return reachable(i) and needed[i].has_value() and *minimum[i] >= *needed[i];
+	}
+
+	// No reachable instruction can underflow
+	auto proven() const -> bool {
+		for (auto i = size_t{0}; i < minimum.size(); ++i)
+			if (reachable(i) and not safe(i))
+				return false;
+		return true;
+	}
+
+	// Values an instruction takes off the stack or looks at, nullopt when it can never succeed
+	static auto needs(const Instruction& instr) -> std::optional<size_t> {
+		switch (instr.op) {
+			case Opcode::READ:
+			case Opcode::WRITE:	return 0;	// WRITE prints null on an empty stack
+			case Opcode::DUP:	return 1;
+			case Opcode::MUL:
+			case Opcode::ADD:
+			case Opcode::SUB:
+			case Opcode::GT:
+			case Opcode::LT:
+			case Opcode::EQ:
+			case Opcode::JMPZ:	return 2;
+			case Opcode::PUSH:
+				if (instr.arg.has_value())
+					return 0;
+				else
+					return std::nullopt;
+			case Opcode::POP:
+			case Opcode::ROT:	// The Verifier rejects 0 and less like a missing argument
+				if (instr.arg.has_value() and *instr.arg > 0)
+					return static_cast<size_t>(*instr.arg);
+				else
+					return std::nullopt;
+		}
+		return std::nullopt;
+	}
+
+	// Depth after an instruction that succeeded at the given depth
+	static auto effect(const Instruction& instr, const size_t depth) -> size_t {
+		switch (instr.op) {
+			case Opcode::READ:
+			case Opcode::DUP:
+			case Opcode::PUSH:	return depth + 1;
+			case Opcode::WRITE:	return depth > 0 ? depth - 1 : 0;
+			case Opcode::MUL:
+			case Opcode::ADD:
+			case Opcode::SUB:
+			case Opcode::GT:
+			case Opcode::LT:
+			case Opcode::EQ:	return depth - 1;
+			case Opcode::JMPZ:	return depth - 2;
+			case Opcode::POP:	return depth - static_cast<size_t>(*instr.arg);
+			case Opcode::ROT:	return depth;
+		}
+		return depth;
+	}
+
+	// Target of `PUSH t; JMPZ` at i
+	static auto static_target(const Instructions& instructions, const size_t i) -> std::optional<Integer> {
+		if (i > 0 and instructions[i - 1].op == Opcode::PUSH and instructions[i - 1].arg.has_value())
+			return instructions[i - 1].arg;
+		else
+			return std::nullopt;
+	}
+};
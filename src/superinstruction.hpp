@@ -0,0 +1,272 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+#include <initializer_list>
+
+#include "stack.hpp"
+#include "instruction.hpp"
+#include "profile.hpp"
+
+// Fixed sequences our programs are full of, recognized once in Interpreter::prepare() so that the
+// Loop and Threaded engines run each of them in a single dispatch.
+//
+// Every instruction keeps its index: a sequence is fused into its first instruction and the rest of
+// it stays where it was. Jumping into the middle of a sequence simply runs the original instructions
+// from there, and every pc (JMPZ targets, errors, report_pc) still means the same instruction.
+//
+// Which sequences get fused is a Selection, by default the ones our programs are known for. A Profile
+// of training runs can pick them instead, see tools/profile.cpp.
+//
+// Usage:
+//
+// const auto code = Superinstruction::compile(instructions);
+// switch (code[i].dispatch)	// Opcode of instructions[i], or the Kind of the sequence starting there
+struct Superinstruction {
+	using Integer = Stack::Integer;
+	using Opcode = Instruction::Opcode;
+
+	// Numbered after the Opcodes, so that both fit in one dispatch table
+	enum class Kind : uint8_t {
+		BRANCH = Instruction::opcode_count,	// DUP; PUSH k; EQ|LT|GT; PUSH t; JMPZ	goto t if comparing TOP to k gives 0, TOP stays
+		JUMP,					// PUSH 0; PUSH t; JMPZ			goto t
+		NIP,					// ROT 2; POP 1				drop SECOND
+		PUSH_OP,				// PUSH k; <binary>			TOP = k <binary> TOP
+		DUP_OP,					// DUP; <binary>			TOP = TOP <binary> TOP
+		SWAP_OP,				// ROT 2; <binary>			with TOP and SECOND swapped
+	};
+
+	static constexpr auto kind_count = size_t{6};
+	static constexpr auto dispatch_count = Instruction::opcode_count + kind_count;
+
+	// Indexed by Kind - Instruction::opcode_count
+	static constexpr auto names = std::array<std::string_view, kind_count>{
+		"BRANCH", "JUMP", "NIP",
+		"PUSH_OP", "DUP_OP", "SWAP_OP",
+	};
+
+	static constexpr auto binary_operations = std::array{
+		Opcode::MUL, Opcode::ADD, Opcode::SUB,
+		Opcode::GT, Opcode::LT, Opcode::EQ,
+	};
+
+	// Which Kinds compile() may use. The defaults cover the sequences our programs are known for,
+	// from() picks whatever a profile says saves the most dispatches.
+	struct Selection {
+		std::array<bool, kind_count> enabled{};
+		std::array<uint64_t, kind_count> saved{};	// Dispatches each enabled Kind saved in the profile, if from() made this
+
+		auto has(const Kind kind) const -> bool {
+			return enabled[index(kind)];
+		}
+
+		static auto defaults() -> Selection {
+			auto selection = Selection{};
+			for (const auto kind : { Kind::BRANCH, Kind::JUMP, Kind::NIP })
+				selection.enabled[index(kind)] = true;
+			return selection;
+		}
+
+		static auto none() -> Selection {
+			return {};
+		}
+
+		// At most limit Kinds, each of them saving at least min_share of the dispatches in the profile
+		static auto from(const Profile& profile, const size_t limit = kind_count, const double min_share = 0.01) -> Selection {
+			auto selection = Selection{};
+			auto ranked = std::array<Kind, kind_count>{};
+			for (auto i = size_t{0}; i < kind_count; ++i) {
+				ranked[i] = static_cast<Kind>(Instruction::opcode_count + i);
+				for (const auto& pattern : patterns(ranked[i]))
+					selection.saved[i] += profile.count(pattern) * (pattern.length() - 1);
+			}
+
+			std::stable_sort(ranked.begin(), ranked.end(), [&] (const auto a, const auto b) {
+				return selection.saved[index(a)] > selection.saved[index(b)];
+			});
+
+			for (auto i = size_t{0}; i < std::min(limit, kind_count); ++i) {
+				const auto share = static_cast<double>(selection.saved[index(ranked[i])]) / static_cast<double>(std::max<uint64_t>(profile.executed, 1));
+				if (selection.saved[index(ranked[i])] > 0 and share >= min_share)
+					selection.enabled[index(ranked[i])] = true;
+			}
+
+			for (auto i = size_t{0}; i < kind_count; ++i)
+				if (not selection.enabled[i])
+					selection.saved[i] = 0;
+
+			return selection;
+		}
+
+		// One Kind per line, # comments
+		auto save(std::ostream& o) const -> void {
+			o << "# Superinstructions, each with the dispatches it saved in training\n";
+			for (auto i = size_t{0}; i < kind_count; ++i)
+				if (enabled[i])
+					o << names[i] << '\t' << saved[i] << '\n';
+		}
+
+		static auto load(std::istream& in) -> std::optional<Selection> {
+			auto selection = Selection{};
+			auto line = std::string{};
+			while (std::getline(in, line)) {
+				line.erase(std::find(line.begin(), line.end(), '#'), line.end());
+
+				auto line_ss = std::istringstream{line};
+				auto name = std::string{};
+				if (not (line_ss >> name))
+					continue;
+
+				const auto it = std::find(names.cbegin(), names.cend(), name);
+				if (it == names.cend()) {
+					std::cerr << "Error: superinstructions: unknown superinstruction " << name << '\n';
+					return std::nullopt;
+				}
+
+				const auto i = static_cast<size_t>(std::distance(names.cbegin(), it));
+				selection.enabled[i] = true;
+				line_ss >> selection.saved[i];
+			}
+			return selection;
+		}
+
+	private:
+		static constexpr auto index(const Kind kind) -> size_t {
+			return static_cast<size_t>(kind) - Instruction::opcode_count;
+		}
+	};
+
+	// The opcode n-grams a Kind fuses, one per operation it takes
+	static auto patterns(const Kind kind) -> std::vector<Profile::Gram> {
+		const auto gram = [] (const std::initializer_list<Opcode> ops) {
+			return Profile::Gram::pack(ops.begin(), ops.end());
+		};
+
+		auto grams = std::vector<Profile::Gram>{};
+		switch (kind) {
+			case Kind::BRANCH:
+				for (const auto compare : { Opcode::EQ, Opcode::LT, Opcode::GT })
+					grams.push_back(gram({ Opcode::DUP, Opcode::PUSH, compare, Opcode::PUSH, Opcode::JMPZ }));
+				break;
+			case Kind::JUMP:	grams.push_back(gram({ Opcode::PUSH, Opcode::PUSH, Opcode::JMPZ }));	break;
+			case Kind::NIP:		grams.push_back(gram({ Opcode::ROT, Opcode::POP }));			break;
+			case Kind::PUSH_OP:
+			case Kind::DUP_OP:
+			case Kind::SWAP_OP: {
+				const auto first = kind == Kind::PUSH_OP ? Opcode::PUSH : kind == Kind::DUP_OP ? Opcode::DUP : Opcode::ROT;
+				for (const auto op : binary_operations)
+					grams.push_back(gram({ first, op }));
+				break;
+			}
+		}
+		return grams;
+	}
+
+	// One per instruction
+	struct Op {
+		uint8_t dispatch;	// Opcode, or Kind where a sequence starts
+		uint8_t length;		// Instructions run by this dispatch
+		Opcode operation;	// BRANCH, *_OP
+		Integer value;		// BRANCH, PUSH_OP
+		Integer target;		// BRANCH, JUMP
+
+		// Past dispatch_count is up to whoever dispatches, eg. Interpreter::unchecked_dispatch
+		auto fused() const -> bool {
+			return dispatch >= Instruction::opcode_count and dispatch < dispatch_count;
+		}
+
+		auto kind() const -> Kind {
+			return static_cast<Kind>(dispatch);
+		}
+	};
+	using Code = std::vector<Op>;
+
+	static constexpr auto name(const Kind kind) -> std::string_view {
+		return names[static_cast<size_t>(kind) - Instruction::opcode_count];
+	}
+
+	// Sequences may overlap, each instruction simply gets whatever starts there
+	static auto compile(const Instructions& instructions, const Selection& selection = Selection::defaults()) -> Code {
+		auto code = Code{};
+		code.reserve(instructions.size());
+
+		for (auto i = size_t{0}; i < instructions.size(); ++i) {
+			if (const auto op = match(instructions, i, selection); op.has_value())
+				code.push_back(*op);
+			else
+				code.push_back({ static_cast<uint8_t>(instructions[i].op), 1, Opcode::EQ, 0, 0 });
+		}
+
+		return code;
+	}
+
+	// Only sequences that cannot fail once their first instruction could run are fused, anything that
+	// would warn or jump out of the program is left to the plain instructions to report.
+	static auto match(const Instructions& instructions, const size_t i, const Selection& selection) -> std::optional<Op> {
+		const auto at = [&] (const size_t offset, const Opcode op) -> const Instruction* {
+			if (i + offset < instructions.size() and instructions[i + offset].op == op)
+				return &instructions[i + offset];
+			else
+				return nullptr;
+		};
+		const auto plain = [] (const Instruction* instr) {
+			return instr != nullptr and not instr->arg.has_value();
+		};
+		const auto with_arg = [] (const Instruction* instr) {
+			return instr != nullptr and instr->arg.has_value();
+		};
+		const auto target = [&] (const Instruction* instr) {
+			return with_arg(instr) and 0 <= *instr->arg and static_cast<size_t>(*instr->arg) < instructions.size();
+		};
+
+		const auto binary = [&] (const size_t offset) -> std::optional<Opcode> {
+			for (const auto op : binary_operations)
+				if (plain(at(offset, op)))
+					return op;
+			return std::nullopt;
+		};
+
+		// Longest first
+		if (selection.has(Kind::BRANCH) and plain(at(0, Opcode::DUP)) and with_arg(at(1, Opcode::PUSH)) and target(at(3, Opcode::PUSH)) and plain(at(4, Opcode::JMPZ))) {
+			for (const auto compare : { Opcode::EQ, Opcode::LT, Opcode::GT })
+				if (plain(at(2, compare)))
+					return Op{ static_cast<uint8_t>(Kind::BRANCH), 5, compare, *instructions[i + 1].arg, *instructions[i + 3].arg };
+		}
+
+		if (const auto* condition = at(0, Opcode::PUSH);
+			selection.has(Kind::JUMP) and with_arg(condition) and *condition->arg == 0 and target(at(1, Opcode::PUSH)) and plain(at(2, Opcode::JMPZ)))
+		{
+			return Op{ static_cast<uint8_t>(Kind::JUMP), 3, Opcode::EQ, 0, *instructions[i + 1].arg };
+		}
+
+		const auto* rot = at(0, Opcode::ROT);
+		const auto swap = with_arg(rot) and *rot->arg == 2;
+
+		if (const auto* pop = at(1, Opcode::POP);
+			selection.has(Kind::NIP) and swap and with_arg(pop) and *pop->arg == 1)
+		{
+			return Op{ static_cast<uint8_t>(Kind::NIP), 2, Opcode::EQ, 0, 0 };
+		}
+
+		const auto* push = at(0, Opcode::PUSH);
+		const auto operation = binary(1);
+
+		if (selection.has(Kind::PUSH_OP) and with_arg(push) and operation.has_value())
+			return Op{ static_cast<uint8_t>(Kind::PUSH_OP), 2, *operation, *push->arg, 0 };
+
+		if (selection.has(Kind::DUP_OP) and plain(at(0, Opcode::DUP)) and operation.has_value())
+			return Op{ static_cast<uint8_t>(Kind::DUP_OP), 2, *operation, 0, 0 };
+
+		if (selection.has(Kind::SWAP_OP) and swap and operation.has_value())
+			return Op{ static_cast<uint8_t>(Kind::SWAP_OP), 2, *operation, 0, 0 };
+
+		return std::nullopt;
+	}
+};
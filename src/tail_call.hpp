@@ -0,0 +1,305 @@
+#pragma once
+
+#include <vector>
+#include <iostream>
+#include <algorithm>
+
+#include "stack.hpp"
+#include "instruction.hpp"
+#include "machine.hpp"
+
+// Every handler tail calls the next one, so the pc, the stack pointer and the top of the stack
+// stay in argument registers for the whole run instead of going through the Interpreter.
+#if defined(__has_cpp_attribute) && __has_cpp_attribute(clang::musttail)
+#	define TAIL_CALL_GUARANTEED
+#	define TAIL_CALL [[clang::musttail]] return
+#elif defined(__has_cpp_attribute) && __has_cpp_attribute(gnu::musttail)
+#	define TAIL_CALL_GUARANTEED
+#	define TAIL_CALL [[gnu::musttail]] return
+#else
+#	define TAIL_CALL return	// Up to the optimizer to turn these into sibling calls
+#endif
+
+// Usage:
+//
+// const auto code = Tail_Call::compile(instructions);
+// const auto exit = Tail_Call::run(code, machine);
+//
+// Stack layout while running: the top lives in `tos`, everything below it in memory [base, sp - 1).
+// So the depth is always sp - base and base[-1] is a scratch slot that lets pushes and pops
+// on a 0/1 deep stack go without a branch.
+struct Tail_Call {
+	using Integer = Stack::Integer;
+	using Opcode = Instruction::Opcode;
+	using State = Machine::State;
+
+	struct Op;
+	struct Context;
+	using Handler = auto (*)(Context&, const Op*, Integer*, Integer) -> Machine::Exit;
+
+	struct Op {
+		Handler handler;
+		Integer arg;
+	};
+	using Code = std::vector<Op>;
+
+	struct Context {
+		const Op* code;
+		size_t size;
+
+		Stack::Vector& storage;
+		Integer* base;
+		Integer* limit;	// sp at which the next push no longer fits
+
+		const Machine& machine;	// For READ
+		std::ostream& cout;
+
+		// Filled in by the handler that stops the run
+		Integer* sp;
+		Integer tos;
+	};
+
+	// Arguments are decoded here once, the Verifier already dropped stray ones
+	static auto compile(const Instructions& instructions) -> Code {
+		auto code = Code{};
+		code.reserve(instructions.size() + 1);
+
+		for (const auto& instr : instructions) {
+			switch (instr.op) {
+				case Opcode::PUSH:
+				case Opcode::POP:
+				case Opcode::ROT:
+					if (not instr.arg.has_value())
+						code.push_back({ missing_argument, static_cast<Integer>(instr.op) });
+					else
+						code.push_back({ handler(instr.op), *instr.arg });
+					break;
+
+				default:
+					code.push_back({ handler(instr.op), 0 });
+			}
+		}
+
+		code.push_back({ done, 0 });	// Falling off the end of the program
+		return code;
+	}
+
+	// Starting anywhere but 0 is for carrying on from another engine, see tiering.hpp
+	static auto run(const Code& code, const Machine& machine, const size_t start = 0) -> Machine::Exit {
+		auto& storage = machine.stack.storage();
+
+		const auto depth = storage.size();
+		storage.insert(storage.begin(), Integer{});	// base[-1]
+		storage.resize(std::max<size_t>(64, 2 * storage.size()));
+
+		auto ctx = Context{
+			.code = code.data(),
+			.size = code.size() - 1,
+			.storage = storage,
+			.base = storage.data() + 1,
+			.limit = storage.data() + storage.size(),
+			.machine = machine,
+			.cout = machine.cout,
+			.sp = nullptr,
+			.tos = 0,
+		};
+
+		ctx.sp = ctx.base + depth;
+		ctx.tos = ctx.sp[-1];
+
+		// Handlers only come back here with State::Running when they bounce a jump, see jmpz()
+		auto exit = Machine::Exit{ State::Running, start };
+		do {
+			const auto* pc = ctx.code + exit.pc;
+			exit = pc->handler(ctx, pc, ctx.sp, ctx.tos);
+		} while (exit.state == State::Running);
+
+		// Hand the stack back
+		const auto final_depth = static_cast<size_t>(ctx.sp - ctx.base);
+		if (final_depth > 0)
+			ctx.base[final_depth - 1] = ctx.tos;
+		storage.resize(final_depth + 1);
+		storage.erase(storage.begin());
+
+		return exit;
+	}
+
+private:
+	static constexpr auto handler(const Opcode op) -> Handler {
+		switch (op) {
+			case Opcode::READ:	return read;
+			case Opcode::WRITE:	return write;
+			case Opcode::DUP:	return dup;
+			case Opcode::MUL:	return binary<Opcode::MUL>;
+			case Opcode::ADD:	return binary<Opcode::ADD>;
+			case Opcode::SUB:	return binary<Opcode::SUB>;
+			case Opcode::GT:	return binary<Opcode::GT>;
+			case Opcode::LT:	return binary<Opcode::LT>;
+			case Opcode::EQ:	return binary<Opcode::EQ>;
+			case Opcode::JMPZ:	return jmpz;
+			case Opcode::PUSH:	return push;
+			case Opcode::POP:	return pop;
+			case Opcode::ROT:	return rot;
+		}
+		return nullptr;
+	}
+
+	static auto depth(const Context& ctx, const Integer* sp) -> size_t {
+		return static_cast<size_t>(sp - ctx.base);
+	}
+
+	static auto stop(Context& ctx, const Op* pc, Integer* sp, const Integer tos, const State state) -> Machine::Exit {
+		ctx.sp = sp;
+		ctx.tos = tos;
+		return { state, static_cast<size_t>(pc - ctx.code) };
+	}
+
+	// pc is the failed instruction, the Interpreter reports errors one past it
+	[[gnu::cold]] static auto error(Context& ctx, const Op* pc, Integer* sp, const Integer tos) -> Machine::Exit {
+		return stop(ctx, pc + 1, sp, tos, State::Error);
+	}
+
+	[[gnu::cold]] static auto grow(Context& ctx, const Op* pc, Integer* sp, const Integer tos) -> Machine::Exit {
+		const auto d = depth(ctx, sp);
+		ctx.storage.resize(2 * ctx.storage.size());
+		ctx.base = ctx.storage.data() + 1;
+		ctx.limit = ctx.storage.data() + ctx.storage.size();
+		TAIL_CALL pc->handler(ctx, pc, ctx.base + d, tos);	// Retry the push
+	}
+
+#define TAIL_CALL_NEXT() TAIL_CALL pc[1].handler(ctx, pc + 1, sp, tos)
+
+	static auto done(Context& ctx, const Op* pc, Integer* sp, const Integer tos) -> Machine::Exit {
+		return stop(ctx, pc, sp, tos, State::Done);
+	}
+
+	[[gnu::cold]] static auto missing_argument(Context& ctx, const Op* pc, Integer* sp, const Integer tos) -> Machine::Exit {
+		Machine::report_missing_argument(static_cast<Opcode>(pc->arg));
+		return error(ctx, pc, sp, tos);
+	}
+
+	static auto read(Context& ctx, const Op* pc, Integer* sp, Integer tos) -> Machine::Exit {
+		if (sp == ctx.limit) [[unlikely]]
+			TAIL_CALL grow(ctx, pc, sp, tos);
+
+		if (auto i = Integer{}; ctx.machine.read(i)) {
+			sp[-1] = tos;
+			tos = i;
+			++sp;
+			TAIL_CALL_NEXT();
+		}
+		else
+			TAIL_CALL error(ctx, pc, sp, tos);
+	}
+
+	static auto write(Context& ctx, const Op* pc, Integer* sp, Integer tos) -> Machine::Exit {
+		if (depth(ctx, sp) > 0) {
+			ctx.cout << tos << ' ';
+			tos = sp[-2];
+			--sp;
+		}
+		else
+			ctx.cout << "null" << ' ';
+		TAIL_CALL_NEXT();
+	}
+
+	static auto dup(Context& ctx, const Op* pc, Integer* sp, Integer tos) -> Machine::Exit {
+		if (depth(ctx, sp) < 1) [[unlikely]] {
+			Machine::report_underflow(Opcode::DUP);
+			TAIL_CALL error(ctx, pc, sp, tos);
+		}
+		if (sp == ctx.limit) [[unlikely]]
+			TAIL_CALL grow(ctx, pc, sp, tos);
+
+		sp[-1] = tos;
+		++sp;
+		TAIL_CALL_NEXT();
+	}
+
+	template <Opcode op>
+	static auto binary(Context& ctx, const Op* pc, Integer* sp, Integer tos) -> Machine::Exit {
+		if (depth(ctx, sp) < 2) [[unlikely]] {
+			Machine::report_underflow(op);
+			TAIL_CALL error(ctx, pc, sp, tos);
+		}
+
+		tos = Instruction::evaluate(op, tos, sp[-2]);
+		--sp;
+		TAIL_CALL_NEXT();
+	}
+
+	static auto jmpz(Context& ctx, const Op* pc, Integer* sp, Integer tos) -> Machine::Exit {
+		if (depth(ctx, sp) < 2) [[unlikely]] {
+			Machine::report_underflow(Opcode::JMPZ);
+			TAIL_CALL error(ctx, pc, sp, tos);
+		}
+
+		const auto target = tos;
+		const auto condition = sp[-2];
+		tos = sp[-3];
+		sp -= 2;
+
+		if (condition != 0)
+			TAIL_CALL_NEXT();
+		else if (0 <= target and static_cast<size_t>(target) < ctx.size) {
+			const auto* next = ctx.code + target;
+#ifdef TAIL_CALL_GUARANTEED
+			TAIL_CALL next->handler(ctx, next, sp, tos);
+#else
+			// Nothing forces the calls above to be sibling calls (sanitizers, -O0, address taken locals)
+			// so bounce through run() on every taken jump, the native stack then stays bounded by
+			// the length of the program instead of the length of the run.
+			return stop(ctx, next, sp, tos, State::Running);
+#endif
+		}
+		else {
+			Machine::report_jump(target, ctx.size);
+			TAIL_CALL error(ctx, pc, sp, tos);
+		}
+	}
+
+	static auto push(Context& ctx, const Op* pc, Integer* sp, Integer tos) -> Machine::Exit {
+		if (sp == ctx.limit) [[unlikely]]
+			TAIL_CALL grow(ctx, pc, sp, tos);
+
+		sp[-1] = tos;
+		tos = pc->arg;
+		++sp;
+		TAIL_CALL_NEXT();
+	}
+
+	// The Verifier rejects 0 and less like a missing argument. What did not go through it has its
+	// argument converted to size_t just like Stack::pop_n/rot, so negatives fail and 0 does nothing.
+	static auto pop(Context& ctx, const Op* pc, Integer* sp, Integer tos) -> Machine::Exit {
+		const auto n = static_cast<size_t>(pc->arg);
+		if (depth(ctx, sp) < n) [[unlikely]] {
+			Machine::report_underflow(Opcode::POP, pc->arg);
+			TAIL_CALL error(ctx, pc, sp, tos);
+		}
+
+		if (n > 0) {
+			tos = sp[-1 - static_cast<ptrdiff_t>(n)];
+			sp -= n;
+		}
+		TAIL_CALL_NEXT();
+	}
+
+	static auto rot(Context& ctx, const Op* pc, Integer* sp, Integer tos) -> Machine::Exit {
+		const auto n = static_cast<size_t>(pc->arg);
+		if (depth(ctx, sp) < n) [[unlikely]] {
+			Machine::report_underflow(Opcode::ROT, pc->arg);
+			TAIL_CALL error(ctx, pc, sp, tos);
+		}
+
+		// The top sinks n - 1 places, everything it passes moves up by one
+		if (n >= 2) {
+			const auto top = tos;
+			tos = sp[-2];
+			std::copy_backward(sp - n, sp - 2, sp - 1);
+			sp[-static_cast<ptrdiff_t>(n)] = top;
+		}
+		TAIL_CALL_NEXT();
+	}
+
+#undef TAIL_CALL_NEXT
+};
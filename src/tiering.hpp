@@ -0,0 +1,61 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+// When Engine::Tiered moves a program on to a faster engine. Every program starts out in the one
+// that costs nothing to get going and only what runs long enough to make up for it gets compiled:
+//
+// Baseline	execute() one instruction at a time, counting the backward jumps to every loop header
+// Optimized	Quickening, from the loop header that got `warm` backward jumps over all runs so far
+// Native	Jit, from the loop header Optimized jumped back to `hot` times in a row
+//
+// All of them work on the same Stack, so moving up is nothing but carrying on at the header with the
+// next engine, right at the backward jump (on-stack replacement). A program run `frequent` times
+// starts out Optimized, one that ever made it to Native starts out there.
+//
+// Usage:
+//
+// auto tiering = Tiering{instructions.size()};	// Once per prepared program
+// auto tier = tiering.start();			// Once per run
+// tier = tiering.back_edge(target);		// On every backward jump in Baseline
+struct Tiering {
+	enum class Tier : uint8_t {
+		Baseline, Optimized, Native,
+	};
+
+	static constexpr auto warm = uint32_t{64};
+	static constexpr auto hot = uint32_t{4096};
+	static constexpr auto frequent = uint32_t{16};
+
+	uint32_t runs = 0;
+	std::vector<uint32_t> back_edges;	// Per loop header, over all runs
+	bool native = false;			// Has made it to Native
+
+	explicit Tiering(const size_t size = 0)
+		: back_edges(size)
+	{}
+
+	auto start() -> Tier {
+		if (runs < frequent)
+			++runs;
+
+		if (native)
+			return Tier::Native;
+		else if (runs >= frequent)
+			return Tier::Optimized;
+		else
+			return Tier::Baseline;
+	}
+
+	auto back_edge(const size_t target) -> Tier {
+		if (auto& count = back_edges[target]; count < warm)
+			++count;
+		return back_edges[target] >= warm ? Tier::Optimized : Tier::Baseline;
+	}
+
+	// Optimized went around hot times
+	auto promote() -> void {
+		native = true;
+	}
+};
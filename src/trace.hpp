@@ -0,0 +1,352 @@
+#pragma once
+
+#include <vector>
+#include <optional>
+#include <algorithm>
+#include <iostream>
+#include <cstdint>
+
+#include "stack.hpp"
+#include "instruction.hpp"
+#include "machine.hpp"
+#include "stack_depth.hpp"
+#include "deoptimization.hpp"
+
+// Straight line code for a hot loop, compiled from the instructions one iteration of it actually ran.
+//
+// Engine::Trace counts how often every static JMPZ jumps backwards. Once one of them has done so
+// Trace::hot times, the instructions run from its target until the loop comes back around are
+// recorded, and compile() turns them into a trace:
+//
+// - Constants PUSHed are kept by the trace instead of the Stack. Whatever works on nothing but
+//   constants is done while compiling, a constant next to a value on the Stack becomes an immediate.
+// - Every JMPZ becomes a guard on its condition, the PUSH of its target is gone. One on a constant
+//   condition is gone altogether. A guard that does not go the way it went while recording exits to
+//   where the JMPZ goes instead.
+// - Stack_Depth::needs() of every instruction is summed up into a single check at the start of each
+//   iteration, everything past it runs unchecked. Only READ can still fail, and with
+//   Stack::Overflow::Error MUL, ADD and SUB. Those exit to the instruction itself for the interpreter
+//   to fail on, a trace that would fold an overflow is not compiled at all.
+//
+// Every exit has a Deoptimization::Point that puts the constants back where the instructions would
+// have them, so whatever leaves the trace hands back the pc to go on from and the stack exactly as the
+// instructions would have left it. The interpreter simply carries on from there.
+//
+// Usage:
+//
+// if (const auto trace = Trace::compile(instructions, recorded, overflow); trace.has_value())
+// 	const auto exit = Trace::run(*trace, machine);	// State::Running at exit.pc when it left the loop
+struct Trace {
+	using Integer = Stack::Integer;
+	using Opcode = Instruction::Opcode;
+	using State = Machine::State;
+
+	static constexpr auto hot = uint32_t{64};	// Backward jumps before recording
+	static constexpr auto longest = size_t{512};	// Instructions in one iteration, longer is not worth it
+
+	enum class Kind : uint8_t {
+		READ, WRITE, DUP,
+		MUL, ADD, SUB, GT, LT, EQ,
+		POP, ROT,
+		PUSH_OP,	// TOP = k <operation> TOP
+		OP_PUSHED,	// TOP = TOP <operation> k, k having been pushed before TOP
+		WRITE_PUSHED,	// Write k
+		GUARD_ZERO,	// Pop the condition, exit unless it is 0
+		GUARD_NONZERO,	// Pop the condition, exit if it is 0
+		MATERIALIZE,	// Put the constants of the point back on the Stack
+	};
+
+	struct Op {
+		Kind kind;
+		Opcode operation;	// Of PUSH_OP and OP_PUSHED
+		Integer k;		// POP, ROT, PUSH_OP, OP_PUSHED and WRITE_PUSHED
+		uint32_t pc;		// Of the instruction
+		uint32_t point;		// Of READ, guards, MATERIALIZE and checked MUL, ADD and SUB
+	};
+
+	struct Code {
+		uint32_t header;	// Where the loop starts and the trace is entered
+		size_t needs;		// Values on the stack for one iteration to run unchecked
+		bool checked;		// MUL, ADD and SUB exit instead of overflowing
+		std::vector<Op> ops;
+		std::vector<Deoptimization::Point> points;	// Where ops exit to, with the constants they keep
+	};
+
+	// Records one iteration of a loop, starting at header
+	struct Recorder {
+		uint32_t header;
+		std::vector<uint32_t> path;
+
+		enum class Status {
+			Recording, Closed, Aborted,
+		};
+
+		// Call with every pc about to run
+		auto record(const size_t pc) -> Status {
+			if (pc == header and not path.empty())
+				return Status::Closed;
+			else if (path.size() >= longest)
+				return Status::Aborted;
+
+			path.push_back(static_cast<uint32_t>(pc));
+			return Status::Recording;
+		}
+	};
+
+	// nullopt if the loop does not fit, the program has to have static jumps only
+	static auto compile(const Instructions& instructions, const Recorder& recorder, const Stack::Overflow overflow = Stack::Overflow::Unchecked) -> std::optional<Code> {
+		using Slot = Deoptimization::Slot;
+		const auto& path = recorder.path;
+
+		auto code = Code{ recorder.header, 0, overflow == Stack::Overflow::Error, {}, {} };
+
+		// What the instructions would have on top of the stack, relative to the start of the iteration.
+		// Whatever is looked at below that start is pulled in as it is needed, which is what needs counts.
+		// The slots a POP or ROT reaches deeper than `longest` are only counted in hidden, below layout.
+		// None of those are constants.
+		auto layout = Deoptimization::Layout{};
+		auto hidden = size_t{0};
+		const auto reach = [&] (const size_t n) {
+			if (const auto known = layout.size() + hidden; known < n) {
+				code.needs += n - known;
+				hidden += n - known;
+			}
+		};
+		const auto expose = [&] (const size_t n) {
+			for (; layout.size() < n and hidden > 0; --hidden)
+				layout.insert(layout.begin(), Slot{ false, 0 });
+		};
+		const auto top = [&] (const size_t i = 0) -> Slot& {
+			return layout[layout.size() - 1 - i];
+		};
+		const auto pop = [&] {
+			const auto slot = layout.back();
+			layout.pop_back();
+			return slot;
+		};
+		const auto point = [&] (const size_t pc) {
+			code.points.push_back({ static_cast<uint32_t>(pc), layout });
+			return static_cast<uint32_t>(code.points.size() - 1);
+		};
+		const auto emit = [&] (const Kind kind, const uint32_t pc, const Integer k = 0, const Opcode operation = Opcode::PUSH, const uint32_t p = 0) {
+			code.ops.push_back({ kind, operation, k, pc, p });
+		};
+		// Everything on the Stack from here on
+		const auto materialize = [&] (const uint32_t pc) {
+			if (rs::none_of(layout, &Slot::constant))
+				return;
+			emit(Kind::MATERIALIZE, pc, 0, Opcode::PUSH, point(pc));
+			for (auto& slot : layout)
+				slot = Slot{ false, 0 };
+		};
+
+		for (auto p = size_t{0}; p < path.size(); ++p) {
+			const auto pc = path[p];
+			const auto& instr = instructions[pc];
+			const auto next = p + 1 < path.size() ? path[p + 1] : recorder.header;
+			const auto needs = Stack_Depth::needs(instr);
+			if (not needs.has_value())
+				return std::nullopt;
+
+			reach(std::max<size_t>(*needs, instr.op == Opcode::WRITE ? 1 : 0));	// Printing null for nothing is left to the interpreter
+			if (*needs <= longest)
+				expose(std::max<size_t>(*needs, instr.op == Opcode::WRITE ? 1 : 0));
+			switch (instr.op) {
+				case Opcode::READ:
+					emit(Kind::READ, pc, 0, instr.op, point(pc));
+					layout.push_back({ false, 0 });
+					break;
+
+				case Opcode::WRITE:
+					if (const auto slot = pop(); slot.constant)
+						emit(Kind::WRITE_PUSHED, pc, slot.k);
+					else
+						emit(Kind::WRITE, pc);
+					break;
+
+				case Opcode::DUP:
+					if (not top().constant)
+						emit(Kind::DUP, pc);
+					layout.push_back(top());
+					break;
+
+				case Opcode::PUSH:
+					layout.push_back({ true, *instr.arg });
+					break;
+
+				case Opcode::POP: {
+					auto values = Integer{0};
+					auto n = *instr.arg;
+					for (; n > 0 and not layout.empty(); --n)
+						values += not pop().constant;
+					values += n;
+					hidden -= static_cast<size_t>(n);
+					if (values > 0)
+						emit(Kind::POP, pc, values);
+					break;
+				}
+
+				case Opcode::ROT: {
+					// Only the constants move around as long as the values on the Stack stay in order, which
+					// they do unless TOP is one of them and sinks below another
+					const auto n = static_cast<size_t>(*instr.arg);
+					if (n > layout.size()) {
+						// TOP sinks into hidden, which holds no constants
+						materialize(pc);
+						emit(Kind::ROT, pc, *instr.arg);
+						break;
+					}
+					const auto in_order = top().constant
+						or rs::all_of(layout.end() - static_cast<std::ptrdiff_t>(n), layout.end() - 1, &Slot::constant);
+					if (not in_order) {
+						materialize(pc);
+						emit(Kind::ROT, pc, *instr.arg);
+					}
+					rs::rotate(layout.end() - static_cast<std::ptrdiff_t>(n), layout.end() - 1, layout.end());
+					break;
+				}
+
+				case Opcode::MUL:
+				case Opcode::ADD:
+				case Opcode::SUB:
+				case Opcode::GT:
+				case Opcode::LT:
+				case Opcode::EQ: {
+					// Back to before the instruction if it overflows
+					const auto checked = code.checked and instr.op <= Opcode::SUB;
+					const auto p = checked ? point(pc) : 0;
+					const auto tos = pop();
+					auto& second = top();
+					if (tos.constant and second.constant) {
+						const auto k = checked ? Instruction::evaluate_exact(instr.op, tos.k, second.k) : Instruction::evaluate(instr.op, tos.k, second.k);
+						if (not k.has_value())
+							return std::nullopt;
+						second.k = *k;
+					}
+					else if (tos.constant)
+						emit(Kind::PUSH_OP, pc, tos.k, instr.op, p);
+					else if (second.constant) {
+						emit(Kind::OP_PUSHED, pc, second.k, instr.op, p);
+						second = Slot{ false, 0 };
+					}
+					else
+						emit(static_cast<Kind>(static_cast<int>(Kind::MUL) + static_cast<int>(instr.op) - static_cast<int>(Opcode::MUL)), pc, 0, instr.op, p);
+					break;
+				}
+
+				case Opcode::JMPZ: {
+					// Static, so the target was PUSHed right before
+					const auto target = pop();
+					const auto condition = pop();
+					if (not target.constant or pc == 0 or instructions[pc - 1].op != Opcode::PUSH)
+						return std::nullopt;
+					if (target.k < 0 or static_cast<size_t>(target.k) >= instructions.size())
+						return std::nullopt;	// Leaving the loop there is an error, the interpreter reports it
+
+					// Went the way it had to while recording
+					if (condition.constant)
+						break;
+
+					if (static_cast<size_t>(target.k) == pc + 1)
+						emit(Kind::POP, pc, 1);		// Either way it goes on at the next instruction
+					else if (next == static_cast<uint32_t>(target.k))
+						emit(Kind::GUARD_ZERO, pc, 0, instr.op, point(pc + 1));
+					else
+						emit(Kind::GUARD_NONZERO, pc, 0, instr.op, point(static_cast<size_t>(target.k)));
+					break;
+				}
+			}
+		}
+
+		// Around again with nothing but the Stack
+		materialize(recorder.header);
+		return code;
+	}
+
+	static auto run(const Code& code, const Machine machine) -> Machine::Exit {
+		auto& stack = machine.stack.storage();
+		const auto pop = [&] {
+			const auto top = stack.back();
+			stack.pop_back();
+			return top;
+		};
+		// op(top, second), nullopt where it overflows and the code is checked
+		const auto evaluate = [&] (const Opcode operation, const Integer top, const Integer second) -> std::optional<Integer> {
+			if (code.checked)
+				return Instruction::evaluate_exact(operation, top, second);
+			else
+				return Instruction::evaluate(operation, top, second);
+		};
+
+		for (;;) {
+			if (stack.size() < code.needs)
+				return { State::Running, code.header };
+
+			for (const auto& op : code.ops) {
+				switch (op.kind) {
+					case Kind::READ:
+						if (auto i = Integer{}; machine.read(i))
+							stack.push_back(i);
+						else {
+							Deoptimization::materialize(code.points[op.point].layout, stack);
+							return { State::Error, op.pc + 1 };
+						}
+						break;
+
+					case Kind::WRITE:	machine.cout << pop() << ' ';		break;
+					case Kind::WRITE_PUSHED: machine.cout << op.k << ' ';		break;
+					case Kind::DUP:		stack.push_back(stack.back());		break;
+					case Kind::POP:		stack.resize(stack.size() - static_cast<size_t>(op.k));	break;
+
+					case Kind::ROT: {
+						const auto end = stack.end();
+						std::rotate(end - op.k, end - 1, end);
+						break;
+					}
+
+					case Kind::MUL:
+					case Kind::ADD:
+					case Kind::SUB:
+					case Kind::GT:
+					case Kind::LT:
+					case Kind::EQ: {
+						const auto result = evaluate(op.operation, stack.end()[-1], stack.end()[-2]);
+						if (not result.has_value())
+							return Deoptimization::resume(code.points[op.point], stack);
+						stack.pop_back();
+						stack.back() = *result;
+						break;
+					}
+
+					case Kind::PUSH_OP:
+						if (const auto result = evaluate(op.operation, op.k, stack.back()); result.has_value())
+							stack.back() = *result;
+						else
+							return Deoptimization::resume(code.points[op.point], stack);
+						break;
+
+					case Kind::OP_PUSHED:
+						if (const auto result = evaluate(op.operation, stack.back(), op.k); result.has_value())
+							stack.back() = *result;
+						else
+							return Deoptimization::resume(code.points[op.point], stack);
+						break;
+
+					case Kind::GUARD_ZERO:
+						if (pop() != 0)
+							return Deoptimization::resume(code.points[op.point], stack);
+						break;
+
+					case Kind::GUARD_NONZERO:
+						if (pop() == 0)
+							return Deoptimization::resume(code.points[op.point], stack);
+						break;
+
+					case Kind::MATERIALIZE:
+						Deoptimization::materialize(code.points[op.point].layout, stack);
+						break;
+				}
+			}
+		}
+	}
+};
@@ -0,0 +1,332 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <iostream>
+
+#include "stack.hpp"
+#include "instruction.hpp"
+#include "machine.hpp"
+
+// Turns prepared instructions into source code: one function per program, one label per
+// instruction and the stack in a plain array.
+//
+// Usage:
+//
+// Transpiler::emit(instructions, {.function = "factorial"}, header_ostream);
+//
+// Dialect::Cpp is a self contained header for sage_transpile, the function has the
+// signature of Machine::Compiled, see Interpreter::run_compiled(). Its stack is a fixed
+// size local array, growing past Options::stack_capacity stops the program with State::Error.
+//
+// Dialect::C is plain C for Native, it only talks to the outside through Host and
+// instead of failing on a full stack it returns State::Running so the caller can grow
+// the array and call again from the same pc.
+struct Transpiler {
+	using Integer = Stack::Integer;
+	using Opcode = Instruction::Opcode;
+	using State = Machine::State;
+
+	enum class Dialect {
+		Cpp, C,
+	};
+
+	struct Options {
+		std::string function;
+		Dialect dialect = Dialect::Cpp;
+		size_t stack_capacity = 256;	// Dialect::Cpp only
+		std::string source = {};	// Mentioned in the header comment
+	};
+
+	// What Dialect::C passes to Host::report
+	enum class Report : int {
+		Underflow, Jump, Read, Missing_Argument,
+	};
+
+	// Dialect::C counterpart of the streams and Machine::report_*, keep in sync with host_declaration
+	struct Host {
+		void* ctx;
+		auto (*read)(void* ctx, Integer* value) -> int;
+		auto (*write)(void* ctx, Integer value) -> void;
+		auto (*write_null)(void* ctx) -> void;
+		auto (*report)(void* ctx, int report, int op, Integer arg) -> void;
+	};
+	// Dialect::C signature, depth and pc are read on entry and written on exit, returns the State
+	using C_Function = auto (*)(const Host*, Integer* stack, size_t* depth, size_t capacity, size_t* pc) -> int;
+
+	static constexpr auto host_declaration = std::string_view{
+		"struct sage_host {\n"
+		"\tvoid* ctx;\n"
+		"\tint (*read)(void* ctx, int32_t* value);\n"
+		"\tvoid (*write)(void* ctx, int32_t value);\n"
+		"\tvoid (*write_null)(void* ctx);\n"
+		"\tvoid (*report)(void* ctx, int report, int op, int32_t arg);\n"
+		"};\n"
+	};
+
+	static auto emit(const Instructions& instructions, const Options& options, std::ostream& o) -> void {
+		switch (options.dialect) {
+			case Dialect::Cpp:
+				o
+					<< "// Generated by sage_transpile" << (options.source.empty() ? "" : " from " + options.source) << ", do not edit\n"
+					<< "#pragma once\n"
+					<< '\n'
+					<< "#include <string.h>\n"
+					<< "#include <algorithm>\n"
+					<< "#include <iostream>\n"
+					<< "#include <type_traits>\n"
+					<< '\n'
+					<< "#include \"stack.hpp\"\n"
+					<< "#include \"instruction.hpp\"\n"
+					<< "#include \"machine.hpp\"\n"
+					<< '\n';
+				break;
+
+			case Dialect::C:
+				o
+					<< "/* Generated by sage" << (options.source.empty() ? "" : " from " + options.source) << ", do not edit */\n"
+					<< "#include <stddef.h>\n"
+					<< "#include <stdint.h>\n"
+					<< "#include <string.h>\n"
+					<< '\n'
+					<< host_declaration
+					<< '\n';
+				break;
+		}
+		emit_function(instructions, options, o);
+	}
+
+private:
+	static auto emit_function(const Instructions& instructions, const Options& options, std::ostream& o) -> void {
+		const auto size = instructions.size();
+		const auto cpp = options.dialect == Dialect::Cpp;
+
+		const auto label = [] (const size_t i) { return "i" + std::to_string(i); };
+		const auto op_name = [] (const Opcode op) { return std::string{Instruction::name(op)}; };
+		const auto state = [] (const State s) { return std::to_string(static_cast<int>(s)); };
+
+		// Statements reporting a failed instruction
+		const auto report = [&] (const Report r, const Opcode op, const std::string& arg) -> std::string {
+			if (cpp) {
+				switch (r) {
+					case Report::Underflow:		return "Machine::report_underflow(Opcode::" + op_name(op) + ", " + arg + ");";
+					case Report::Jump:		return "Machine::report_jump(" + arg + ", size);";
+					case Report::Read:		return "Machine::report_read();";
+					case Report::Missing_Argument:	return "Machine::report_missing_argument(Opcode::" + op_name(op) + ");";
+				}
+				return {};
+			}
+			else
+				return "host->report(host->ctx, " + std::to_string(static_cast<int>(r)) + ", " + std::to_string(static_cast<int>(op)) + ", " + arg + ");";
+		};
+		const auto fail = [] (const size_t i) {
+			return "pc = " + std::to_string(i) + "; goto error;";
+		};
+		const auto require = [&] (const size_t i, const size_t n, const Opcode op, const Integer arg = 0) {
+			o << "\tif (n < " << n << ") { " << report(Report::Underflow, op, std::to_string(arg)) << ' ' << fail(i) << " }\n";
+		};
+		const auto reserve = [&] (const size_t i) {
+			if (cpp)
+				o << "\tif (n == capacity) { report_overflow(); " << fail(i) << " }\n";
+			else
+				o << "\tif (n == capacity) { pc = " << i << "; goto overflow; }\n";
+		};
+		// Same as Instruction::evaluate for C, which can not call it
+		const auto evaluate = [&] (const Opcode op) -> std::string {
+			if (cpp)
+				return "Instruction::evaluate(Opcode::" + op_name(op) + ", s[n - 1], s[n - 2])";
+
+			switch (op) {
+				case Opcode::MUL:	return "(int32_t)((uint32_t)s[n - 1] * (uint32_t)s[n - 2])";
+				case Opcode::ADD:	return "(int32_t)((uint32_t)s[n - 1] + (uint32_t)s[n - 2])";
+				case Opcode::SUB:	return "(int32_t)((uint32_t)s[n - 1] - (uint32_t)s[n - 2])";
+				case Opcode::GT:	return "(s[n - 1] <= s[n - 2])";
+				case Opcode::LT:	return "(s[n - 1] >= s[n - 2])";
+				case Opcode::EQ:	return "(s[n - 1] != s[n - 2])";
+				default:		return {};
+			}
+		};
+		const auto jump_table = [&] (const bool entry) {
+			o << "\tswitch (target) {\n";
+			for (auto i = size_t{0}; i < size + entry; ++i)
+				o << "\t\tcase " << i << ": goto " << label(i) << ";\n";
+			o << "\t\tdefault:\n";
+			if (entry)
+				o << "\t\t\treturn " << state(State::Error) << ";\n";
+			else
+				o
+					<< "\t\t\t" << report(Report::Jump, Opcode::JMPZ, "target") << '\n'
+					<< "\t\t\tpc = jump_pc;\n"
+					<< "\t\t\tgoto error;\n";
+			o << "\t}\n";
+		};
+
+		if (cpp) {
+			o
+				<< "#pragma GCC diagnostic push\n"
+				<< "#pragma GCC diagnostic ignored \"-Wunused-label\"\n"
+				<< "inline auto " << options.function << "(Stack& stack, std::istream& cin, std::ostream& cout) -> Machine::Exit {\n"
+				<< "\tusing Opcode = Instruction::Opcode;\n"
+				<< "\tusing State = Machine::State;\n"
+				<< "\tstatic_assert(std::is_same_v<Stack::Integer, int32_t>);\n"
+				<< '\n'
+				<< "\tconstexpr auto size = size_t{" << size << "};\n"
+				<< "\tconstexpr auto capacity = size_t{" << options.stack_capacity << "};\n"
+				<< "\tconst auto report_overflow = [] { std::cerr << \"\\tError: stack exceeds the \" << capacity << \" ints of the compiled program\\n\"; };\n"
+				<< '\n'
+				<< "\tint32_t s[capacity];\n"
+				<< "\tsize_t n = 0;\n"
+				<< "\tsize_t pc = 0;\n"
+				<< "\tint32_t target = 0;\n"
+				<< "\tsize_t jump_pc = 0;\n"
+				<< '\n'
+				<< "\t// Pick up where the last run left the stack\n"
+				<< "\tif (auto& storage = stack.storage(); storage.size() > capacity) {\n"
+				<< "\t\treport_overflow();\n"
+				<< "\t\treturn { State::Error, 0 };\n"
+				<< "\t}\n"
+				<< "\telse {\n"
+				<< "\t\tn = storage.size();\n"
+				<< "\t\tstd::copy(storage.cbegin(), storage.cend(), s);\n"
+				<< "\t}\n"
+				<< '\n';
+		}
+		else {
+			o
+				<< "int " << options.function << "(const struct sage_host* host, int32_t* s, size_t* depth, size_t capacity, size_t* pc_io) {\n"
+				<< "\tsize_t n = *depth;\n"
+				<< "\tsize_t pc = 0;\n"
+				<< "\tint32_t target = (int32_t)*pc_io;\n"
+				<< "\tsize_t jump_pc = 0;\n"
+				<< '\n'
+				<< "\t/* Resume wherever the last call stopped */\n";
+			jump_table(true);
+			o << '\n';
+		}
+
+		for (auto i = size_t{0}; i < size; ++i) {
+			const auto& instr = instructions[i];
+			o << label(i) << ":\t// " << instr << '\n';
+
+			switch (instr.op) {
+				case Opcode::READ:
+					reserve(i);
+					if (cpp)
+						o << "\tif (!(cin >> s[n])) { " << report(Report::Read, instr.op, "0") << ' ' << fail(i) << " }\n";
+					else
+						o << "\tif (!host->read(host->ctx, &s[n])) { " << report(Report::Read, instr.op, "0") << ' ' << fail(i) << " }\n";
+					o << "\t++n;\n";
+					break;
+
+				case Opcode::WRITE:
+					if (cpp)
+						o << "\tif (n > 0) cout << s[--n] << ' '; else cout << \"null\" << ' ';\n";
+					else
+						o << "\tif (n > 0) host->write(host->ctx, s[--n]); else host->write_null(host->ctx);\n";
+					break;
+
+				case Opcode::DUP:
+					require(i, 1, instr.op);
+					reserve(i);
+					o << "\ts[n] = s[n - 1]; ++n;\n";
+					break;
+
+				case Opcode::MUL:
+				case Opcode::ADD:
+				case Opcode::SUB:
+				case Opcode::GT:
+				case Opcode::LT:
+				case Opcode::EQ:
+					require(i, 2, instr.op);
+					o << "\ts[n - 2] = " << evaluate(instr.op) << "; --n;\n";
+					break;
+
+				case Opcode::JMPZ:
+					require(i, 2, instr.op);
+					o << "\ttarget = s[n - 1]; n -= 2;\n";
+					o << "\tif (s[n] == 0) { jump_pc = " << i << "; goto jump; }\n";
+					break;
+
+				case Opcode::PUSH:
+					if (not instr.arg.has_value()) {
+						o << '\t' << report(Report::Missing_Argument, instr.op, "0") << ' ' << fail(i) << '\n';
+						break;
+					}
+
+					// PUSH t; JMPZ, straight to the label. The JMPZ keeps its own code for anyone jumping to it
+					if (i + 1 < size and instructions[i + 1].op == Opcode::JMPZ) {
+						const auto t = *instr.arg;
+						o << "\tif (n < 1) { s[n++] = " << t << "; " << report(Report::Underflow, Opcode::JMPZ, "0") << ' ' << fail(i + 1) << " }\n";
+						if (0 <= t and static_cast<size_t>(t) < size)
+							o << "\tif (s[--n] == 0) goto " << label(static_cast<size_t>(t)) << ";\n";
+						else
+							o << "\tif (s[--n] == 0) { " << report(Report::Jump, Opcode::JMPZ, std::to_string(t)) << ' ' << fail(i + 1) << " }\n";
+						o << "\tgoto " << label(i + 2) << ";\n";
+						break;
+					}
+
+					reserve(i);
+					o << "\ts[n++] = " << *instr.arg << ";\n";
+					break;
+
+				case Opcode::POP:
+					if (not instr.arg.has_value())
+						o << '\t' << report(Report::Missing_Argument, instr.op, "0") << ' ' << fail(i) << '\n';
+					else if (*instr.arg < 0)	// Huge once converted to size_t, see Stack::pop_n
+						o << '\t' << report(Report::Underflow, instr.op, std::to_string(*instr.arg)) << ' ' << fail(i) << '\n';
+					else if (*instr.arg > 0) {
+						require(i, static_cast<size_t>(*instr.arg), instr.op, *instr.arg);
+						o << "\tn -= " << *instr.arg << ";\n";
+					}
+					break;
+
+				case Opcode::ROT:
+					if (not instr.arg.has_value())
+						o << '\t' << report(Report::Missing_Argument, instr.op, "0") << ' ' << fail(i) << '\n';
+					else if (*instr.arg < 0)
+						o << '\t' << report(Report::Underflow, instr.op, std::to_string(*instr.arg)) << ' ' << fail(i) << '\n';
+					else {
+						require(i, static_cast<size_t>(*instr.arg), instr.op, *instr.arg);
+						if (*instr.arg == 2)
+							o << "\t{ int32_t t = s[n - 1]; s[n - 1] = s[n - 2]; s[n - 2] = t; }\n";
+						else if (*instr.arg > 2)
+							o << "\t{ int32_t t = s[n - 1]; memmove(&s[n - " << *instr.arg << " + 1], &s[n - " << *instr.arg << "], " << (*instr.arg - 1) << " * sizeof(int32_t)); s[n - " << *instr.arg << "] = t; }\n";
+					}
+					break;
+			}
+		}
+
+		o << label(size) << ":\n";
+		if (cpp)
+			o
+				<< "\tstack.storage().assign(s, s + n);\n"
+				<< "\treturn { State::Done, size };\n";
+		else
+			o
+				<< "\t*depth = n;\n"
+				<< "\t*pc_io = " << size << ";\n"
+				<< "\treturn " << state(State::Done) << ";\n";
+
+		o << '\n' << "jump:\n";
+		jump_table(false);
+
+		o << '\n' << "error:\n";
+		if (cpp)
+			o
+				<< "\tstack.storage().assign(s, s + n);\n"
+				<< "\treturn { State::Error, pc + 1 };\n"
+				<< "}\n"
+				<< "#pragma GCC diagnostic pop\n";
+		else
+			o
+				<< "\t*depth = n;\n"
+				<< "\t*pc_io = pc + 1;\n"
+				<< "\treturn " << state(State::Error) << ";\n"
+				<< '\n'
+				<< "overflow:\n"
+				<< "\t*depth = n;\n"
+				<< "\t*pc_io = pc;\n"
+				<< "\treturn " << state(State::Running) << ";\n"
+				<< "}\n";
+	}
+};
@@ -0,0 +1,207 @@
+#pragma once
+
+#include <vector>
+#include <optional>
+#include <algorithm>
+#include <limits>
+#include <cstdint>
+
+#include "stack.hpp"
+#include "instruction.hpp"
+#include "stack_depth.hpp"
+
+// Intervals of the values on the stack before every instruction, from a dataflow pass over the jumps a
+// program makes, to prove which MUL, ADD and SUB can never overflow an Integer.
+//
+// Only what the program itself pushes is known: constants, what comparisons give and whatever READ
+// reads, which is anything unless the input is declared to be in a range. The stack left over from the
+// last run could hold anything, so the intervals are of the top of the stack only and everything below
+// them is unknown.
+//
+// An interval that still grows after `widen_after` visits to an instruction is widened to anything,
+// loops would otherwise take as many rounds as it takes to overflow. Programs with jumps that are not
+// static, see Stack_Depth, could go anywhere and get nothing proven.
+//
+// Usage:
+//
+// const auto ranges = Value_Range::analyze(instructions, { 0, 100 });	// Input is never outside [0, 100]
+// if (ranges.proven(i))	// instructions[i] never overflows, no need to check
+struct Value_Range {
+	using Integer = Stack::Integer;
+	using Opcode = Instruction::Opcode;
+
+	static constexpr auto widen_after = 8;
+
+	// Wide enough for the result of any operation on two Integers
+	struct Interval {
+		int64_t lo = std::numeric_limits<Integer>::min();
+		int64_t hi = std::numeric_limits<Integer>::max();
+
+		auto fits() const -> bool {
+			return std::numeric_limits<Integer>::min() <= lo and hi <= std::numeric_limits<Integer>::max();
+		}
+
+		auto contains(const int64_t i) const -> bool {
+			return lo <= i and i <= hi;
+		}
+
+		friend auto operator== (const Interval&, const Interval&) -> bool = default;
+	};
+	using Values = std::vector<Interval>;	// The top of the stack, bottom first
+
+	std::vector<std::optional<Values>> values;	// Per instruction, nullopt where it is unreachable
+	std::vector<bool> overflows;			// Per instruction, a MUL, ADD or SUB there that might
+
+	// Input could be anything
+	static auto analyze(const Instructions& instructions) -> Value_Range {
+		return analyze(instructions, Interval{});
+	}
+
+	static auto analyze(const Instructions& instructions, const Interval input) -> Value_Range {
+		const auto size = instructions.size();
+
+		auto analysis = Value_Range{};
+		analysis.values.assign(size, std::nullopt);
+		analysis.overflows.assign(size, false);
+		for (auto i = size_t{0}; i < size; ++i)
+			analysis.overflows[i] = arithmetic(instructions[i].op);
+
+		if (size == 0 or Stack_Depth::analyze(instructions).dynamic)
+			return analysis;
+
+		auto visits = std::vector<int>(size, 0);
+		auto worklist = std::vector<size_t>{};
+		const auto join = [&] (const size_t i, const Values& incoming) {
+			if (i >= size)
+				return;
+
+			auto& known = analysis.values[i];
+			if (not known.has_value()) {
+				known = incoming;
+				worklist.push_back(i);
+				return;
+			}
+
+			// Whatever is known on both ways in, top aligned
+			const auto n = std::min(known->size(), incoming.size());
+			auto joined = Values(known->end() - static_cast<std::ptrdiff_t>(n), known->end());
+			for (auto k = size_t{0}; k < n; ++k) {
+				const auto& other = incoming[incoming.size() - n + k];
+				auto& interval = joined[k];
+				const auto hull = Interval{ std::min(interval.lo, other.lo), std::max(interval.hi, other.hi) };
+				interval = hull != interval and visits[i] >= widen_after ? Interval{} : hull;
+			}
+
+			if (joined != *known) {
+				known = std::move(joined);
+				worklist.push_back(i);
+			}
+		};
+
+		join(0, {});
+		while (not worklist.empty()) {
+			const auto i = worklist.back();
+			worklist.pop_back();
+			++visits[i];
+
+			auto stack = *analysis.values[i];
+			const auto& instr = instructions[i];
+			const auto needs = Stack_Depth::needs(instr);
+			if (not needs.has_value())
+				continue;	// Always fails
+
+			// What is below the known values could be anything. Only the two values an operation looks at
+			// are ever filled in, POP and ROT go as deep as their argument says.
+			if (instr.op != Opcode::POP and instr.op != Opcode::ROT)
+				while (stack.size() < *needs)
+					stack.insert(stack.begin(), Interval{});
+			const auto pop = [&] {
+				const auto top = stack.back();
+				stack.pop_back();
+				return top;
+			};
+
+			switch (instr.op) {
+				case Opcode::READ:	stack.push_back(input);				break;
+				case Opcode::WRITE:	if (not stack.empty()) stack.pop_back();	break;
+				case Opcode::DUP:	stack.push_back(stack.back());			break;
+				case Opcode::PUSH:	stack.push_back({ *instr.arg, *instr.arg });	break;
+				case Opcode::POP:	stack.resize(stack.size() - std::min(*needs, stack.size()));	break;
+
+				case Opcode::ROT:
+					if (*needs <= stack.size())
+						std::rotate(stack.end() - static_cast<std::ptrdiff_t>(*needs), stack.end() - 1, stack.end());
+					else if (not stack.empty())
+						stack.pop_back();	// Sinks below what is known, the rest moves up
+					break;
+
+				case Opcode::MUL:
+				case Opcode::ADD:
+				case Opcode::SUB: {
+					const auto top = pop();
+					const auto result = evaluate(instr.op, top, stack.back());
+					stack.back() = result.fits() ? result : Interval{};
+					break;
+				}
+
+				case Opcode::GT:
+				case Opcode::LT:
+				case Opcode::EQ:
+					pop();
+					stack.back() = { 0, 1 };
+					break;
+
+				case Opcode::JMPZ: {
+					const auto target = *instructions[i - 1].arg;	// Static, so PUSHed right before
+					pop();
+					const auto condition = pop();
+					if (condition.contains(0) and 0 <= target)
+						join(static_cast<size_t>(target), stack);
+					if (condition != Interval{ 0, 0 })
+						join(i + 1, stack);
+					continue;
+				}
+			}
+			join(i + 1, stack);
+		}
+
+		// Only now that every interval is as wide as it gets
+		for (auto i = size_t{0}; i < size; ++i) {
+			const auto& instr = instructions[i];
+			if (not arithmetic(instr.op))
+				continue;
+			else if (not analysis.values[i].has_value())
+				analysis.overflows[i] = false;	// Never runs
+			else {
+				const auto& stack = *analysis.values[i];
+				const auto top = stack.size() >= 1 ? stack[stack.size() - 1] : Interval{};
+				const auto second = stack.size() >= 2 ? stack[stack.size() - 2] : Interval{};
+				analysis.overflows[i] = not evaluate(instr.op, top, second).fits();
+			}
+		}
+
+		return analysis;
+	}
+
+	// instructions[i] is not a MUL, ADD or SUB that could overflow
+	auto proven(const size_t i) const -> bool {
+		return not overflows[i];
+	}
+
+	static constexpr auto arithmetic(const Opcode op) -> bool {
+		return op == Opcode::MUL or op == Opcode::ADD or op == Opcode::SUB;
+	}
+
+private:
+	// Exact for two Integers, op(TOP, SECOND) like Instruction::evaluate()
+	static auto evaluate(const Opcode op, const Interval top, const Interval second) -> Interval {
+		switch (op) {
+			case Opcode::ADD:	return { top.lo + second.lo, top.hi + second.hi };
+			case Opcode::SUB:	return { top.lo - second.hi, top.hi - second.lo };
+			default: {
+				const auto corners = { top.lo * second.lo, top.lo * second.hi, top.hi * second.lo, top.hi * second.hi };
+				return { std::min(corners), std::max(corners) };
+			}
+		}
+	}
+};
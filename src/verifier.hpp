@@ -0,0 +1,73 @@
+#pragma once
+
+#include <vector>
+#include <iostream>
+
+#include "stack.hpp"
+#include "instruction.hpp"
+
+// Everything about a program that can be checked without running it, checked once in
+// Interpreter::prepare() instead of every time an instruction runs:
+//
+// - Stray arguments are reported and dropped
+// - Missing arguments are reported and the instruction is listed, running it still fails like it always did
+// - POP and ROT of 0 or less are reported and their argument dropped, so they fail like a missing one on
+//   every engine. Stack::pop_n and Stack::rot assert against 0, negatives never had the values anyway.
+// - JMPZ targets PUSHed right before the JMPZ are checked against the program
+//
+// Usage:
+//
+// const auto verified = Verifier::verify(instructions);
+// for (const auto i : verified.missing_arguments)	// Fails whenever it runs
+struct Verifier {
+	using Integer = Stack::Integer;
+	using Opcode = Instruction::Opcode;
+
+	struct Program {
+		Instructions instructions;		// Without stray arguments
+		std::vector<size_t> missing_arguments;	// PUSH, POP and ROT without one
+		std::vector<size_t> bad_arguments;	// POP and ROT of 0 or less, without one now
+		std::vector<size_t> bad_jumps;		// JMPZ whose static target is outside of the program
+		size_t stray_arguments = 0;
+	};
+
+	static constexpr auto takes_argument(const Opcode op) -> bool {
+		return op == Opcode::PUSH or op == Opcode::POP or op == Opcode::ROT;
+	}
+
+	static auto verify(Instructions instructions) -> Program {
+		auto program = Program{};
+
+		for (auto i = size_t{0}; i < instructions.size(); ++i) {
+			auto& instr = instructions[i];
+			if (takes_argument(instr.op) and not instr.arg.has_value()) {
+				std::cerr << "\tWarning: " << i << ' ' << Instruction::name(instr.op) << ": arguments expected\n";
+				program.missing_arguments.push_back(i);
+			}
+			else if ((instr.op == Opcode::POP or instr.op == Opcode::ROT) and *instr.arg <= 0) {
+				std::cerr << "\tWarning: " << i << ' ' << Instruction::name(instr.op) << ": argument " << *instr.arg << " is not positive\n";
+				instr.arg.reset();
+				program.bad_arguments.push_back(i);
+			}
+			else if (not takes_argument(instr.op) and instr.arg.has_value()) {
+				std::cerr << "\tWarning: " << i << ' ' << Instruction::name(instr.op) << ": arguments are not expected\n";
+				instr.arg.reset();
+				++program.stray_arguments;
+			}
+
+			if (instr.op == Opcode::JMPZ and i > 0 and instructions[i - 1].op == Opcode::PUSH and instructions[i - 1].arg.has_value()) {
+				if (const auto target = *instructions[i - 1].arg;
+					target < 0 or static_cast<size_t>(target) >= instructions.size())
+				{
+					std::cerr
+						<< "\tWarning: " << i << " JMPZ: jump to " << target
+						<< " is past end of program " << (instructions.size() - 1) << '\n';
+					program.bad_jumps.push_back(i);
+				}
+			}
+		}
+
+		program.instructions = std::move(instructions);
+		return program;
+	}
+};
@@ -11,6 +11,7 @@ namespace vw = std::ranges::views;
 #include <filesystem>
 namespace fs = std::filesystem;
 #include <numeric>
+#include <functional>
 
 #include "interpreter.hpp"
 
@@ -18,6 +19,69 @@ using namespace std::literals;
 
 constexpr auto RANDOM_CASES = 10'000;
 
+constexpr auto ENGINES = std::array{
+	Interpreter::Engine::Loop,
+	Interpreter::Engine::Threaded,
+	Interpreter::Engine::Tail_Call,
+	Interpreter::Engine::Jit,
+	Interpreter::Engine::Native,
+	Interpreter::Engine::Register,
+	Interpreter::Engine::Stack_Cache,
+	Interpreter::Engine::Block,
+	Interpreter::Engine::Trace,
+	Interpreter::Engine::Quickening,
+	Interpreter::Engine::Tiered,
+};
+
+// What the runs of a program on one interpreter came to, the stack outlives a run
+struct Runs {
+	std::string output;
+	std::vector<Interpreter::Execution_Result> results;
+};
+
+// Runs program runs times on each of engines, every engine with an interpreter of its own that
+// setup gets to configure first. All have to come to what the first one does, errors included.
+auto compare_engines(
+	const std::string& program,
+	const std::string& input,
+	const std::vector<Interpreter::Engine>& engines,
+	const std::function<void(Interpreter&, size_t)>& setup = {},
+	const int runs = 1
+) -> Runs {
+	auto expected = Runs{};
+	for (auto i = size_t{0}; i < engines.size(); ++i) {
+		const auto engine = engines[i];
+		CAPTURE(engine);
+		CAPTURE(i);
+		auto cin = std::istringstream{input};
+		auto cout = std::ostringstream{};
+		auto interpreter = Interpreter{cin, cout};
+		if (setup)
+			setup(interpreter, i);
+		auto program_ss = std::istringstream{program};
+		REQUIRE(interpreter.prepare(program_ss));
+
+		auto results = std::vector<Interpreter::Execution_Result>{};
+		for (auto run = 0; run < runs; ++run) {
+			auto result = Interpreter::Execution_Result{};
+			REQUIRE(interpreter.run([&] (auto&& execution_result) { result = execution_result; }, engine));
+			results.push_back(result);
+		}
+
+		if (i == 0)
+			expected = { cout.str(), std::move(results) };
+		else {
+			CHECK_EQ(cout.str(), expected.output);
+			for (auto run = size_t{0}; run < results.size(); ++run) {
+				CAPTURE(run);
+				CHECK_EQ(results[run].state, expected.results[run].state);
+				CHECK_EQ(results[run].top, expected.results[run].top);
+			}
+		}
+	}
+	return expected;
+}
+
 auto simple_factorial(Interpreter::Integer x) -> Interpreter::Integer {
 	assert(x >= 0);
 	auto result = 1;
@@ -137,28 +201,31 @@ TEST_CASE ("Interpreter") {
 
 	REQUIRE(interpreter.prepare(program));
 
-	// Run Interpreter
-	rs::for_each(test_inputs, [&] (const auto& test_input) {
-		CAPTURE(test_input);
-		cin << test_input.input << ' ';
-		REQUIRE(interpreter.run([&] (auto&& execution_result) {
-			switch (execution_result.state) {
-				case Interpreter::State::Running:
-					return;
-
-				case Interpreter::State::Done: {
-					auto out = Interpreter::Integer{};
-					cout >> out;
-					CHECK_EQ(out, test_input.expected);
-					return;
-				}
+	// Run Interpreter, every engine has to agree with the expected results
+	for (const auto engine : ENGINES) {
+		CAPTURE(engine);
+		rs::for_each(test_inputs, [&] (const auto& test_input) {
+			CAPTURE(test_input);
+			cin << test_input.input << ' ';
+			REQUIRE(interpreter.run([&] (auto&& execution_result) {
+				switch (execution_result.state) {
+					case Interpreter::State::Running:
+						return;
 
-				case Interpreter::State::Error:
-				default:
-					FAIL("Interpreter entered the State::Error");
-			}
-		}));
-	});
+					case Interpreter::State::Done: {
+						auto out = Interpreter::Integer{};
+						cout >> out;
+						CHECK_EQ(out, test_input.expected);
+						return;
+					}
+
+					case Interpreter::State::Error:
+					default:
+						FAIL("Interpreter entered the State::Error");
+				}
+			}, engine));
+		});
+	}
 }
 
 
@@ -169,3 +236,1398 @@ TEST_CASE ("Interpreter Empty Program") {
 	REQUIRE_FALSE(interpreter.run([] (const auto&) { FAIL("Interpreter::run() should not begin running anything"); }));
 }
 
+
+TEST_CASE ("Interpreter Unknown Instruction") {
+	auto program = std::istringstream{"0 PUSH 1\n1 NOP\n2 WRITE\n"};
+	auto interpreter = Interpreter{};
+	REQUIRE_FALSE(interpreter.prepare(program));
+	REQUIRE_FALSE(interpreter.run([] (const auto&) { FAIL("Interpreter::run() should not begin running anything"); }));
+}
+
+TEST_CASE ("Interpreter Errors") {
+	auto program = std::string{};
+
+	auto expected_top = std::optional<Interpreter::Integer>{};
+
+	SUBCASE ("DUP empty stack")		{ program = "0 DUP\n"; }
+	SUBCASE ("ADD single value")		{ program = "0 PUSH 1\n1 ADD\n"; }
+	SUBCASE ("JMPZ past end")		{ program = "0 PUSH 0\n1 PUSH 9\n2 JMPZ\n"; }
+	SUBCASE ("POP more than pushed")	{ program = "0 PUSH 1\n1 POP 2\n"; }
+	SUBCASE ("READ without input")		{ program = "0 READ\n"; }
+	SUBCASE ("PUSH without argument")	{ program = "0 PUSH 1\n1 PUSH\n"; }
+	SUBCASE ("JMPZ single value")		{ program = "0 PUSH 3\n1 PUSH 0\n2 JMPZ\n3 PUSH 1\n4 JMPZ\n"; }
+	SUBCASE ("Fused DUP empty stack")	{ program = "0 DUP\n1 PUSH 0\n2 EQ\n3 PUSH 0\n4 JMPZ\n"; }
+	SUBCASE ("Fused ROT single value")	{ program = "0 PUSH 1\n1 ROT 2\n2 POP 1\n"; }
+	SUBCASE ("POP 4n past 32 bits")		{ program = "0 PUSH 1\n1 POP 1073741824\n2 PUSH 5\n3 WRITE\n"; }
+	SUBCASE ("POP 4n wraps to 4")		{ program = "0 PUSH 1\n1 POP 1073741825\n2 PUSH 5\n3 WRITE\n"; }
+	SUBCASE ("ROT 4n past 32 bits")		{ program = "0 PUSH 1\n1 ROT 1073741824\n2 PUSH 5\n3 WRITE\n"; }
+
+	for (const auto engine : ENGINES) {
+		CAPTURE(engine);
+
+		// The stack survives between runs, so every engine gets a fresh interpreter
+		auto cin = std::istringstream{};
+		auto cout = std::ostringstream{};
+		auto interpreter = Interpreter{cin, cout};
+
+		auto program_ss = std::istringstream{program};
+		REQUIRE(interpreter.prepare(program_ss));
+
+		auto final_result = Interpreter::Execution_Result{};
+		REQUIRE(interpreter.run([&] (auto&& execution_result) {
+			final_result = execution_result;
+		}, engine));
+		CHECK_EQ(final_result.state, Interpreter::State::Error);
+
+		// Whatever the failed instruction left on the stack is the same everywhere
+		if (engine == ENGINES.front())
+			expected_top = final_result.top;
+		else
+			CHECK_EQ(final_result.top, expected_top);
+	}
+}
+
+TEST_CASE ("Interpreter Stack Operations") {
+	constexpr auto program = R"end(
+		0 PUSH 1
+		1 PUSH 2
+		2 PUSH 3
+		3 PUSH 4
+		4 ROT 3		# 1 4 2 3
+		5 ROT 2		# 1 4 3 2
+		6 ROT 1
+		7 DUP		# 1 4 3 2 2
+		8 POP 2		# 1 4 3
+		9 WRITE
+		10 WRITE
+		11 WRITE
+		12 WRITE
+	)end";
+
+	for (const auto engine : ENGINES) {
+		CAPTURE(engine);
+
+		auto cin = std::istringstream{};
+		auto cout = std::ostringstream{};
+		auto interpreter = Interpreter{cin, cout};
+
+		auto program_ss = std::istringstream{program};
+		REQUIRE(interpreter.prepare(program_ss));
+		REQUIRE(interpreter.run([] (auto&&) {}, engine));
+		CHECK_EQ(cout.str(), "3 4 1 null ");
+	}
+}
+
+// Long enough that any engine growing the native stack per instruction would overflow it
+TEST_CASE ("Interpreter Countdown") {
+	constexpr auto program = R"end(
+		0 READ
+		1 PUSH 1
+		2 ROT 2
+		3 SUB
+		4 DUP
+		5 PUSH 0
+		6 EQ
+		7 PUSH 12
+		8 JMPZ
+		9 PUSH 0
+		10 PUSH 1
+		11 JMPZ
+		12 WRITE
+	)end";
+
+	for (const auto engine : ENGINES) {
+		CAPTURE(engine);
+
+		auto cin = std::istringstream{"100000"};
+		auto cout = std::ostringstream{};
+		auto interpreter = Interpreter{cin, cout};
+
+		auto program_ss = std::istringstream{program};
+		REQUIRE(interpreter.prepare(program_ss));
+
+		auto final_state = Interpreter::State::Running;
+		REQUIRE(interpreter.run([&] (auto&& execution_result) {
+			final_state = execution_result.state;
+		}, engine));
+		CHECK_EQ(final_state, Interpreter::State::Done);
+		CHECK_EQ(cout.str(), "0 ");
+	}
+}
+
+TEST_CASE ("Interpreter Superinstructions") {
+	constexpr auto program = R"end(
+		0 PUSH 7
+		1 PUSH 7
+		2 PUSH 0	# JUMP
+		3 PUSH 6
+		4 JMPZ
+		5 DUP		# BRANCH, skipped
+		6 PUSH 7	# Jumped into the middle of it
+		7 EQ
+		8 PUSH 11
+		9 JMPZ
+		10 WRITE
+		11 PUSH 1
+		12 ROT 2	# NIP
+		13 POP 1
+		14 WRITE
+		15 WRITE
+	)end";
+
+	auto program_ss = std::istringstream{program};
+	const auto code = Superinstruction::compile(Interpreter::parse(program_ss));
+	REQUIRE_EQ(code.size(), 16);
+	CHECK_EQ(code[2].kind(), Superinstruction::Kind::JUMP);
+	CHECK_EQ(code[2].target, 6);
+	CHECK_EQ(code[5].kind(), Superinstruction::Kind::BRANCH);
+	CHECK_EQ(code[5].value, 7);
+	CHECK_EQ(code[5].target, 11);
+	CHECK_EQ(code[12].kind(), Superinstruction::Kind::NIP);
+	CHECK_FALSE(code[6].fused());
+	CHECK_FALSE(code[13].fused());
+
+	for (const auto engine : ENGINES) {
+		CAPTURE(engine);
+
+		auto cin = std::istringstream{};
+		auto cout = std::ostringstream{};
+		auto interpreter = Interpreter{cin, cout};
+
+		program_ss = std::istringstream{program};
+		REQUIRE(interpreter.prepare(program_ss));
+		REQUIRE(interpreter.run([] (auto&&) {}, engine));
+		CHECK_EQ(cout.str(), "1 null ");
+	}
+}
+
+TEST_CASE ("Interpreter Fused Operations") {
+	constexpr auto program = R"end(
+		0 PUSH 3
+		1 PUSH 4
+		2 ROT 2		# SWAP_OP
+		3 SUB		# -1
+		4 DUP		# DUP_OP
+		5 MUL		# 1
+		6 PUSH 2	# PUSH_OP
+		7 ADD		# 3
+		8 WRITE
+	)end";
+
+	auto all = Superinstruction::Selection{};
+	all.enabled.fill(true);
+
+	for (const auto engine : ENGINES) {
+		CAPTURE(engine);
+
+		auto cin = std::istringstream{};
+		auto cout = std::ostringstream{};
+		auto interpreter = Interpreter{cin, cout};
+		interpreter.select(all);
+
+		auto program_ss = std::istringstream{program};
+		REQUIRE(interpreter.prepare(program_ss));
+		REQUIRE(interpreter.run([] (auto&&) {}, engine));
+		CHECK_EQ(cout.str(), "3 ");
+	}
+}
+
+TEST_CASE ("Interpreter Profile") {
+	const auto naive_factorial_path = fs::current_path() / "interpreter.naive_factorial.txt";
+	REQUIRE_MESSAGE(fs::exists(naive_factorial_path), naive_factorial_path);
+
+	auto cin = std::stringstream{};
+	auto cout = std::stringstream{};
+	auto interpreter = Interpreter{cin, cout};
+
+	auto program = std::ifstream{naive_factorial_path};
+	REQUIRE(interpreter.prepare(program));
+
+	auto profile = Profile{};
+	for (const auto input : { 5, 10, 12 }) {
+		cin << input << ' ';
+		REQUIRE(interpreter.profile(profile, [] (auto&&) {}));
+	}
+	CHECK_EQ(cout.str(), "120 3628800 479001600 ");
+
+	constexpr auto branch = std::array{
+		Instruction::Opcode::DUP, Instruction::Opcode::PUSH, Instruction::Opcode::EQ, Instruction::Opcode::PUSH, Instruction::Opcode::JMPZ,
+	};
+	CHECK_GT(profile.count(Profile::Gram::pack(branch.begin(), branch.end())), 0);
+	CHECK_EQ(profile.top(1).front().first.length(), 2);	// Every longer gram contains a shorter one
+
+	const auto selection = Superinstruction::Selection::from(profile);
+	CHECK(selection.has(Superinstruction::Kind::BRANCH));
+
+	// What a later prepare() loads
+	auto saved = std::stringstream{};
+	selection.save(saved);
+	const auto loaded = Superinstruction::Selection::load(saved);
+	REQUIRE(loaded.has_value());
+	CHECK_EQ(loaded->enabled, selection.enabled);
+	CHECK_EQ(loaded->saved, selection.saved);
+
+	auto unknown = std::istringstream{"BRANCH 1\nTELEPORT 2\n"};
+	CHECK_FALSE(Superinstruction::Selection::load(unknown).has_value());
+
+	for (const auto engine : ENGINES) {
+		CAPTURE(engine);
+
+		auto engine_cin = std::istringstream{"10"};
+		auto engine_cout = std::ostringstream{};
+		auto trained = Interpreter{engine_cin, engine_cout};
+		trained.select(*loaded);
+
+		program = std::ifstream{naive_factorial_path};
+		REQUIRE(trained.prepare(program));
+		REQUIRE(trained.run([] (auto&&) {}, engine));
+		CHECK_EQ(engine_cout.str(), "3628800 ");
+	}
+}
+
+// Register_VM hands computed jumps back to the stack engines
+TEST_CASE ("Interpreter Computed Jump") {
+	constexpr auto program = R"end(
+		0 READ
+		1 PUSH 0
+		2 ROT 2
+		3 JMPZ
+		4 PUSH 1
+		5 WRITE
+		6 PUSH 2
+		7 WRITE
+	)end";
+
+	for (const auto& [input, expected] : { std::pair{"6", "2 "}, std::pair{"4", "1 2 "} }) {
+		for (const auto engine : ENGINES) {
+			CAPTURE(engine);
+			CAPTURE(input);
+
+			auto cin = std::istringstream{input};
+			auto cout = std::ostringstream{};
+			auto interpreter = Interpreter{cin, cout};
+
+			auto program_ss = std::istringstream{program};
+			REQUIRE(interpreter.prepare(program_ss));
+			REQUIRE(interpreter.run([] (auto&&) {}, engine));
+			CHECK_EQ(cout.str(), expected);
+		}
+	}
+}
+
+TEST_CASE ("Register VM Translation") {
+	const auto naive_factorial_path = fs::current_path() / "interpreter.naive_factorial.txt";
+	REQUIRE_MESSAGE(fs::exists(naive_factorial_path), naive_factorial_path);
+
+	auto program = std::ifstream{naive_factorial_path};
+	const auto instructions = Interpreter::parse(program);
+	const auto code = Register_VM::compile(instructions);
+
+	// DUP, ROT, POP and PUSH are gone, compares and JMPZ became branches
+	CHECK_LT(Register_VM::operations(code), 2 * instructions.size() / 3);
+	CHECK_FALSE(rs::any_of(code, [] (const auto& op) { return op.kind == Register_VM::Kind::BAIL; }));
+	CHECK(rs::any_of(code, [] (const auto& op) { return op.kind == Register_VM::Kind::BRANCH_EQ; }));
+}
+
+TEST_CASE ("Native Cache") {
+	// Anyone else could plant a shared object in there
+	const auto cache = fs::temp_directory_path() / ("sage-native-test-" + std::to_string(std::rand()));
+	fs::create_directories(cache);
+	fs::permissions(cache, fs::perms::all);
+
+	auto program_ss = std::istringstream{"0 PUSH 1\n1 WRITE\n"};
+	CHECK_FALSE(Native::compile(Interpreter::parse(program_ss), { .cache = cache }));
+	CHECK(fs::is_empty(cache));
+	fs::remove_all(cache);
+
+	// No shell gets to see the paths
+	const auto quoted = fs::temp_directory_path() / ("sage-native-test-it's'; touch pwned; '" + std::to_string(std::rand()));
+	program_ss = std::istringstream{"0 PUSH 1\n1 WRITE\n"};
+	CHECK(Native::compile(Interpreter::parse(program_ss), { .cache = quoted }));
+	CHECK_FALSE(fs::exists("pwned"));
+	fs::remove_all(quoted);
+}
+
+TEST_CASE ("Stack Depth") {
+	const auto analyze = [] (const std::string& program) {
+		auto program_ss = std::istringstream{program};
+		const auto instructions = Interpreter::parse(program_ss);
+		return Stack_Depth::analyze(instructions);
+	};
+
+	SUBCASE ("Straight line") {
+		const auto depth = analyze("0 PUSH 1\n1 READ\n2 ADD\n3 ADD\n4 WRITE\n");
+		CHECK_EQ(depth.minimum[2], 2);
+		CHECK(depth.safe(2));
+		CHECK_FALSE(depth.safe(3));	// Only if something was left on the stack by a previous run
+		CHECK_FALSE(depth.proven());
+	}
+
+	SUBCASE ("Branches join at their lowest") {
+		const auto depth = analyze(R"end(
+			0 READ
+			1 DUP
+			2 PUSH 0
+			3 PUSH 6
+			4 JMPZ
+			5 DUP
+			6 ROT 2
+			7 WRITE
+		)end");
+		CHECK_EQ(depth.minimum[6], 2);
+		CHECK(depth.proven());
+		CHECK_FALSE(depth.dynamic);
+	}
+
+	SUBCASE ("Past what always fails") {
+		const auto depth = analyze("0 PUSH 1\n1 POP 0\n2 WRITE\n");
+		CHECK(depth.reachable(1));
+		CHECK_FALSE(depth.safe(1));
+		CHECK_FALSE(depth.reachable(2));
+	}
+
+	SUBCASE ("Computed jumps go anywhere") {
+		const auto depth = analyze("0 PUSH 1\n1 PUSH 0\n2 READ\n3 JMPZ\n4 PUSH 1\n5 DUP\n");
+		CHECK(depth.dynamic);
+		CHECK_EQ(depth.minimum[5], 0);
+		CHECK_FALSE(depth.safe(5));
+	}
+
+	SUBCASE ("Naive Factorial") {
+		const auto naive_factorial_path = fs::current_path() / "interpreter.naive_factorial.txt";
+		REQUIRE_MESSAGE(fs::exists(naive_factorial_path), naive_factorial_path);
+
+		auto program = std::ifstream{naive_factorial_path};
+		const auto instructions = Interpreter::parse(program);
+		const auto depth = Stack_Depth::analyze(instructions);
+
+		// The multiply loop runs until it finds the 0 it left at the bottom, nothing static can know that
+		CHECK_FALSE(depth.proven());
+		CHECK_FALSE(depth.safe(34));
+		CHECK_GT(rs::count_if(vw::iota(size_t{0}, instructions.size()), [&] (const auto i) { return depth.safe(i); }), 40);
+	}
+}
+
+TEST_CASE ("Control Flow") {
+	const auto build = [] (const std::string& program) {
+		auto program_ss = std::istringstream{program};
+		return Control_Flow::build(Interpreter::parse(program_ss));
+	};
+	const auto successors = [] (const Control_Flow& control_flow, const size_t b) {
+		return control_flow.blocks[b].successors;
+	};
+	const auto predecessors = [] (const Control_Flow& control_flow, const size_t b) {
+		return control_flow.blocks[b].predecessors;
+	};
+	using Blocks = std::vector<size_t>;
+
+	SUBCASE ("Straight line") {
+		const auto control_flow = build("0 READ\n1 DUP\n2 MUL\n3 WRITE\n");
+		REQUIRE_EQ(control_flow.blocks.size(), 1);
+		CHECK_EQ(control_flow.blocks[0].end, 4);
+		CHECK(successors(control_flow, 0).empty());
+	}
+
+	SUBCASE ("Loop") {
+		// 0-3 counts down to 4-8, which goes back to 4 until 0
+		const auto control_flow = build(R"end(
+			0 READ
+			1 PUSH 0
+			2 PUSH 4
+			3 JMPZ
+			4 PUSH 1
+			5 SUB
+			6 DUP
+			7 PUSH 4
+			8 JMPZ
+			9 WRITE
+		)end");
+		REQUIRE_EQ(control_flow.blocks.size(), 3);
+		CHECK_EQ(control_flow.block_of, std::vector<size_t>{ 0, 0, 0, 0, 1, 1, 1, 1, 1, 2 });
+		CHECK_EQ(successors(control_flow, 0), Blocks{ 1 });	// Both ways
+		CHECK_EQ(successors(control_flow, 1), Blocks{ 2, 1 });
+		CHECK_EQ(predecessors(control_flow, 1), Blocks{ 0, 1 });
+		CHECK_EQ(predecessors(control_flow, 2), Blocks{ 1 });
+		CHECK_FALSE(control_flow.dynamic);
+	}
+
+	SUBCASE ("Jumps out of the program") {
+		const auto control_flow = build("0 PUSH 0\n1 PUSH 9\n2 JMPZ\n");
+		REQUIRE_EQ(control_flow.blocks.size(), 1);
+		CHECK(successors(control_flow, 0).empty());
+	}
+
+	SUBCASE ("Computed jumps") {
+		const auto control_flow = build("0 PUSH 0\n1 READ\n2 JMPZ\n3 WRITE\n");
+		CHECK(control_flow.dynamic);
+		REQUIRE_EQ(control_flow.blocks.size(), 4);
+		CHECK(control_flow.blocks[2].computed);
+		CHECK_EQ(successors(control_flow, 2), Blocks{ 3 });
+	}
+
+	SUBCASE ("Naive Factorial") {
+		auto program = std::ifstream{fs::current_path() / "interpreter.naive_factorial.txt"};
+		const auto instructions = Interpreter::parse(program);
+		const auto control_flow = Control_Flow::build(instructions);
+		CHECK_FALSE(control_flow.dynamic);
+
+		auto begins = Blocks{};
+		for (const auto& block : control_flow.blocks) {
+			begins.push_back(block.begin);
+			for (auto i = block.begin; i + 1 < block.end; ++i)
+				CHECK_NE(instructions[i].op, Interpreter::Opcode::JMPZ);
+		}
+		CHECK_EQ(begins, Blocks{ 0, 9, 14, 19, 21, 30, 33, 40, 43, 44, 45 });
+		CHECK_EQ(successors(control_flow, control_flow.block_of[42]), Blocks{ control_flow.block_of[43], control_flow.block_of[33] });
+	}
+}
+
+TEST_CASE ("Trace") {
+	SUBCASE ("Compile") {
+		auto program = std::istringstream{"0 READ\n1 PUSH 1\n2 ROT 2\n3 SUB\n4 DUP\n5 PUSH 0\n6 EQ\n7 PUSH 12\n8 JMPZ\n9 PUSH 0\n10 PUSH 1\n11 JMPZ\n12 WRITE\n"};
+		const auto instructions = Interpreter::parse(program);
+
+		auto recorder = Trace::Recorder{ 1, {} };
+		for (auto pc = size_t{1}; pc < 12; ++pc)
+			REQUIRE_EQ(recorder.record(pc), Trace::Recorder::Status::Recording);
+		REQUIRE_EQ(recorder.record(1), Trace::Recorder::Status::Closed);
+
+		const auto trace = Trace::compile(instructions, recorder);
+		REQUIRE(trace.has_value());
+		auto kinds = std::vector<Trace::Kind>{};
+		for (const auto& op : trace->ops)
+			kinds.push_back(op.kind);
+		using enum Trace::Kind;
+		CHECK_EQ(kinds, std::vector{ OP_PUSHED, DUP, PUSH_OP, GUARD_NONZERO });	// The constants are all immediates
+		CHECK_EQ(trace->points[trace->ops[3].point].pc, 12);
+		CHECK_EQ(trace->needs, 1);
+	}
+
+	// Whatever leaves the loop, the rest of the run has to go like it does on Engine::Loop
+	const auto compare = [] (const std::string& program, const std::string& input) {
+		return compare_engines(program, input, { Interpreter::Engine::Loop, Interpreter::Engine::Trace }).results.front().state;
+	};
+
+	SUBCASE ("Guards") {
+		// Counts down from 200, writing only from 50 on
+		const auto program = R"end(
+			0 READ
+			1 DUP
+			2 PUSH 50
+			3 ROT 2
+			4 GT
+			5 PUSH 9
+			6 JMPZ
+			7 DUP
+			8 WRITE
+			9 PUSH 1
+			10 ROT 2
+			11 SUB
+			12 DUP
+			13 PUSH 0
+			14 EQ
+			15 PUSH 20
+			16 JMPZ
+			17 PUSH 0
+			18 PUSH 1
+			19 JMPZ
+			20 WRITE
+		)end";
+		CHECK_EQ(compare(program, "200"), Interpreter::State::Done);
+	}
+
+	SUBCASE ("Constants put back") {
+		// Counts down with a 7 kept below the count that only the exit WRITEs
+		const auto program = R"end(
+			0 READ
+			1 PUSH 7
+			2 ROT 2
+			3 DUP
+			4 PUSH 0
+			5 EQ
+			6 PUSH 16
+			7 JMPZ
+			8 PUSH 1
+			9 ROT 2
+			10 SUB
+			11 ROT 2
+			12 POP 1
+			13 PUSH 0
+			14 PUSH 1
+			15 JMPZ
+			16 WRITE
+			17 WRITE
+		)end";
+		CHECK_EQ(compare(program, "200"), Interpreter::State::Done);
+		CHECK_EQ(compare(std::string{program} + "18 READ\n", "200"), Interpreter::State::Error);
+	}
+
+	SUBCASE ("Not enough values") {
+		// Pushes 100 down to 0, then adds them up until ADD runs out of values
+		const auto program = R"end(
+			0 PUSH 100
+			1 DUP
+			2 PUSH 1
+			3 ROT 2
+			4 SUB
+			5 DUP
+			6 PUSH 0
+			7 EQ
+			8 PUSH 13
+			9 JMPZ
+			10 PUSH 0
+			11 PUSH 1
+			12 JMPZ
+			13 ADD
+			14 DUP
+			15 WRITE
+			16 PUSH 0
+			17 PUSH 13
+			18 JMPZ
+		)end";
+		CHECK_EQ(compare(program, ""), Interpreter::State::Error);
+	}
+
+	SUBCASE ("Nothing left to read") {
+		auto input = std::string{};
+		for (auto i = 0; i < 200; ++i)
+			input += std::to_string(i) + ' ';
+		CHECK_EQ(compare("0 READ\n1 WRITE\n2 PUSH 0\n3 PUSH 0\n4 JMPZ\n", input), Interpreter::State::Error);
+	}
+}
+
+TEST_CASE ("Deoptimization") {
+	using Slot = Deoptimization::Slot;
+	const auto value = Slot{ false, 0 };
+
+	auto stack = Stack::Vector{ 1, 2, 3 };
+	Deoptimization::materialize({ value, Slot{ true, 7 }, value, Slot{ true, 8 } }, stack);
+	CHECK_EQ(stack, Stack::Vector{ 1, 2, 7, 3, 8 });
+
+	const auto exit = Deoptimization::resume({ 4, { Slot{ true, 5 }, Slot{ true, 6 } } }, stack);
+	CHECK_EQ(exit.state, Interpreter::State::Running);
+	CHECK_EQ(exit.pc, 4);
+	CHECK_EQ(stack, Stack::Vector{ 1, 2, 7, 3, 8, 5, 6 });
+
+	Deoptimization::resume({ 0, { value, value } }, stack);
+	CHECK_EQ(stack.size(), 7);
+}
+
+TEST_CASE ("Loop Idioms") {
+	const auto naive_factorial_path = fs::current_path() / "interpreter.naive_factorial.txt";
+	REQUIRE_MESSAGE(fs::exists(naive_factorial_path), naive_factorial_path);
+
+	// Runs with and without kernels have to be the same, errors included
+	const auto compare = [] (const std::string& program, const std::string& input) {
+		const auto idioms = [] (Interpreter& interpreter, const size_t i) { interpreter.idioms(i != 0); };
+		compare_engines(program, input, { Interpreter::Engine::Loop, Interpreter::Engine::Loop, Interpreter::Engine::Threaded }, idioms);
+	};
+
+	SUBCASE ("Naive Factorial") {
+		auto program = std::ifstream{naive_factorial_path};
+		const auto kernels = Loop_Idiom::recognize(Interpreter::parse(program));
+		for (auto i = size_t{0}; i < kernels.size(); ++i) {
+			CAPTURE(i);
+			CHECK_EQ(kernels[i].has_value(), i == 21 or i == 33);
+		}
+		CHECK_EQ(kernels[21]->kind, Loop_Idiom::Kind::COUNT);
+		CHECK_EQ(kernels[21]->end, 1);
+		CHECK_EQ(kernels[21]->exit, 33);
+		CHECK_EQ(kernels[33]->kind, Loop_Idiom::Kind::FOLD);
+		CHECK_EQ(kernels[33]->operation, Interpreter::Opcode::MUL);
+		CHECK_EQ(kernels[33]->exit, 44);
+
+		program = std::ifstream{naive_factorial_path};
+		const auto text = std::string{std::istreambuf_iterator<char>{program}, {}};
+		for (const auto input : { -3, 0, 1, 2, 3, 5, 10, 12 }) {
+			CAPTURE(input);
+			compare(text, std::to_string(input));
+		}
+	}
+
+	SUBCASE ("Wraps around") {
+		auto cin = std::istringstream{"20"};
+		auto cout = std::ostringstream{};
+		auto interpreter = Interpreter{cin, cout};
+		auto program = std::ifstream{naive_factorial_path};
+		REQUIRE(interpreter.prepare(program));
+		REQUIRE(interpreter.run([] (auto&&) {}, Interpreter::Engine::Threaded));
+
+		auto expected = uint32_t{1};
+		for (auto i = uint32_t{2}; i <= 20; ++i)
+			expected *= i;
+		CHECK_EQ(cout.str(), std::to_string(static_cast<Interpreter::Integer>(expected)) + ' ');
+	}
+
+	SUBCASE ("Random") {
+		std::srand(18);
+		const auto random = [] (const int n) { return std::rand() % n; };
+
+		for (auto p = 0; p < 500; ++p) {
+			// Some values, maybe a 0 among them, then a loop that exits onto enough WRITEs to see the stack
+			auto program = std::ostringstream{};
+			auto i = 0;
+			for (auto n = random(7); n > 0; --n)
+				program << i++ << " PUSH " << (random(4) == 0 ? 0 : random(9) - 3) << '\n';
+
+			const auto h = i;
+			if (random(2) == 0) {
+				const auto up = random(2) == 0;
+				const auto end = random(9) - 4;
+				program << i++ << " PUSH " << (up ? end - 1 - random(30) : end + 1 + random(30)) << '\n';
+				const auto loop = i;
+				for (const auto* instr : { "DUP", "PUSH 1", "ROT 2", up ? "ADD" : "SUB", "DUP" })
+					program << i++ << ' ' << instr << '\n';
+				program << i++ << " PUSH " << end << '\n';
+				program << i++ << " EQ\n";
+				program << i++ << " PUSH " << loop + 12 << '\n';
+				program << i++ << " JMPZ\n";
+				program << i++ << " PUSH 0\n";
+				program << i++ << " PUSH " << loop << '\n';
+				program << i++ << " JMPZ\n";
+			}
+			else {
+				program << i++ << (random(2) == 0 ? " MUL" : " ADD") << '\n';
+				for (const auto* instr : { "ROT 2", "DUP", "PUSH 0", "EQ" })
+					program << i++ << ' ' << instr << '\n';
+				program << i++ << " PUSH " << h + 10 << '\n';
+				program << i++ << " JMPZ\n";
+				program << i++ << " PUSH 0\n";
+				program << i++ << " PUSH " << h << '\n';
+				program << i++ << " JMPZ\n";
+			}
+			for (auto n = 0; n < 40; ++n)
+				program << i++ << " WRITE\n";
+
+			CAPTURE(program.str());
+			compare(program.str(), "");
+		}
+	}
+}
+
+TEST_CASE ("Partial Evaluation") {
+	const auto parse = [] (const std::string& program) {
+		auto program_ss = std::istringstream{program};
+		return Interpreter::parse(program_ss);
+	};
+	const auto run = [] (const Interpreter::Instructions& instructions, const std::string& input, std::string& output) {
+		auto cin = std::istringstream{input};
+		auto cout = std::ostringstream{};
+		auto interpreter = Interpreter{cin, cout};
+		REQUIRE(interpreter.prepare(instructions));
+
+		auto result = Interpreter::Execution_Result{};
+		REQUIRE(interpreter.run([&] (auto&& execution_result) { result = execution_result; }));
+		output = cout.str();
+		return result;
+	};
+	// The residual program on whatever input is left has to do what the program does on all of it
+	const auto compare = [&] (const std::string& program, const std::vector<Interpreter::Integer>& prefix, const std::string& data) {
+		const auto instructions = parse(program);
+		const auto residual = Partial_Evaluation::specialize(instructions, prefix);
+
+		auto input = std::string{};
+		for (const auto value : prefix)
+			input += std::to_string(value) + ' ';
+		auto rest = std::string{};
+		for (auto i = residual.consumed; i < prefix.size(); ++i)
+			rest += std::to_string(prefix[i]) + ' ';
+
+		auto expected_output = std::string{};
+		auto output = std::string{};
+		const auto expected = run(instructions, input + data, expected_output);
+		const auto result = run(residual.instructions, rest + data, output);
+		CHECK_EQ(output, expected_output);
+		CHECK_EQ(result.state, expected.state);
+		CHECK_EQ(result.top, expected.top);
+		return residual;
+	};
+
+	// Writes twice the first value, then every value after it times the first one until a 0
+	const auto scale = R"end(
+		0 READ
+		1 DUP
+		2 PUSH 2
+		3 MUL
+		4 WRITE
+		5 READ
+		6 DUP
+		7 PUSH 0
+		8 EQ
+		9 PUSH 19
+		10 JMPZ
+		11 ROT 2
+		12 DUP
+		13 ROT 3
+		14 MUL
+		15 WRITE
+		16 PUSH 0
+		17 PUSH 5
+		18 JMPZ
+		19 WRITE
+	)end";
+
+	SUBCASE ("Setup") {
+		const auto residual = compare(scale, { 3 }, "4 5 0");
+		CHECK_EQ(residual.consumed, 1);
+		CHECK_EQ(residual.instructions.size(), 6 + 15);	// Writes 6, pushes 3, jumps to 5
+	}
+
+	SUBCASE ("Into the loop") {
+		CHECK_EQ(compare(scale, { 3, 4, 5 }, "6 0").consumed, 3);
+		CHECK_EQ(compare(scale, { 3, 4, 0 }, "").consumed, 3);
+		CHECK_EQ(compare(scale, { 3, 0, 7 }, "").consumed, 2);
+	}
+
+	SUBCASE ("Nothing known") {
+		const auto instructions = parse(scale);
+		const auto residual = compare(scale, {}, "3 4 0");
+		CHECK_EQ(residual.consumed, 0);
+		CHECK_EQ(residual.instructions, instructions);
+
+		CHECK_EQ(compare("0 ADD\n1 WRITE\n", { 1 }, "").consumed, 0);
+	}
+
+	SUBCASE ("Errors") {
+		compare("0 READ\n1 POP 2\n", { 3 }, "");
+		compare("0 READ\n1 PUSH 9\n2 JMPZ\n", { 0 }, "");
+		compare("0 READ\n1 READ\n2 ADD\n", { 1 }, "");
+	}
+
+	SUBCASE ("Naive Factorial") {
+		auto program = std::ifstream{fs::current_path() / "interpreter.naive_factorial.txt"};
+		const auto text = std::string{std::istreambuf_iterator<char>{program}, {}};
+		for (const auto input : { -3, 0, 1, 5, 10 }) {
+			CAPTURE(input);
+			const auto residual = compare(text, { input }, "");
+			CHECK(rs::none_of(residual.instructions, [] (const auto& instr) { return instr.op == Interpreter::Opcode::JMPZ; }));	// Just writes and pushes
+		}
+	}
+}
+
+TEST_CASE ("Snapshot") {
+	SUBCASE ("Before the first READ") {
+		auto program = std::istringstream{"0 PUSH 2\n1 DUP\n2 MUL\n3 DUP\n4 WRITE\n5 PUSH 1\n6 ADD\n7 READ\n8 WRITE\n"};
+		const auto known = Partial_Evaluation::evaluate(Interpreter::parse(program));
+		CHECK_EQ(known.pc, 7);
+		CHECK_EQ(known.stack, std::vector<Interpreter::Integer>{ 5 });
+		CHECK_EQ(known.output, std::vector<Interpreter::Integer>{ 4 });
+	}
+
+	// The stack outlives a run, so the same interpreter has to come to the same results run after run
+	const auto compare = [] (const std::string& program, const std::string& input, const int runs) {
+		compare_engines(program, input, { Interpreter::Engine::Loop, Interpreter::Engine::Threaded, Interpreter::Engine::Block, Interpreter::Engine::Trace }, {}, runs);
+	};
+
+	SUBCASE ("Naive Factorial") {
+		auto program = std::ifstream{fs::current_path() / "interpreter.naive_factorial.txt"};
+		compare(std::string{std::istreambuf_iterator<char>{program}, {}}, "5 0 1 -3 10 3", 6);
+	}
+
+	SUBCASE ("Left over from the last run") {
+		compare("0 PUSH 1\n1 WRITE\n2 PUSH 3\n3 ADD\n4 DUP\n5 WRITE\n6 READ\n7 POP 1\n", "1 2 3", 4);
+	}
+
+	SUBCASE ("Never READs") {
+		compare("0 PUSH 7\n1 DUP\n2 WRITE\n", "", 3);
+	}
+}
+
+TEST_CASE ("Quickening") {
+	using Kind = Quickening::Kind;
+	const auto kind = [] (const Quickening::Op& op) { return op.kind; };
+	const auto is = [] (const Kind k) { return static_cast<uint8_t>(k); };
+
+	auto program = std::istringstream{"0 READ\n1 PUSH 5\n2 ROT 2\n3 PUSH 0\n4 PUSH 7\n5 JMPZ\n6 WRITE\n7 POP 1\n8 WRITE\n9 ROT 3\n"};
+	const auto instructions = Interpreter::parse(program);
+	const auto fresh = Quickening::compile(instructions);
+
+	const auto run = [&] (Quickening::Code& code, const std::string& input, std::string& output) {
+		auto cin = std::istringstream{input};
+		auto cout = std::ostringstream{};
+		auto stack = Stack{};
+		const auto exit = Quickening::run(code, Machine{instructions, stack, cin, cout});
+		output = cout.str();
+		return exit;
+	};
+
+	auto code = fresh;
+	auto output = std::string{};
+	auto exit = run(code, "3", output);
+	CHECK_EQ(exit.state, Interpreter::State::Error);	// ROT 3 with only one value left
+	CHECK_EQ(exit.pc, 10);
+	CHECK_EQ(output, "5 ");
+	CHECK_EQ(kind(code[2]), is(Kind::SWAP));
+	CHECK_EQ(kind(code[3]), static_cast<uint8_t>(Interpreter::Opcode::PUSH));
+	CHECK_EQ(kind(code[4]), is(Kind::BRANCH));
+	CHECK_EQ(kind(code[5]), static_cast<uint8_t>(Interpreter::Opcode::JMPZ));	// Skipped by the BRANCH
+	CHECK_EQ(kind(code[6]), static_cast<uint8_t>(Interpreter::Opcode::WRITE));	// Never ran
+	CHECK_EQ(kind(code[7]), is(Kind::DROP));
+	CHECK_EQ(kind(code[9]), static_cast<uint8_t>(Interpreter::Opcode::ROT));	// Failed, so it is still generic
+
+	// Quickened or not, it runs the same
+	auto again = std::string{};
+	const auto second = run(code, "3", again);
+	CHECK_EQ(second.state, exit.state);
+	CHECK_EQ(second.pc, exit.pc);
+	CHECK_EQ(again, output);
+
+	CHECK_EQ(kind(fresh[2]), static_cast<uint8_t>(Interpreter::Opcode::ROT));	// Only the copy was rewritten
+}
+
+TEST_CASE ("Tiering") {
+	SUBCASE ("Thresholds") {
+		auto tiering = Tiering{4};
+		for (auto run = uint32_t{1}; run < Tiering::frequent; ++run)
+			CHECK_EQ(tiering.start(), Tiering::Tier::Baseline);
+		CHECK_EQ(tiering.start(), Tiering::Tier::Optimized);
+
+		for (auto jump = uint32_t{1}; jump < Tiering::warm; ++jump)
+			CHECK_EQ(tiering.back_edge(1), Tiering::Tier::Baseline);
+		CHECK_EQ(tiering.back_edge(1), Tiering::Tier::Optimized);
+		CHECK_EQ(tiering.back_edge(1), Tiering::Tier::Optimized);	// Stays warm in the next run
+		CHECK_EQ(tiering.back_edge(2), Tiering::Tier::Baseline);
+
+		tiering.promote();
+		CHECK_EQ(tiering.start(), Tiering::Tier::Native);
+	}
+
+	// Runs until every tier has had its turn, the results have to be the same as those of Loop
+	const auto compare = [] (const std::string& program, const std::string& input, const int runs) {
+		compare_engines(program, input, { Interpreter::Engine::Loop, Interpreter::Engine::Tiered }, {}, runs);
+	};
+
+	// Counts down from whatever it READs and WRITEs what it got to
+	const auto count_down = std::string{R"end(
+		0 READ
+		1 DUP
+		2 PUSH 0
+		3 EQ
+		4 PUSH 12
+		5 JMPZ
+		6 PUSH 1
+		7 ROT 2
+		8 SUB
+		9 PUSH 0
+		10 PUSH 1
+		11 JMPZ
+		12 WRITE
+	)end"};
+
+	SUBCASE ("On-stack replacement") {
+		compare(count_down, "100000", 1);
+		compare(count_down, "3 70 5000 0 100000", 5);
+	}
+
+	SUBCASE ("Many short runs") {
+		compare(count_down, "3 1 0 2 5 4 1 0 7 3 2 9 1 0 6 3 2 4 1 1 8 0", 22);
+	}
+
+	SUBCASE ("Errors in every tier") {
+		compare(count_down + "13 POP 2\n", "10 100 10000 1000000", 5);
+		compare(count_down + "13 READ\n", "100000 x", 2);
+		compare(count_down + "13 PUSH 0\n14 PUSH 99\n15 JMPZ\n", "100000", 1);
+	}
+}
+
+TEST_CASE ("Value Range") {
+	const auto analyze = [] (const std::string& program, const Value_Range::Interval input = {}) {
+		auto program_ss = std::istringstream{program};
+		return Value_Range::analyze(Interpreter::parse(program_ss), input);
+	};
+
+	// Squares whatever it READs until a 0
+	const auto squares = std::string{R"end(
+		0 READ
+		1 DUP
+		2 PUSH 0
+		3 EQ
+		4 PUSH 12
+		5 JMPZ
+		6 DUP
+		7 MUL
+		8 WRITE
+		9 PUSH 0
+		10 PUSH 0
+		11 JMPZ
+		12 WRITE
+	)end"};
+
+	SUBCASE ("Declared input") {
+		CHECK(analyze(squares, { -1000, 1000 }).proven(7));
+		CHECK(analyze(squares, { -46340, 46340 }).proven(7));
+		CHECK_FALSE(analyze(squares, { -46341, 46340 }).proven(7));
+		CHECK_FALSE(analyze(squares).proven(7));
+
+		const auto ranges = analyze("0 PUSH 7\n1 READ\n2 ADD\n3 PUSH 3\n4 ROT 2\n5 SUB\n", { 0, 10 });
+		CHECK(ranges.proven(2));
+		CHECK(ranges.proven(5));
+		CHECK_EQ(ranges.values[5]->back().lo, 7);
+		CHECK_EQ(ranges.values[5]->back().hi, 17);
+	}
+
+	SUBCASE ("Unknown") {
+		CHECK_FALSE(analyze("0 PUSH 1\n1 ADD\n", { 0, 0 }).proven(1));	// Whatever was left on the stack
+		CHECK(analyze("0 PUSH 1\n1 DUP\n2 ADD\n3 PUSH 5\n4 PUSH 0\n5 JMPZ\n", { 0, 0 }).proven(2));
+
+		// Adds up what it READs, the sum grows until it is widened to anything
+		const auto sum = "0 PUSH 0\n1 READ\n2 ADD\n3 PUSH 0\n4 PUSH 1\n5 JMPZ\n";
+		CHECK_FALSE(analyze(sum, { 0, 10 }).proven(2));
+
+		// Computed jumps could go anywhere
+		CHECK_FALSE(analyze("0 PUSH 1\n1 PUSH 1\n2 ADD\n3 PUSH 0\n4 ROT 2\n5 JMPZ\n").proven(2));
+	}
+
+	SUBCASE ("Deep POP and ROT") {
+		// Nothing is known that far down, how deep it goes costs nothing
+		const auto pop = analyze("0 PUSH 1\n1 POP 1073741824\n2 PUSH 5\n3 WRITE\n");
+		CHECK(pop.values[2]->empty());
+		const auto rot = analyze("0 PUSH 3\n1 PUSH 1\n2 ROT 2147483647\n3 PUSH 2\n4 ADD\n", { 0, 0 });
+		REQUIRE_EQ(rot.values[3]->size(), 1);
+		CHECK_EQ(rot.values[3]->back(), Value_Range::Interval{ 3, 3 });
+
+		auto cin = std::istringstream{};
+		auto cout = std::ostringstream{};
+		auto interpreter = Interpreter{cin, cout};
+		auto program_ss = std::istringstream{"0 PUSH 1\n1 POP 1073741824\n2 PUSH 5\n3 WRITE\n"};
+		REQUIRE(interpreter.prepare(program_ss));
+		auto result = Interpreter::Execution_Result{};
+		REQUIRE(interpreter.run([&] (auto&& execution_result) { result = execution_result; }));
+		CHECK_EQ(result.state, Interpreter::State::Error);
+	}
+
+	SUBCASE ("Unreachable") {
+		const auto ranges = analyze("0 PUSH 0\n1 PUSH 4\n2 JMPZ\n3 MUL\n4 PUSH 1\n");
+		CHECK_FALSE(ranges.values[3].has_value());
+		CHECK(ranges.proven(3));
+	}
+
+	SUBCASE ("Run") {
+		for (const auto engine : ENGINES) {
+			CAPTURE(engine);
+			auto cin = std::istringstream{"3 -1000 12 0 2000"};
+			auto cout = std::ostringstream{};
+			auto interpreter = Interpreter{cin, cout};
+			interpreter.inputs({ -1000, 1000 });
+			auto program_ss = std::istringstream{squares};
+			REQUIRE(interpreter.prepare(program_ss));
+			CHECK(interpreter.value_range().proven(7));
+
+			auto result = Interpreter::Execution_Result{};
+			REQUIRE(interpreter.run([&] (auto&& execution_result) { result = execution_result; }, engine));
+			CHECK_EQ(result.state, Interpreter::State::Done);
+			CHECK_EQ(cout.str(), "9 1000000 144 0 ");
+
+			// Past what it was declared to READ
+			REQUIRE(interpreter.run([&] (auto&& execution_result) { result = execution_result; }, engine));
+			CHECK_EQ(result.state, Interpreter::State::Error);
+		}
+
+		// However hot the loop got before
+		auto input = std::ostringstream{};
+		for (auto i = 0; i < 200; ++i)
+			input << i % 11 << ' ';
+		input << 500;
+		const auto declared = [] (Interpreter& interpreter, size_t) { interpreter.inputs({ 0, 10 }); };
+		const auto runs = compare_engines("0 READ\n1 WRITE\n2 PUSH 0\n3 PUSH 0\n4 JMPZ\n", input.str(), { ENGINES.begin(), ENGINES.end() }, declared);
+		CHECK_EQ(runs.results.front().state, Interpreter::State::Error);
+		CHECK_EQ(runs.output.size(), input.str().size() - 3);
+	}
+}
+
+TEST_CASE ("Checked Arithmetic") {
+	constexpr auto max = std::numeric_limits<Interpreter::Integer>::max();
+	constexpr auto min = std::numeric_limits<Interpreter::Integer>::min();
+
+	SUBCASE ("Stack") {
+		auto stack = Stack{};
+		stack.push(1);
+		stack.push(max);
+		CHECK_FALSE(stack.add<true, Stack::Overflow::Error>());
+		CHECK_EQ(stack.top(), max);	// Both still there
+		CHECK(stack.sub<true, Stack::Overflow::Error>());
+		CHECK_EQ(stack.top(), max - 1);
+		CHECK_FALSE(stack.mul<true, Stack::Overflow::Error>());	// Only one left
+
+		stack.push(min);
+		CHECK_FALSE(stack.sub<false, Stack::Overflow::Error>());
+		CHECK_FALSE(stack.mul<false, Stack::Overflow::Error>());
+		stack.push(1);
+		CHECK(stack.add<false, Stack::Overflow::Error>());
+		CHECK_EQ(stack.top(), min + 1);
+
+		CHECK_EQ(Instruction::evaluate_exact(Instruction::Opcode::MUL, 46341, 46341), std::nullopt);
+		CHECK_EQ(Instruction::evaluate_exact(Instruction::Opcode::MUL, 46340, 46340), 46340 * 46340);
+		CHECK_EQ(Instruction::evaluate_exact(Instruction::Opcode::EQ, max, max), 0);
+	}
+
+	SUBCASE ("Peephole") {
+		const auto optimize = [] (const std::string& program, const Peephole::Level level) {
+			auto program_ss = std::istringstream{program};
+			return Peephole::optimize(Interpreter::parse(program_ss), level, Stack::Overflow::Error);
+		};
+		using Opcode = Instruction::Opcode;
+
+		CHECK_EQ(optimize("0 PUSH 3\n1 PUSH 2\n2 MUL\n3 WRITE\n", Peephole::Level::Fold), Instructions{ { Opcode::PUSH, 6 }, { Opcode::WRITE, std::nullopt } });
+		CHECK_EQ(optimize("0 PUSH 2147483647\n1 PUSH 2\n2 MUL\n3 WRITE\n", Peephole::Level::Fold).size(), 4);
+		CHECK_EQ(optimize("0 READ\n1 READ\n2 MUL\n3 POP 1\n", Peephole::Level::Basic).size(), 4);
+		CHECK_EQ(optimize("0 READ\n1 READ\n2 EQ\n3 POP 1\n", Peephole::Level::Basic).size(), 3);
+	}
+
+	SUBCASE ("Specialize") {
+		auto cin = std::istringstream{};
+		auto cout = std::ostringstream{};
+		auto interpreter = Interpreter{cin, cout};
+		interpreter.arithmetic(Stack::Overflow::Error);
+		auto program_ss = std::istringstream{"0 READ\n1 READ\n2 MUL\n3 WRITE\n"};
+		REQUIRE(interpreter.prepare(program_ss));
+
+		// Stops right before the MUL that fails
+		const auto residual = interpreter.specialize({ 2, 2147483647 });
+		CHECK_EQ(residual.consumed, 2);
+		CHECK(rs::any_of(residual.instructions, [] (const auto& instr) { return instr.op == Instruction::Opcode::MUL; }));
+		REQUIRE(interpreter.prepare(residual.instructions));
+		auto result = Interpreter::Execution_Result{};
+		REQUIRE(interpreter.run([&] (auto&& execution_result) { result = execution_result; }));
+		CHECK_EQ(result.state, Interpreter::State::Error);
+		CHECK_EQ(cout.str(), "");
+
+		CHECK_EQ(Partial_Evaluation::specialize(residual.instructions, {}).instructions.size(), 2);	// PUSH -2; WRITE
+	}
+
+	SUBCASE ("Run") {
+		// Every engine has to stop where Loop does, the compiled ones by leaving it to Threaded
+		const auto run = [] (const std::string& program, const std::string& input = "", const Peephole::Level level = Peephole::Level::None) {
+			const auto checked = [&] (Interpreter& interpreter, size_t) {
+				interpreter.arithmetic(Stack::Overflow::Error);
+				interpreter.optimize(level);
+			};
+			auto runs = compare_engines(program, input, { ENGINES.begin(), ENGINES.end() }, checked);
+			return std::pair{ runs.results.front(), runs.output };
+		};
+
+		// PUSH_OP, DUP_OP and SWAP_OP leave it to the instructions
+		const auto add = run("0 PUSH 2147483647\n1 PUSH 1\n2 ADD\n3 WRITE\n");
+		CHECK_EQ(add.first.state, Interpreter::State::Error);
+		CHECK_EQ(add.first.top, 1);
+		CHECK_EQ(add.second, "");
+		CHECK_EQ(run("0 PUSH 65536\n1 DUP\n2 MUL\n").first.state, Interpreter::State::Error);
+		CHECK_EQ(run("0 PUSH 1\n1 PUSH -2147483648\n2 ROT 2\n3 SUB\n").first.state, Interpreter::State::Error);
+		CHECK_EQ(run("0 PUSH 1\n1 PUSH -2147483648\n2 SUB\n").first.state, Interpreter::State::Error);
+		CHECK_EQ(run("0 PUSH -1\n1 PUSH -2147483648\n2 SUB\n3 WRITE\n").second, std::to_string(min + 1) + ' ');
+
+		// Unknown, then fits after all
+		const auto fits = run("0 READ\n1 READ\n2 MUL\n3 WRITE\n", "-46340 46340");
+		CHECK_EQ(fits.first.state, Interpreter::State::Done);
+		CHECK_EQ(fits.second, std::to_string(-46340 * 46340) + ' ');
+		CHECK_EQ(run("0 READ\n1 READ\n2 MUL\n3 WRITE\n", "-46341 46341").first.state, Interpreter::State::Error);
+
+		// Neither dropped nor folded by Peephole
+		CHECK_EQ(run("0 READ\n1 READ\n2 MUL\n3 POP 1\n4 PUSH 1\n5 WRITE\n", "2147483647 2", Peephole::Level::Basic).first.state, Interpreter::State::Error);
+		const auto folded = run("0 PUSH 2147483647\n1 PUSH 2\n2 MUL\n3 WRITE\n", "", Peephole::Level::Fold);
+		CHECK_EQ(folded.first.state, Interpreter::State::Error);
+		CHECK_EQ(folded.second, "");
+
+		// Runs its loops as kernels as long as they fit
+		const auto naive_factorial_path = fs::current_path() / "interpreter.naive_factorial.txt";
+		REQUIRE_MESSAGE(fs::exists(naive_factorial_path), naive_factorial_path);
+		auto naive_factorial = std::ostringstream{};
+		naive_factorial << std::ifstream{naive_factorial_path}.rdbuf();
+		const auto twelve = run(naive_factorial.str(), "12");
+		CHECK_EQ(twelve.first.state, Interpreter::State::Done);
+		CHECK_EQ(twelve.second, "479001600 ");
+		CHECK_EQ(run(naive_factorial.str(), "13").first.state, Interpreter::State::Error);
+
+		// Long enough to be traced and tiered up before it overflows, by a constant and by a value
+		const auto constant = run("0 PUSH 0\n1 PUSH 30000000\n2 ADD\n3 DUP\n4 WRITE\n5 PUSH 0\n6 PUSH 1\n7 JMPZ\n");
+		CHECK_EQ(constant.first.state, Interpreter::State::Error);
+		CHECK_EQ(constant.first.top, 30000000);
+		const auto value = run("0 READ\n1 PUSH 0\n2 ROT 2\n3 DUP\n4 ROT 3\n5 ADD\n6 DUP\n7 WRITE\n8 PUSH 0\n9 PUSH 2\n10 JMPZ\n", "30000000");
+		CHECK_EQ(value.first.state, Interpreter::State::Error);
+		CHECK_EQ(value.first.top, 30000000);
+	}
+}
+
+TEST_CASE ("Verifier") {
+	auto program = std::istringstream{R"end(
+		0 PUSH 3
+		1 DUP 7
+		2 PUSH 1
+		3 SUB
+		4 DUP
+		5 PUSH 12
+		6 JMPZ
+		7 POP
+		8 PUSH 0
+		9 PUSH 1
+		10 JMPZ 2
+		11 WRITE
+	)end"};
+	const auto verified = Verifier::verify(Interpreter::parse(program));
+
+	CHECK_EQ(verified.stray_arguments, 2);
+	CHECK_FALSE(verified.instructions[1].arg.has_value());
+	CHECK_FALSE(verified.instructions[10].arg.has_value());
+	CHECK_EQ(verified.missing_arguments, std::vector<size_t>{7});
+	CHECK_EQ(verified.bad_jumps, std::vector<size_t>{6});
+
+	// A stray argument is only reported by the Verifier, missing ones still fail when they run
+	for (const auto engine : ENGINES) {
+		CAPTURE(engine);
+
+		auto cin = std::istringstream{};
+		auto cout = std::ostringstream{};
+		auto interpreter = Interpreter{cin, cout};
+		REQUIRE(interpreter.prepare(verified.instructions));
+
+		auto result = Interpreter::Execution_Result{};
+		REQUIRE(interpreter.run([&] (auto&& execution_result) { result = execution_result; }, engine));
+		CHECK_EQ(result.state, Interpreter::State::Error);
+		CHECK_EQ(result.top, -2);	// SUB is TOP - SECOND
+	}
+
+	// POP and ROT of 0 or less always fail, the same way on every engine
+	for (const auto* const bad : { "POP 0", "POP -1", "ROT 0", "ROT -2" }) {
+		CAPTURE(bad);
+		const auto program = "0 PUSH 7\n1 PUSH 3\n2 "s + bad + "\n3 WRITE\n";
+		auto program_ss = std::istringstream{program};
+		CHECK_EQ(Verifier::verify(Interpreter::parse(program_ss)).bad_arguments, std::vector<size_t>{2});
+
+		const auto runs = compare_engines(program, "", { ENGINES.begin(), ENGINES.end() });
+		CHECK_EQ(runs.results.front().state, Interpreter::State::Error);
+		CHECK_EQ(runs.results.front().top, 3);
+		CHECK_EQ(runs.output, "");
+	}
+}
+
+TEST_CASE ("Peephole") {
+	const auto optimize = [] (const std::string& program, const Peephole::Level level) {
+		auto program_ss = std::istringstream{program};
+		auto optimized = std::ostringstream{};
+		for (const auto& instr : Peephole::optimize(Interpreter::parse(program_ss), level))
+			optimized << instr << '\n';
+		return optimized.str();
+	};
+	const auto expected = [&] (const std::string& program) {
+		return optimize(program, Peephole::Level::None);
+	};
+
+	SUBCASE ("Fold") {
+		const auto program = "0 PUSH 2\n1 PUSH 3\n2 SUB\n3 PUSH 4\n4 MUL\n5 WRITE\n";
+		CHECK_EQ(optimize(program, Peephole::Level::Fold), expected("0 PUSH 4\n1 WRITE\n"));
+		CHECK_EQ(optimize(program, Peephole::Level::Basic), expected(program));
+	}
+
+	SUBCASE ("Nothing") {
+		const auto program = "0 READ\n1 ROT 1\n2 DUP\n3 POP 1\n4 PUSH 7\n5 POP 1\n6 ROT 2\n7 ROT 2\n8 WRITE\n";
+		CHECK_EQ(optimize(program, Peephole::Level::Basic), expected("0 READ\n1 ROT 2\n2 ROT 2\n3 WRITE\n"));	// Only 1 value for ROT 2
+	}
+
+	SUBCASE ("Only what cannot fail") {
+		// Once ROT 1 did not fail there is something to DUP
+		CHECK_EQ(optimize("0 ROT 1\n1 DUP\n2 POP 1\n", Peephole::Level::Fold), expected("0 ROT 1\n"));
+	}
+
+	SUBCASE ("Jumps") {
+		// Straight to 9, which leaves 8 behind and the second jump going nowhere but the next instruction
+		const auto program = R"end(
+			0 READ
+			1 DUP
+			2 PUSH 5
+			3 JMPZ
+			4 ROT 1
+			5 PUSH 0
+			6 PUSH 9
+			7 JMPZ
+			8 WRITE
+			9 WRITE
+		)end";
+		CHECK_EQ(optimize(program, Peephole::Level::Basic), expected("0 READ\n1 DUP\n2 PUSH 4\n3 JMPZ\n4 WRITE\n"));
+	}
+
+	SUBCASE ("Dead code") {
+		auto program_ss = std::istringstream{"0 PUSH 0\n1 PUSH 4\n2 JMPZ\n3 POP 1\n4 READ\n5 PUSH 1\n6 POP 0\n7 WRITE\n8 WRITE\n"};
+		auto lines = std::vector<size_t>{};
+		auto optimized = std::ostringstream{};
+		for (const auto& instr : Peephole::optimize(Interpreter::parse(program_ss), Peephole::Level::Basic, lines))
+			optimized << instr << '\n';
+		CHECK_EQ(optimized.str(), expected("0 READ\n1 PUSH 1\n2 POP 0\n"));	// POP 0 always fails
+		CHECK_EQ(lines, std::vector<size_t>{ 4, 5, 6 });
+
+		auto cin = std::istringstream{"7"};
+		auto cout = std::ostringstream{};
+		auto interpreter = Interpreter{cin, cout};
+		interpreter.optimize(Peephole::Level::Basic);
+		program_ss = std::istringstream{"0 PUSH 0\n1 PUSH 4\n2 JMPZ\n3 POP 1\n4 READ\n5 WRITE\n"};
+		REQUIRE(interpreter.prepare(program_ss));
+		CHECK_EQ(interpreter.line(1), 5);
+		CHECK(interpreter.run([] (auto&&) {}));
+		CHECK_EQ(cout.str(), "7 ");
+	}
+
+	SUBCASE ("Cancel out") {
+		const auto program = "0 READ\n1 READ\n2 DUP\n3 POP 3\n4 READ\n5 READ\n6 ADD\n7 POP 1\n8 POP 1\n9 PUSH 1\n";
+		CHECK_EQ(optimize(program, Peephole::Level::Basic), expected("0 READ\n1 READ\n2 POP 2\n3 READ\n4 READ\n5 POP 2\n6 POP 1\n7 PUSH 1\n"));	// The last POP could fail
+	}
+
+	SUBCASE ("Propagate") {
+		const auto program = "0 PUSH 1\n1 DUP\n2 PUSH 2\n3 EQ\n4 PUSH 6\n5 JMPZ\n6 WRITE\n";
+		CHECK_EQ(optimize(program, Peephole::Level::Fold), expected(program));
+		CHECK_EQ(optimize(program, Peephole::Level::Propagate), expected("0 PUSH 1\n1 WRITE\n"));
+	}
+
+	SUBCASE ("Jumps around in circles") {
+		const auto program = "0 PUSH 0\n1 PUSH 3\n2 JMPZ\n3 PUSH 0\n4 PUSH 0\n5 JMPZ\n";
+		CHECK_EQ(optimize(program, Peephole::Level::Fold), expected("0 PUSH 0\n1 PUSH 0\n2 JMPZ\n"));	// Only the first jump goes nowhere
+	}
+
+	SUBCASE ("Naive Factorial") {
+		const auto naive_factorial_path = fs::current_path() / "interpreter.naive_factorial.txt";
+		REQUIRE_MESSAGE(fs::exists(naive_factorial_path), naive_factorial_path);
+
+		for (const auto level : { Peephole::Level::Fold, Peephole::Level::Propagate })
+		for (const auto input : { -3, 0, 1, 5, 10 }) {
+			CAPTURE(level);
+			CAPTURE(input);
+			auto cin = std::istringstream{std::to_string(input)};
+			auto cout = std::ostringstream{};
+			auto interpreter = Interpreter{cin, cout};
+			interpreter.optimize(level);
+
+			auto program = std::ifstream{naive_factorial_path};
+			REQUIRE(interpreter.prepare(program));
+			REQUIRE(interpreter.run([] (auto&&) {}));
+			CHECK_EQ(cout.str(), std::to_string(input < 0 ? 0 : simple_factorial(input)) + ' ');
+		}
+	}
+}
+
+TEST_CASE ("Constant Propagation") {
+	const auto analyze = [] (const std::string& program) {
+		auto program_ss = std::istringstream{program};
+		return Constant_Propagation::analyze(Interpreter::parse(program_ss));
+	};
+
+	SUBCASE ("Inverted comparisons") {
+		const auto constants = analyze("0 PUSH 3\n1 DUP\n2 PUSH 1\n3 EQ\n4 PUSH 3\n5 PUSH 2\n6 GT\n7 WRITE\n");
+		CHECK_EQ(constants.top(3), 1);
+		CHECK_EQ(constants.top(3, 1), 3);
+		CHECK_EQ(constants.top(4), 1);	// 1 != 3
+		CHECK_EQ(constants.top(7), 1);	// 2 > 3 is false
+	}
+
+	SUBCASE ("Known branches") {
+		const auto constants = analyze("0 PUSH 1\n1 PUSH 0\n2 PUSH 5\n3 JMPZ\n4 PUSH 2\n5 DUP\n6 WRITE\n");
+		CHECK_FALSE(constants.at[4].has_value());
+		CHECK_EQ(constants.top(5), 1);
+	}
+
+	SUBCASE ("Joins") {
+		const auto constants = analyze("0 READ\n1 PUSH 4\n2 ROT 2\n3 PUSH 7\n4 JMPZ\n5 POP 1\n6 PUSH 5\n7 PUSH 9\n8 WRITE\n");
+		CHECK_EQ(constants.top(5), 4);
+		CHECK_FALSE(constants.top(7).has_value());
+		CHECK_EQ(constants.top(8), 9);
+	}
+
+	SUBCASE ("Deep ROT") {
+		const auto constants = analyze("0 PUSH 3\n1 PUSH 1\n2 ROT 2147483647\n3 WRITE\n");
+		CHECK_EQ(constants.top(3), 3);
+		CHECK_FALSE(constants.top(3, 1).has_value());
+	}
+
+	SUBCASE ("Computed jumps") {
+		const auto constants = analyze("0 PUSH 1\n1 PUSH 0\n2 READ\n3 JMPZ\n");
+		CHECK(constants.dynamic);
+		CHECK_FALSE(constants.top(1).has_value());
+	}
+}
+
+// Every engine has to agree with Engine::Loop on whatever a program does, errors included
+TEST_CASE ("Interpreter Random Programs") {
+	constexpr auto PROGRAMS = 500;
+	constexpr auto ops = std::array{
+		"READ", "WRITE", "DUP", "MUL", "ADD", "SUB", "GT", "LT", "EQ", "JMPZ", "PUSH", "POP", "ROT",
+	};
+
+	std::srand(42);
+	const auto random = [] (const int n) { return std::rand() % n; };
+
+	for (auto p = 0; p < PROGRAMS; ++p) {
+		// Forward jumps only and never straight onto a JMPZ, so everything terminates
+		auto program = std::ostringstream{};
+		const auto size = 8 + random(24);
+		auto targets = std::vector<bool>(static_cast<size_t>(size) + 1, false);
+		for (auto i = 0; i < size; ++i) {
+			if (i < 4) {	// Something to work on, most programs would just underflow otherwise
+				program << i << " PUSH " << random(12) - 3 << '\n';
+				continue;
+			}
+
+			auto op = std::string_view{ops[static_cast<size_t>(random(static_cast<int>(ops.size())))]};
+			if (op == "JMPZ" and (i + 2 >= size or targets[static_cast<size_t>(i + 2)]))
+				op = "WRITE";
+			else if (op == "JMPZ") {
+				const auto target = i + 3 + random(size - i - 2);
+				targets[static_cast<size_t>(target)] = true;
+				program << i << " PUSH " << random(3) << '\n';
+				++i;
+				program << i << " PUSH " << target << '\n';
+				++i;
+			}
+			program << i << ' ' << op;
+			if (op == "PUSH")
+				program << ' ' << random(12) - 3;
+			else if (op == "POP" or op == "ROT")
+				program << ' ' << std::array{-1, 1, 2, 3, 4}[static_cast<size_t>(random(5))];	// Stack asserts against 0
+			program << '\n';
+		}
+		CAPTURE(program.str());
+
+		auto expected_output = std::string{};
+		auto expected = Interpreter::Execution_Result{};
+		for (const auto engine : ENGINES) {
+			if (engine == Interpreter::Engine::Native)
+				continue;	// A compiler run per program is too slow for this many
+			CAPTURE(engine);
+
+			auto cin = std::istringstream{"3 -2 7 0 5"};
+			auto cout = std::ostringstream{};
+			auto interpreter = Interpreter{cin, cout};
+
+			auto program_ss = std::istringstream{program.str()};
+			REQUIRE(interpreter.prepare(program_ss));
+
+			auto result = Interpreter::Execution_Result{};
+			REQUIRE(interpreter.run([&] (auto&& execution_result) { result = execution_result; }, engine));
+
+			if (engine == ENGINES.front()) {
+				expected_output = cout.str();
+				expected = result;
+			}
+			else {
+				CHECK_EQ(cout.str(), expected_output);
+				CHECK_EQ(result.state, expected.state);
+				CHECK_EQ(result.top, expected.top);
+			}
+		}
+
+		// And so does the same program once it is optimized
+		for (const auto level : { Peephole::Level::Basic, Peephole::Level::Fold, Peephole::Level::Propagate }) {
+			CAPTURE(level);
+
+			auto cin = std::istringstream{"3 -2 7 0 5"};
+			auto cout = std::ostringstream{};
+			auto interpreter = Interpreter{cin, cout};
+			interpreter.optimize(level);
+
+			auto program_ss = std::istringstream{program.str()};
+			REQUIRE(interpreter.prepare(program_ss));
+
+			auto result = Interpreter::Execution_Result{};
+			REQUIRE(interpreter.run([&] (auto&& execution_result) { result = execution_result; }, Interpreter::Engine::Threaded));
+			CHECK_EQ(cout.str(), expected_output);
+			CHECK_EQ(result.state, expected.state);
+			CHECK_EQ(result.top, expected.top);
+		}
+	}
+}
@@ -0,0 +1,76 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#define DOCTEST_CONFIG_SUPER_FAST_ASSERTS
+#include "doctest.h"
+
+#include <sstream>
+#include <fstream>
+#include <filesystem>
+namespace fs = std::filesystem;
+
+#include "interpreter.hpp"
+
+// Generated by sage_transpile, see test/CMakeLists.txt
+#include "naive_factorial.hpp"
+#include "naive_factorial_small.hpp"
+
+using namespace std::literals;
+
+auto naive_factorial_program() -> std::string {
+	const auto path = fs::current_path() / "interpreter.naive_factorial.txt";
+	REQUIRE_MESSAGE(fs::exists(path), path);
+
+	auto program = std::ostringstream{};
+	program << std::ifstream{path}.rdbuf();
+	return program.str();
+}
+
+struct Outcome {
+	std::string output;
+	Interpreter::Execution_Result result;
+};
+
+auto run(Interpreter& interpreter, std::istringstream& cin, std::ostringstream& cout, const Machine::Compiled compiled, const Interpreter::Integer input) -> Outcome {
+	cin.clear();
+	cin.str(std::to_string(input));
+	cout.str("");
+
+	auto result = Interpreter::Execution_Result{};
+	const auto callback = [&] (auto&& execution_result) { result = execution_result; };
+	if (compiled != nullptr)
+		REQUIRE(interpreter.run_compiled(compiled, callback));
+	else
+		REQUIRE(interpreter.run(callback));
+
+	return { cout.str(), result };
+}
+
+
+TEST_CASE ("Transpiler matches Interpreter") {
+	auto cin = std::istringstream{};
+	auto cout = std::ostringstream{};
+	auto interpreter = Interpreter{cin, cout};
+	auto compiled = Interpreter{cin, cout};
+
+	auto program = std::istringstream{naive_factorial_program()};
+	REQUIRE(interpreter.prepare(program));
+
+	// Both keep their stacks between runs, so they also have to agree on what is left behind
+	for (auto input = -5; input <= 120; ++input) {
+		CAPTURE(input);
+		const auto expected = run(interpreter, cin, cout, nullptr, input);
+		const auto actual = run(compiled, cin, cout, naive_factorial, input);
+
+		CHECK_EQ(actual.output, expected.output);
+		CHECK_EQ(actual.result.state, expected.result.state);
+		CHECK_EQ(actual.result.top, expected.result.top);
+	}
+}
+
+TEST_CASE ("Transpiler stack capacity") {
+	auto cin = std::istringstream{};
+	auto cout = std::ostringstream{};
+	auto compiled = Interpreter{cin, cout};
+
+	CHECK_EQ(run(compiled, cin, cout, naive_factorial_small, 5).output, "120 ");
+	CHECK_EQ(run(compiled, cin, cout, naive_factorial_small, 50).result.state, Interpreter::State::Error);
+}
@@ -0,0 +1,72 @@
+// Runs a training corpus through the interpreter, reports the most frequent opcode n-grams per
+// program and overall, and saves the superinstructions worth having for Interpreter::select()
+//
+// Usage: sage_profile <output> <program> <inputs> [<program> <inputs>]...
+//
+// Every line of an inputs file is one run of its program, fed to READ
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "interpreter.hpp"
+#include "profile.hpp"
+#include "superinstruction.hpp"
+
+constexpr auto TOP = size_t{10};
+
+auto report(const std::string& title, const Profile& profile) -> void {
+	std::cout << title << ": " << profile.executed << " instructions\n";
+	for (const auto& [gram, count] : profile.top(TOP))
+		std::cout << '\t' << count << '\t' << gram << '\n';
+}
+
+auto main(int argc, char** argv) -> int {
+	if (argc < 4 or argc % 2 != 0) {
+		std::cerr << "Usage: " << argv[0] << " <output> <program> <inputs> [<program> <inputs>]...\n";
+		return 1;
+	}
+
+	auto total = Profile{};
+	for (auto i = 2; i < argc; i += 2) {
+		auto program = std::ifstream{argv[i]};
+		auto inputs = std::ifstream{argv[i + 1]};
+		if (not program or not inputs) {
+			std::cerr << "Error: could not open " << argv[i] << " or " << argv[i + 1] << '\n';
+			return 1;
+		}
+
+		auto cin = std::stringstream{};
+		auto cout = std::ostringstream{};
+		auto interpreter = Interpreter{cin, cout};
+		if (not interpreter.prepare(program))
+			return 1;
+
+		auto profile = Profile{};
+		auto line = std::string{};
+		while (std::getline(inputs, line)) {
+			if (line.empty())
+				continue;
+
+			cin.clear();
+			cin.str(line);
+			interpreter.profile(profile, [] (auto&&) {});
+		}
+
+		report(argv[i], profile);
+		total.merge(profile);
+	}
+
+	report("Total", total);
+
+	const auto selection = Superinstruction::Selection::from(total);
+	auto output = std::ofstream{argv[1]};
+	selection.save(output);
+	if (not output) {
+		std::cerr << "Error: could not write " << argv[1] << '\n';
+		return 1;
+	}
+
+	selection.save(std::cout);
+}
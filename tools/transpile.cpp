@@ -0,0 +1,43 @@
+// Transpiles a program to a C++ header, see transpiler.hpp and cmake/sage_transpile.cmake
+//
+// Usage: sage_transpile <program> <function> <output header> [stack capacity]
+
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "interpreter.hpp"
+#include "transpiler.hpp"
+
+auto main(int argc, char** argv) -> int {
+	if (argc < 4 or argc > 5) {
+		std::cerr << "Usage: " << argv[0] << " <program> <function> <output header> [stack capacity]\n";
+		return 1;
+	}
+
+	auto program = std::ifstream{argv[1]};
+	if (not program) {
+		std::cerr << "Error: could not open " << argv[1] << '\n';
+		return 1;
+	}
+
+	const auto instructions = Interpreter::parse(program);
+	if (instructions.empty()) {
+		std::cerr << "Error: " << argv[1] << " has no instructions\n";
+		return 1;
+	}
+
+	auto options = Transpiler::Options{
+		.function = argv[2],
+		.source = argv[1],
+	};
+	if (argc == 5)
+		options.stack_capacity = std::stoul(argv[4]);
+
+	auto header = std::ofstream{argv[3]};
+	Transpiler::emit(instructions, options, header);
+	if (not header) {
+		std::cerr << "Error: could not write " << argv[3] << '\n';
+		return 1;
+	}
+}